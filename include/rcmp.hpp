@@ -1,6 +1,13 @@
 #pragma once
 
+#include "rcmp/batch.hpp"
 #include "rcmp/codegen.hpp"
+#include "rcmp/elf.hpp"
+#include "rcmp/hook_handle.hpp"
 #include "rcmp/memory.hpp"
+#include "rcmp/offset_cache.hpp"
+#include "rcmp/registry.hpp"
+#include "rcmp/scan.hpp"
 #include "rcmp/low_level.hpp"
 #include "rcmp/version.hpp"
+#include "rcmp/vtable.hpp"
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "detail/address.hpp"
+
+#include <functional>
+#include <vector>
+
+#include <cstddef>
+
+namespace rcmp {
+
+enum class patch_mode {
+    // Code is written as is, other threads must not execute it meanwhile
+    plain,
+
+    // x86/x86-64: breakpoint is written first, then the tail of patch, then its first byte.
+    // Threads hitting the breakpoint are redirected, so hooked code may be executed while it's patched.
+    // Before the tail is written, other threads are sampled (signal SIGRTMAX - 1 on Linux, suspension on Windows)
+    // until none of them is in the middle of patched code; commit fails if they don't leave it in time.
+    // Code generated for hooks uninstalled in this mode is never freed, other threads may be still running it.
+    live,
+};
+
+// Applies to all batches committed after the call.
+// Throws `rcmp::error` for `patch_mode::live` if other threads can't be made to refetch patched code (no membarrier on Linux).
+void set_patch_mode(patch_mode mode);
+
+// Whether `set_patch_mode(mode)` succeeds on this system
+bool is_patch_mode_supported(patch_mode mode) noexcept;
+
+patch_mode get_patch_mode() noexcept;
+
+// Collects memory writes of all hooks installed by the current thread while the batch is alive,
+// and applies them at once on `commit`: every affected page is made writable once, instruction cache is flushed once.
+// If the batch is destroyed without commit (or commit fails), nothing is written and installed hooks are undone.
+// Batches may be nested, committed inner batch passes everything to the outer one.
+class hook_batch {
+    struct write_t {
+        rcmp::address_t        where;
+        std::vector<std::byte> bytes;
+        rcmp::address_t        resume; // null for data
+    };
+
+    hook_batch*                        m_parent;
+    bool                               m_finished = false;
+    std::vector<write_t>               m_writes;
+    std::vector<std::function<void()>> m_rollback_callbacks;
+    std::vector<std::function<void()>> m_commit_callbacks;
+
+    void finish() noexcept;
+
+    void apply_writes() const;
+
+public:
+    hook_batch();
+
+    hook_batch(const hook_batch&) = delete;
+    hook_batch& operator=(const hook_batch&) = delete;
+    hook_batch(hook_batch&&) = delete;
+    hook_batch& operator=(hook_batch&&) = delete;
+
+    ~hook_batch();
+
+    void commit();
+
+    void rollback() noexcept;
+
+    // Innermost active batch of the calling thread, or null
+    static hook_batch* current() noexcept;
+
+    // Queues write of `size` bytes to `where`, see `rcmp::patch_code` for meaning of `resume`
+    void write(rcmp::address_t where, const void* bytes, std::size_t size, rcmp::address_t resume = nullptr);
+
+    // Reads memory as if all queued writes were already applied
+    void read(rcmp::address_t where, void* bytes, std::size_t size) const;
+
+    // `callback` is invoked (in reverse order) if the batch is rolled back
+    void on_rollback(std::function<void()> callback);
+
+    // `callback` is invoked once all queued writes are applied
+    void on_commit(std::function<void()> callback);
+};
+
+} // namespace rcmp
@@ -3,6 +3,7 @@
 #include "detail/hook_installer.hpp"
 #include "detail/address.hpp"
 #include "detail/hook_state.hpp"
+#include "hook_handle.hpp"
 
 #include <type_traits>
 #include <utility>
@@ -17,7 +18,18 @@ void generic_hook_function(rcmp::address_t original_address, Hook&& hook) {
     >::template install_hook<Policy>(original_address, std::forward<Hook>(hook));
 }
 
+template <template <class> class Policy, class Signature, class Hook>
+[[nodiscard]] rcmp::hook_handle generic_hook_function_scoped(rcmp::address_t original_address, Hook&& hook) {
+    return rcmp::hook_handle(detail::hook_installer<
+        to_generic_signature<Signature>,
+        std::decay_t<Hook>
+    >::template install_hook<Policy>(original_address, std::forward<Hook>(hook)));
+}
+
 } // namespace rcmp
 
 #include "detail/hook_policy/prolog_policy.hpp"
 #include "detail/hook_policy/indirect_policy.hpp"
+#include "detail/hook_policy/call_site_policy.hpp"
+#include "detail/hook_policy/import_policy.hpp"
+#include "detail/hook_policy/vtable_clone_policy.hpp"
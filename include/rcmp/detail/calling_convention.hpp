@@ -2,6 +2,8 @@
 
 #include "config.hpp"
 
+#include <type_traits>
+
 namespace rcmp {
 
 enum class cconv {
@@ -44,6 +46,16 @@ namespace detail {
         static_assert(sizeof(Signature) == 0, "Unable to replace function signature");
     };
 
+    // `wrapper(void* state, Args...)` takes `state` in a scratch register, and `Args...` exactly where
+    // a function of `GenericSignature` takes them, so generated stub may jump to it right from the hooked function
+    template <auto Function, class GenericSignature>
+    struct with_state_register_impl {
+        static_assert(sizeof(GenericSignature) == 0, "Unable to pass state in register for this signature");
+    };
+
+    template <class GenericSignature>
+    constexpr bool has_state_register_wrapper_v = false;
+
     // Simple case without pointer
     template <class Ret, class... Args>
     struct to_generic_signature_impl<Ret(Args...)> : to_generic_signature_impl<Ret(*)(Args...)> {};
@@ -144,6 +156,36 @@ namespace detail {
             return Function(static_cast<Args&&>(args)...);
         }
     };
+
+    #if RCMP_GET_COMPILER() == RCMP_COMPILER_GCC || RCMP_GET_COMPILER() == RCMP_COMPILER_CLANG
+        // First argument in eax, the rest on stack, as is: cdecl and stdcall functions leave eax free on entry
+        #define RCMP_DETAIL_STATE_IN_EAX __attribute__((regparm(1)))
+
+        // Values returned through hidden pointer would take eax from the state
+        template <class Ret>
+        constexpr bool is_returned_in_registers_v = std::is_void_v<Ret> || std::is_arithmetic_v<Ret> || std::is_enum_v<Ret> ||
+                                                    std::is_pointer_v<Ret> || std::is_null_pointer_v<Ret>;
+
+        template <class Ret, class... Args>
+        constexpr bool has_state_register_wrapper_v<generic_signature_t<Ret(Args...), cconv::cdecl_>> = is_returned_in_registers_v<Ret>;
+
+        template <class Ret, class... Args>
+        constexpr bool has_state_register_wrapper_v<generic_signature_t<Ret(Args...), cconv::stdcall_>> = is_returned_in_registers_v<Ret>;
+
+        template <auto Function, class Ret, class... Args>
+        struct with_state_register_impl<Function, generic_signature_t<Ret(Args...), cconv::cdecl_>> {
+            static Ret RCMP_DETAIL_CDECL RCMP_DETAIL_STATE_IN_EAX wrapper(void* state, Args... args) {
+                return Function(state, static_cast<Args&&>(args)...);
+            }
+        };
+
+        template <auto Function, class Ret, class... Args>
+        struct with_state_register_impl<Function, generic_signature_t<Ret(Args...), cconv::stdcall_>> {
+            static Ret RCMP_DETAIL_STDCALL RCMP_DETAIL_STATE_IN_EAX wrapper(void* state, Args... args) {
+                return Function(state, static_cast<Args&&>(args)...);
+            }
+        };
+    #endif
 #else
     #define RCMP_HAS_CDECL() 0
     #define RCMP_HAS_STDCALL() 0
@@ -175,6 +217,9 @@ using from_generic_signature = typename detail::from_generic_signature_impl<Gene
 template <auto Function, class Signature>
 constexpr auto with_signature = detail::with_signature_impl<Function, to_generic_signature<Signature>>::wrapper;
 
+template <auto Function, class Signature>
+constexpr auto with_state_register = detail::with_state_register_impl<Function, to_generic_signature<Signature>>::wrapper;
+
 #if RCMP_HAS_CDECL()
     template <> inline constexpr bool is_convention_supported<cconv::cdecl_> = true;
 
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+namespace rcmp::detail {
+
+// Epoch based reclamation. Readers enter the current epoch before reaching shared objects and leave it afterwards.
+// Object unlinked (retired) in epoch `E` may be destroyed once `is_reclaimable(E)`, i.e. the epoch has advanced twice:
+// each advance waits for readers entered before the previous one.
+class epoch_t {
+    std::atomic<std::size_t> m_epoch      = 0;
+    std::atomic<std::size_t> m_readers[2] = {}; // by parity of the epoch readers have entered
+
+public:
+    // Returns the epoch to pass to `leave`
+    std::size_t enter() noexcept {
+        for (;;) {
+            const auto epoch = m_epoch.load();
+            m_readers[epoch % 2].fetch_add(1);
+
+            // otherwise the epoch could have advanced past `epoch` without waiting for this reader
+            if (m_epoch.load() == epoch) {
+                return epoch;
+            }
+
+            m_readers[epoch % 2].fetch_sub(1);
+        }
+    }
+
+    void leave(std::size_t epoch) noexcept {
+        m_readers[epoch % 2].fetch_sub(1);
+    }
+
+    // Epoch to tag objects retired right now with
+    std::size_t current() const noexcept {
+        return m_epoch.load();
+    }
+
+    // Advances the epoch as far as readers allow, at most twice. Callers must be serialized.
+    void advance() noexcept {
+        for (int i = 0; i < 2; i++) {
+            const auto epoch = m_epoch.load();
+            if (m_readers[(epoch + 1) % 2].load() != 0) {
+                break;
+            }
+
+            m_epoch.store(epoch + 1);
+        }
+    }
+
+    bool is_reclaimable(std::size_t retired_in) const noexcept {
+        return retired_in + 2 <= m_epoch.load();
+    }
+};
+
+}
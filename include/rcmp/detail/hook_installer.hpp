@@ -5,11 +5,30 @@
 #include <rcmp/detail/hook_state.hpp>
 #include <rcmp/detail/scope_exit.hpp>
 #include <rcmp/low_level.hpp>
+#include <rcmp/batch.hpp>
+#include <rcmp/hook_handle.hpp>
 
+#include <memory>
+#include <new>
+#include <type_traits>
 #include <utility>
 
 namespace rcmp::detail {
 
+// Policy keeps the only state at a fixed address, so generated code may refer to it directly
+template <class Policy, class = void>
+constexpr bool has_global_state_v = false;
+
+template <class Policy>
+constexpr bool has_global_state_v<Policy, std::void_t<decltype(Policy::has_global_state)>> = Policy::has_global_state;
+
+// Policy's stub passes state to the wrapper directly, see `rcmp::with_state_register`
+template <class Policy, class = void>
+constexpr bool passes_state_in_register_v = false;
+
+template <class Policy>
+constexpr bool passes_state_in_register_v<Policy, std::void_t<decltype(Policy::passes_state_in_register)>> = Policy::passes_state_in_register;
+
 template <class GenericSignature, class Hook>
 class hook_installer;
 
@@ -29,15 +48,87 @@ class hook_installer<generic_signature_t<Ret(Args...), Convention>, Hook> {
         return state->call_hook(std::forward<Args>(args)...);
     }
 
+    // Empty hooks installed with global-state policies are called directly: the hook is never read,
+    // and the original function is a load from a fixed address - the same code as a hand-written detour
+    template <class Policy>
+    static constexpr bool use_direct_call_v = is_empty_hook_v<hook_t> && has_global_state_v<Policy>;
+
+    // Captureless lambdas aren't default constructible in C++17, so the copy passed to `install_hook` is kept here
+    template <class Policy>
+    union empty_hook_storage_t {
+        char   unused;
+        hook_t hook;
+
+        constexpr empty_hook_storage_t() noexcept : unused() {}
+    };
+
+    template <class Policy>
+    inline static empty_hook_storage_t<Policy> g_empty_hook;
+
+    template <class Policy>
+    static Ret call_empty_hook(Args... args) {
+        return g_empty_hook<Policy>.hook(Policy::get_state()->original, std::forward<Args>(args)...);
+    }
+
+    static Ret call_hook_with_state(void* state, Args... args) {
+        return static_cast<state_t*>(state)->call_hook(std::forward<Args>(args)...);
+    }
+
+    template <class Policy>
+    static constexpr auto wrapper_function() {
+        if constexpr (use_direct_call_v<Policy>) {
+            return with_signature<call_empty_hook<Policy>, generic_sig_t>;
+        }
+        else if constexpr (passes_state_in_register_v<Policy>) {
+            return with_state_register<call_hook_with_state, generic_sig_t>;
+        }
+        else {
+            return with_signature<call_hook<Policy>, generic_sig_t>;
+        }
+    }
+
 public:
     template <template <class HookState> class Policy>
-    static void install_hook(rcmp::address_t address, hook_t hook) {
+    static std::shared_ptr<hook_record> install_hook(rcmp::address_t address, hook_t hook) {
         using policy_t = Policy<state_t>;
-        constexpr original_sig_t hook_with_fixed_cconv = with_signature<call_hook<policy_t>, generic_sig_t>;
+        constexpr auto hook_with_fixed_cconv = wrapper_function<policy_t>();
+
+        // Joins batch created by user (if any), otherwise hook is installed right away
+        rcmp::hook_batch batch;
+
+        auto record = std::make_shared<hook_record>();
+        batch.on_rollback([record] { record->release_resources(); });
 
         const auto state = policy_t::allocate_state(address);
-        state->hook.emplace(std::move(hook));
-        state->original = policy_t::install_raw_hook(state, address, rcmp::bit_cast<void*>(hook_with_fixed_cconv)).template as<original_sig_t>();
+        record->state        = state;
+        record->original_ref = &state->original;
+        record->free_state = [](void* state_to_free) noexcept { policy_t::free_state(static_cast<state_t*>(state_to_free)); };
+
+        record->hook_type = type_id<hook_t>();
+
+        if constexpr (use_direct_call_v<policy_t>) {
+            // trivially destructible, nothing to undo on uninstallation
+            ::new (static_cast<void*>(&g_empty_hook<policy_t>.hook)) hook_t(std::move(hook));
+
+            // all instances of empty hook behave the same, there's nothing to replace
+            record->replace_hook  = [](void*, void*) {};
+            record->reclaim_hooks = [](void*) noexcept {};
+        }
+        else {
+            state->emplace(std::move(hook));
+
+            record->replace_hook = [](void* state_to_update, void* new_hook) {
+                static_cast<state_t*>(state_to_update)->replace(std::move(*static_cast<hook_t*>(new_hook)));
+            };
+            record->reclaim_hooks = [](void* state_to_update) noexcept {
+                static_cast<state_t*>(state_to_update)->reclaim();
+            };
+        }
+        state->original = policy_t::install_raw_hook(state, address, rcmp::bit_cast<void*>(hook_with_fixed_cconv), *record).template as<original_sig_t>();
+
+        batch.commit();
+
+        return record;
     }
 };
 
@@ -0,0 +1,173 @@
+#pragma once
+
+#include "with_global_state.hpp"
+#include "prolog_policy.hpp"
+
+#include <utility>
+#include <vector>
+
+namespace rcmp {
+
+namespace detail {
+
+#if RCMP_GET_ARCH() == RCMP_ARCH_X86 || RCMP_GET_ARCH() == RCMP_ARCH_X86_64
+
+#define RCMP_HAS_HOOK_CALL_SITE_POLICY
+
+// Retargets a single `call rel32` or `call [rip + X]` (`call [X]` on x86) instruction to `wrapper_function`,
+// returns its previous destination. Other callers of the same function aren't affected.
+rcmp::address_t install_x86_x86_64_call_site_hook(rcmp::address_t call_site, rcmp::address_t wrapper_function, hook_record& record);
+
+struct HookCallSiteStatelessPolicy {
+    static rcmp::address_t install_stateless_hook(rcmp::address_t address, rcmp::address_t wrapper_function, hook_record& record) {
+        // `address` is an address of call instruction
+        return install_x86_x86_64_call_site_hook(address, wrapper_function, record);
+    }
+};
+
+struct function_call_sites_t {
+    rcmp::address_t                     function;
+    const std::vector<rcmp::address_t>& call_sites;
+};
+
+// Installs prolog hook, then retargets given `call/jmp rel32` instructions from `original_function` to its dispatcher,
+// so these callers skip entry jump, but still see every enabled hook. Throws `rcmp::error` if some call site isn't such a branch.
+rcmp::address_t install_x86_x86_64_hook_with_call_sites(const function_call_sites_t& function, rcmp::address_t wrapper_function, hook_record& record);
+
+struct HookPrologAndCallSitesStatelessPolicy {
+    static rcmp::address_t install_stateless_hook(rcmp::address_t address, rcmp::address_t wrapper_function, hook_record& record) {
+        // `address` is an address of `function_call_sites_t`, that lives until the hook is installed
+        return install_x86_x86_64_hook_with_call_sites(*address.as_ptr<const function_call_sites_t>(), wrapper_function, record);
+    }
+};
+
+#endif
+
+}
+
+#if defined(RCMP_HAS_HOOK_CALL_SITE_POLICY)
+
+// Hooks calls made by a single instruction, `original` is the function it called before.
+// Hooks of the same call site may be uninstalled only in reverse order of installation.
+
+template <class Tag, class Signature, class F>
+void hook_call_site(rcmp::address_t call_address, F&& hook) {
+    using wrapped_policy_t = detail::WithGlobalState<
+        detail::HookCallSiteStatelessPolicy,
+        Tag
+    >;
+    rcmp::generic_hook_function<wrapped_policy_t::template Policy, Signature>(call_address, std::forward<F>(hook));
+}
+
+template <auto CallAddress, class Signature, class F>
+void hook_call_site(F&& hook) {
+    static_assert(std::is_constructible_v<rcmp::address_t, decltype(CallAddress)>);
+
+    using Tag = std::integral_constant<decltype(CallAddress), CallAddress>;
+    rcmp::hook_call_site<Tag, Signature>(CallAddress, std::forward<F>(hook));
+}
+
+template <class Signature, class F>
+void hook_call_site(rcmp::address_t call_address, F&& hook) {
+    rcmp::hook_call_site<class Tag, Signature>(call_address, std::forward<F>(hook));
+}
+
+// Same as `hook_call_site`, but the hook is uninstalled when returned handle is destroyed
+
+template <class Tag, class Signature, class F>
+[[nodiscard]] rcmp::hook_handle hook_call_site_scoped(rcmp::address_t call_address, F&& hook) {
+    using wrapped_policy_t = detail::WithGlobalState<
+        detail::HookCallSiteStatelessPolicy,
+        Tag
+    >;
+    return rcmp::generic_hook_function_scoped<wrapped_policy_t::template Policy, Signature>(call_address, std::forward<F>(hook));
+}
+
+template <auto CallAddress, class Signature, class F>
+[[nodiscard]] rcmp::hook_handle hook_call_site_scoped(F&& hook) {
+    static_assert(std::is_constructible_v<rcmp::address_t, decltype(CallAddress)>);
+
+    using Tag = std::integral_constant<decltype(CallAddress), CallAddress>;
+    return rcmp::hook_call_site_scoped<Tag, Signature>(CallAddress, std::forward<F>(hook));
+}
+
+template <class Signature, class F>
+[[nodiscard]] rcmp::hook_handle hook_call_site_scoped(rcmp::address_t call_address, F&& hook) {
+    return rcmp::hook_call_site_scoped<class Tag, Signature>(call_address, std::forward<F>(hook));
+}
+
+// Same as `hook_function`, but `call_sites` (direct calls and jumps to the function, i.e. found by `find_direct_branches`
+// and checked by the caller) are retargeted to its dispatcher: hot callers don't pass through entry jump.
+// Retargeted callers see every hook of the function, including ones installed later.
+
+template <class Tag, class Signature, class F>
+void hook_function_and_call_sites(rcmp::address_t function_address, const std::vector<rcmp::address_t>& call_sites, F&& hook) {
+    using wrapped_policy_t = detail::WithGlobalState<
+        detail::HookPrologAndCallSitesStatelessPolicy,
+        Tag
+    >;
+    const detail::function_call_sites_t function{ function_address, call_sites };
+    rcmp::generic_hook_function<wrapped_policy_t::template Policy, Signature>(&function, std::forward<F>(hook));
+}
+
+template <auto FunctionAddress, class Signature, class F>
+void hook_function_and_call_sites(const std::vector<rcmp::address_t>& call_sites, F&& hook) {
+    static_assert(std::is_constructible_v<rcmp::address_t, decltype(FunctionAddress)>);
+
+    using Tag = std::integral_constant<decltype(FunctionAddress), FunctionAddress>;
+    rcmp::hook_function_and_call_sites<Tag, Signature>(FunctionAddress, call_sites, std::forward<F>(hook));
+}
+
+template <auto Function, class F>
+void hook_function_and_call_sites(const std::vector<rcmp::address_t>& call_sites, F&& hook) {
+    using Signature = decltype(Function);
+
+    static_assert(std::is_pointer_v<Signature>,                            "Function is not a _pointer_ to function. Did you forget to specify signature? (rcmp::hook_function_and_call_sites<.., Signature>(..) overload)");
+    static_assert(detail::is_function_v<std::remove_pointer_t<Signature>>, "Function is not a pointer to _function_. Did you forget to specify signature? (rcmp::hook_function_and_call_sites<.., Signature>(..) overload)");
+
+    using Tag = std::integral_constant<Signature, Function>;
+    rcmp::hook_function_and_call_sites<Tag, Signature>(rcmp::bit_cast<const void*>(Function), call_sites, std::forward<F>(hook));
+}
+
+template <class Signature, class F>
+void hook_function_and_call_sites(rcmp::address_t function_address, const std::vector<rcmp::address_t>& call_sites, F&& hook) {
+    rcmp::hook_function_and_call_sites<class Tag, Signature>(function_address, call_sites, std::forward<F>(hook));
+}
+
+template <class Tag, class Signature, class F>
+[[nodiscard]] rcmp::hook_handle hook_function_and_call_sites_scoped(rcmp::address_t function_address, const std::vector<rcmp::address_t>& call_sites, F&& hook) {
+    using wrapped_policy_t = detail::WithGlobalState<
+        detail::HookPrologAndCallSitesStatelessPolicy,
+        Tag
+    >;
+    const detail::function_call_sites_t function{ function_address, call_sites };
+    return rcmp::generic_hook_function_scoped<wrapped_policy_t::template Policy, Signature>(&function, std::forward<F>(hook));
+}
+
+template <auto FunctionAddress, class Signature, class F>
+[[nodiscard]] rcmp::hook_handle hook_function_and_call_sites_scoped(const std::vector<rcmp::address_t>& call_sites, F&& hook) {
+    static_assert(std::is_constructible_v<rcmp::address_t, decltype(FunctionAddress)>);
+
+    using Tag = std::integral_constant<decltype(FunctionAddress), FunctionAddress>;
+    return rcmp::hook_function_and_call_sites_scoped<Tag, Signature>(FunctionAddress, call_sites, std::forward<F>(hook));
+}
+
+template <auto Function, class F>
+[[nodiscard]] rcmp::hook_handle hook_function_and_call_sites_scoped(const std::vector<rcmp::address_t>& call_sites, F&& hook) {
+    using Signature = decltype(Function);
+
+    static_assert(std::is_pointer_v<Signature>,                            "Function is not a _pointer_ to function. Did you forget to specify signature? (rcmp::hook_function_and_call_sites_scoped<.., Signature>(..) overload)");
+    static_assert(detail::is_function_v<std::remove_pointer_t<Signature>>, "Function is not a pointer to _function_. Did you forget to specify signature? (rcmp::hook_function_and_call_sites_scoped<.., Signature>(..) overload)");
+
+    using Tag = std::integral_constant<Signature, Function>;
+    return rcmp::hook_function_and_call_sites_scoped<Tag, Signature>(rcmp::bit_cast<const void*>(Function), call_sites, std::forward<F>(hook));
+}
+
+template <class Signature, class F>
+[[nodiscard]] rcmp::hook_handle hook_function_and_call_sites_scoped(rcmp::address_t function_address, const std::vector<rcmp::address_t>& call_sites, F&& hook) {
+    return rcmp::hook_function_and_call_sites_scoped<class Tag, Signature>(function_address, call_sites, std::forward<F>(hook));
+}
+
+#endif
+
+}
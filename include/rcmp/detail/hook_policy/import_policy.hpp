@@ -0,0 +1,96 @@
+#pragma once
+
+#include "with_global_state.hpp"
+
+#include <rcmp/elf.hpp>
+
+#include <utility>
+
+namespace rcmp {
+
+namespace detail {
+
+#if defined(RCMP_HAS_ELF)
+
+#define RCMP_HAS_HOOK_IMPORT_POLICY
+
+struct import_t {
+    const char* module; // see `rcmp::find_import_slots`
+    const char* symbol;
+};
+
+// Writes `wrapper_function` to every GOT entry of the import, returns the function it's bound to.
+// Throws `rcmp::error` if no module imports the symbol.
+rcmp::address_t install_import_hook(const import_t& import, rcmp::address_t wrapper_function, hook_record& record);
+
+struct HookImportStatelessPolicy {
+    static rcmp::address_t install_stateless_hook(rcmp::address_t address, rcmp::address_t wrapper_function, hook_record& record) {
+        // `address` is an address of `import_t`, that lives until the hook is installed
+        return install_import_hook(*address.as_ptr<const import_t>(), wrapper_function, record);
+    }
+};
+
+#endif
+
+}
+
+#if defined(RCMP_HAS_HOOK_IMPORT_POLICY)
+
+// Hooks calls of `symbol` made by `module` (or every loaded module) through GOT, no code is patched.
+// Modules loaded after installation aren't affected. `original` is the function the first bound entry refers to.
+
+template <class Tag, class Signature, class F>
+void hook_import(const char* module, const char* symbol, F&& hook) {
+    using wrapped_policy_t = detail::WithGlobalState<
+        detail::HookImportStatelessPolicy,
+        Tag
+    >;
+    const detail::import_t import{ module, symbol };
+    rcmp::generic_hook_function<wrapped_policy_t::template Policy, Signature>(&import, std::forward<F>(hook));
+}
+
+template <class Tag, class Signature, class F>
+void hook_import(const char* symbol, F&& hook) {
+    rcmp::hook_import<Tag, Signature>(nullptr, symbol, std::forward<F>(hook));
+}
+
+template <class Signature, class F>
+void hook_import(const char* module, const char* symbol, F&& hook) {
+    rcmp::hook_import<class Tag, Signature>(module, symbol, std::forward<F>(hook));
+}
+
+template <class Signature, class F>
+void hook_import(const char* symbol, F&& hook) {
+    rcmp::hook_import<class Tag, Signature>(nullptr, symbol, std::forward<F>(hook));
+}
+
+// Same as `hook_import`, but the hook is uninstalled when returned handle is destroyed
+
+template <class Tag, class Signature, class F>
+[[nodiscard]] rcmp::hook_handle hook_import_scoped(const char* module, const char* symbol, F&& hook) {
+    using wrapped_policy_t = detail::WithGlobalState<
+        detail::HookImportStatelessPolicy,
+        Tag
+    >;
+    const detail::import_t import{ module, symbol };
+    return rcmp::generic_hook_function_scoped<wrapped_policy_t::template Policy, Signature>(&import, std::forward<F>(hook));
+}
+
+template <class Tag, class Signature, class F>
+[[nodiscard]] rcmp::hook_handle hook_import_scoped(const char* symbol, F&& hook) {
+    return rcmp::hook_import_scoped<Tag, Signature>(nullptr, symbol, std::forward<F>(hook));
+}
+
+template <class Signature, class F>
+[[nodiscard]] rcmp::hook_handle hook_import_scoped(const char* module, const char* symbol, F&& hook) {
+    return rcmp::hook_import_scoped<class Tag, Signature>(module, symbol, std::forward<F>(hook));
+}
+
+template <class Signature, class F>
+[[nodiscard]] rcmp::hook_handle hook_import_scoped(const char* symbol, F&& hook) {
+    return rcmp::hook_import_scoped<class Tag, Signature>(nullptr, symbol, std::forward<F>(hook));
+}
+
+#endif
+
+}
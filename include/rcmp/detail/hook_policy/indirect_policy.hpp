@@ -15,12 +15,47 @@ namespace detail {
 #define RCMP_HAS_HOOK_INDIRECT_POLICY
 
 struct HookIndirectStatelessPolicy {
-    static rcmp::address_t install_stateless_hook(rcmp::address_t address, rcmp::address_t wrapper_function) {
+    static rcmp::address_t install_stateless_hook(rcmp::address_t address, rcmp::address_t wrapper_function, hook_record& record) {
         // `address` is an address of memory region (`sizeof(void*)` bytes) storing address of function body
-        auto& function_address_ref = *address.as_ptr<rcmp::address_t>();
+        rcmp::address_t original_function;
+        rcmp::read_memory(address, &original_function, sizeof(original_function));
+        rcmp::write_memory(address, &wrapper_function, sizeof(wrapper_function));
 
-        rcmp::unprotect_memory(&function_address_ref, sizeof(function_address_ref));
-        return std::exchange(function_address_ref, wrapper_function);
+        // Disabled hook isn't in the slot anymore, nothing to undo. `record` owns the callback, so it outlives it.
+        record.unpatch = [address, original_function, wrapper_function, &record] {
+            if (!record.enabled) {
+                return;
+            }
+
+            rcmp::address_t current_function;
+            rcmp::read_memory(address, &current_function, sizeof(current_function));
+
+            // disabled earlier in the same batch
+            if (current_function == original_function) {
+                return;
+            }
+
+            if (current_function != wrapper_function) {
+                throw rcmp::error("unable to uninstall hook of %" PRIXPTR ", it's overridden by another hook", address.as_number());
+            }
+
+            rcmp::write_memory(address, &original_function, sizeof(original_function));
+        };
+
+        record.set_enabled = [address, original_function, wrapper_function](bool enabled) {
+            const auto [from, to] = enabled ? std::pair(original_function, wrapper_function) : std::pair(wrapper_function, original_function);
+
+            rcmp::address_t current_function;
+            rcmp::read_memory(address, &current_function, sizeof(current_function));
+
+            if (current_function != from) {
+                throw rcmp::error("unable to %s hook of %" PRIXPTR ", it's overridden by another hook", enabled ? "enable" : "disable", address.as_number());
+            }
+
+            rcmp::write_memory(address, &to, sizeof(to));
+        };
+
+        return original_function;
     }
 };
 
@@ -52,6 +87,30 @@ void hook_indirect_function(rcmp::address_t indirect_function_address, F&& hook)
     rcmp::hook_indirect_function<class Tag, Signature>(indirect_function_address, std::forward<F>(hook));
 }
 
+// Same as `hook_indirect_function`, but the hook is uninstalled when returned handle is destroyed
+
+template <class Tag, class Signature, class F>
+[[nodiscard]] rcmp::hook_handle hook_indirect_function_scoped(rcmp::address_t indirect_function_address, F&& hook) {
+    using wrapped_policy_t = detail::WithGlobalState<
+        detail::HookIndirectStatelessPolicy,
+        Tag
+    >;
+    return rcmp::generic_hook_function_scoped<wrapped_policy_t::template Policy, Signature>(indirect_function_address, std::forward<F>(hook));
+}
+
+template <auto IndirectFunctionAddress, class Signature, class F>
+[[nodiscard]] rcmp::hook_handle hook_indirect_function_scoped(F&& hook) {
+    static_assert(std::is_constructible_v<rcmp::address_t, decltype(IndirectFunctionAddress)>);
+
+    using Tag = std::integral_constant<decltype(IndirectFunctionAddress), IndirectFunctionAddress>;
+    return rcmp::hook_indirect_function_scoped<Tag, Signature>(IndirectFunctionAddress, std::forward<F>(hook));
+}
+
+template <class Signature, class F>
+[[nodiscard]] rcmp::hook_handle hook_indirect_function_scoped(rcmp::address_t indirect_function_address, F&& hook) {
+    return rcmp::hook_indirect_function_scoped<class Tag, Signature>(indirect_function_address, std::forward<F>(hook));
+}
+
 #endif
 
 }
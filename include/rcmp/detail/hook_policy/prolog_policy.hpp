@@ -2,6 +2,8 @@
 
 #include "with_global_state.hpp"
 
+#include <rcmp/elf.hpp>
+
 namespace rcmp {
 
 namespace detail {
@@ -10,31 +12,63 @@ namespace detail {
 
 #define RCMP_HAS_HOOK_PROLOG_POLICY
 
-// returns relocated original function address
-rcmp::address_t install_x86_x86_64_raw_hook(rcmp::address_t original_function, rcmp::address_t wrapper_function);
+// returns relocated original function address, `record` receives everything needed to uninstall the hook
+rcmp::address_t install_x86_x86_64_raw_hook(rcmp::address_t original_function, rcmp::address_t wrapper_function, hook_record& record);
 
 struct HookPrologStatelessPolicy {
-    static rcmp::address_t install_stateless_hook(rcmp::address_t address, rcmp::address_t wrapper_function) {
+    static rcmp::address_t install_stateless_hook(rcmp::address_t address, rcmp::address_t wrapper_function, hook_record& record) {
         // `address` is an address of function body start
-        return install_x86_x86_64_raw_hook(address, wrapper_function);
+        return install_x86_x86_64_raw_hook(address, wrapper_function, record);
     }
 };
 
+// Generated stub passes `state` to `state_saver` and jumps to `wrapper_function`, all argument registers are preserved.
+// If `tls_slot` (thread-local variable of the calling thread) is given and is static TLS, `state` is stored to it directly.
+// Returns the stub placed near `near`, `record` owns it.
+rcmp::address_t make_x86_x86_64_tls_state_stub(rcmp::address_t wrapper_function, void* state, void(*state_saver)(void*), void* tls_slot, rcmp::address_t near, hook_record& record);
+
+#if RCMP_GET_PLATFORM() == RCMP_PLATFORM_LINUX
+    // Offset from thread pointer is the same for every thread, even if rcmp is used from a shared library
+    #define RCMP_DETAIL_STATIC_TLS __attribute__((tls_model("initial-exec")))
+#else
+    #define RCMP_DETAIL_STATIC_TLS
+#endif
+
 #if RCMP_GET_ARCH() == RCMP_ARCH_X86
-rcmp::address_t install_x86_x86_64_hook_with_tls_state(rcmp::address_t original_function, rcmp::address_t wrapper_function, void* state, void(*state_saver)(void*));
+// Generated stub loads `state` to eax and jumps to `wrapper_function`, see `rcmp::with_state_register`
+rcmp::address_t make_x86_register_state_stub(rcmp::address_t wrapper_function, void* state, rcmp::address_t near, hook_record& record);
+#endif
 
 template <class HookState>
 struct HookPrologTlsStatePolicy {
-    static rcmp::address_t install_raw_hook(HookState* state, rcmp::address_t address, rcmp::address_t wrapper_function) {
-        return install_x86_x86_64_hook_with_tls_state(address, wrapper_function, state, +[](void* current_state) {
+    // Wrapper takes state as the first argument instead of calling `get_state`, if signature allows
+    static constexpr bool passes_state_in_register = has_state_register_wrapper_v<typename HookState::generic_sig_t>;
+
+    static rcmp::address_t install_raw_hook(HookState* state, rcmp::address_t address, rcmp::address_t wrapper_function, hook_record& record) {
+        return install_x86_x86_64_raw_hook(address, make_state_stub(state, wrapper_function, address, record), record);
+    }
+
+    // Stub that makes `state` current and jumps to `wrapper_function`, `record` owns it
+    static rcmp::address_t make_state_stub(HookState* state, rcmp::address_t wrapper_function, rcmp::address_t near, hook_record& record) {
+#if RCMP_GET_ARCH() == RCMP_ARCH_X86
+        if constexpr (passes_state_in_register) {
+            return make_x86_register_state_stub(wrapper_function, state, near, record);
+        }
+#endif
+
+        return make_x86_x86_64_tls_state_stub(wrapper_function, state, +[](void* current_state) {
             set_state(static_cast<HookState*>(current_state));
-        });
+        }, tls_slot(), near, record);
     }
 
     static HookState* allocate_state([[maybe_unused]] rcmp::address_t address) {
         return new HookState;
     }
 
+    static void free_state(HookState* state) noexcept {
+        delete state;
+    }
+
     static HookState* get_state() {
         assert(g_current_state != nullptr);
         return g_current_state;
@@ -45,9 +79,16 @@ struct HookPrologTlsStatePolicy {
     }
 
 private:
-    static inline thread_local HookState* g_current_state = nullptr;
-};
+    static void* tls_slot() {
+#if RCMP_GET_PLATFORM() == RCMP_PLATFORM_LINUX
+        return &g_current_state;
+#else
+        return nullptr;
 #endif
+    }
+
+    static inline thread_local HookState* g_current_state RCMP_DETAIL_STATIC_TLS = nullptr;
+};
 
 // Calling convention friendly implementation of std::is_function_v
 template <class T>
@@ -95,7 +136,45 @@ void hook_function(rcmp::address_t function_address, F&& hook) {
     rcmp::hook_function<class Tag, Signature>(function_address, std::forward<F>(hook));
 }
 
-#if RCMP_GET_ARCH() == RCMP_ARCH_X86
+// Same as `hook_function`, but the hook is uninstalled when returned handle is destroyed
+
+template <class Tag, class Signature, class F>
+[[nodiscard]] rcmp::hook_handle hook_function_scoped(rcmp::address_t function_address, F&& hook) {
+    using wrapped_policy_t = detail::WithGlobalState<
+        detail::HookPrologStatelessPolicy,
+        Tag
+    >;
+    return rcmp::generic_hook_function_scoped<
+        wrapped_policy_t::template Policy,
+        Signature
+    >(function_address, std::forward<F>(hook));
+}
+
+template <auto FunctionAddress, class Signature, class F>
+[[nodiscard]] rcmp::hook_handle hook_function_scoped(F&& hook) {
+    static_assert(std::is_constructible_v<rcmp::address_t, decltype(FunctionAddress)>);
+
+    using Tag = std::integral_constant<decltype(FunctionAddress), FunctionAddress>;
+    return rcmp::hook_function_scoped<Tag, Signature>(FunctionAddress, std::forward<F>(hook));
+}
+
+template <auto Function, class F>
+[[nodiscard]] rcmp::hook_handle hook_function_scoped(F&& hook) {
+    using Signature = decltype(Function);
+
+    static_assert(std::is_pointer_v<Signature>,                            "Function is not a _pointer_ to function. Did you forget to specify signature? (rcmp::hook_function_scoped<.., Signature>(..) overload)");
+    static_assert(detail::is_function_v<std::remove_pointer_t<Signature>>, "Function is not a pointer to _function_. Did you forget to specify signature? (rcmp::hook_function_scoped<.., Signature>(..) overload)");
+
+    using Tag = std::integral_constant<Signature, Function>;
+    return rcmp::hook_function_scoped<Tag, Signature>(rcmp::bit_cast<const void*>(Function), std::forward<F>(hook));
+}
+
+template <class Signature, class F>
+[[nodiscard]] rcmp::hook_handle hook_function_scoped(rcmp::address_t function_address, F&& hook) {
+    return rcmp::hook_function_scoped<class Tag, Signature>(function_address, std::forward<F>(hook));
+}
+
+// Every hook gets its own state, so a single instantiation (per signature and hook type) serves any number of addresses
 template <class Signature, class F>
 void hook_function_stateless(rcmp::address_t function_address, F&& hook) {
     rcmp::generic_hook_function<
@@ -103,6 +182,60 @@ void hook_function_stateless(rcmp::address_t function_address, F&& hook) {
         Signature
     >(function_address, std::forward<F>(hook));
 }
+
+template <class Signature, class F>
+[[nodiscard]] rcmp::hook_handle hook_function_stateless_scoped(rcmp::address_t function_address, F&& hook) {
+    return rcmp::generic_hook_function_scoped<
+        detail::HookPrologTlsStatePolicy,
+        Signature
+    >(function_address, std::forward<F>(hook));
+}
+
+#if defined(RCMP_HAS_ELF)
+
+namespace detail {
+    inline rcmp::address_t find_symbol_to_hook(const char* module, const char* symbol) {
+        const auto address = rcmp::find_symbol(module, symbol);
+        if (address == nullptr) {
+            throw rcmp::error("unable to hook %s, there's no such symbol in %s", symbol, module != nullptr ? module : "loaded modules");
+        }
+
+        return address;
+    }
+}
+
+// Same as `hook_function` and others, but the function is found by `symbol` defined in `module`, see `rcmp::find_symbol`
+
+template <class Tag, class Signature, class F>
+void hook_function(const char* module, const char* symbol, F&& hook) {
+    rcmp::hook_function<Tag, Signature>(detail::find_symbol_to_hook(module, symbol), std::forward<F>(hook));
+}
+
+template <class Signature, class F>
+void hook_function(const char* module, const char* symbol, F&& hook) {
+    rcmp::hook_function<class Tag, Signature>(detail::find_symbol_to_hook(module, symbol), std::forward<F>(hook));
+}
+
+template <class Tag, class Signature, class F>
+[[nodiscard]] rcmp::hook_handle hook_function_scoped(const char* module, const char* symbol, F&& hook) {
+    return rcmp::hook_function_scoped<Tag, Signature>(detail::find_symbol_to_hook(module, symbol), std::forward<F>(hook));
+}
+
+template <class Signature, class F>
+[[nodiscard]] rcmp::hook_handle hook_function_scoped(const char* module, const char* symbol, F&& hook) {
+    return rcmp::hook_function_scoped<class Tag, Signature>(detail::find_symbol_to_hook(module, symbol), std::forward<F>(hook));
+}
+
+template <class Signature, class F>
+void hook_function_stateless(const char* module, const char* symbol, F&& hook) {
+    rcmp::hook_function_stateless<Signature>(detail::find_symbol_to_hook(module, symbol), std::forward<F>(hook));
+}
+
+template <class Signature, class F>
+[[nodiscard]] rcmp::hook_handle hook_function_stateless_scoped(const char* module, const char* symbol, F&& hook) {
+    return rcmp::hook_function_stateless_scoped<Signature>(detail::find_symbol_to_hook(module, symbol), std::forward<F>(hook));
+}
+
 #endif
 
 #endif
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "prolog_policy.hpp"
+
+#include <utility>
+
+#include <cstddef>
+
+namespace rcmp {
+
+namespace detail {
+
+#if defined(RCMP_HAS_HOOK_PROLOG_POLICY)
+
+#define RCMP_HAS_HOOK_VTABLE_CLONE_POLICY
+
+struct vtable_slot_t {
+    rcmp::address_t object;
+    std::size_t     index; // index of virtual method in vtable
+};
+
+// Switches `slot.object` to its own copy of the vtable (made once per object), writes `wrapper_function` to the copy.
+// Returns the method that was in the slot.
+rcmp::address_t install_vtable_clone_hook(const vtable_slot_t& slot, rcmp::address_t wrapper_function, hook_record& record);
+
+template <class HookState>
+struct HookVtableCloneTlsStatePolicy : HookPrologTlsStatePolicy<HookState> {
+    static rcmp::address_t install_raw_hook(HookState* state, rcmp::address_t address, rcmp::address_t wrapper_function, hook_record& record) {
+        // `address` is an address of `vtable_slot_t`, that lives until the hook is installed
+        const auto stub = HookPrologTlsStatePolicy<HookState>::make_state_stub(state, wrapper_function, nullptr, record);
+        return install_vtable_clone_hook(*address.as_ptr<const vtable_slot_t>(), stub, record);
+    }
+};
+
+#endif
+
+}
+
+#if defined(RCMP_HAS_HOOK_VTABLE_CLONE_POLICY)
+
+// Hooks virtual method `index` of a single object: the object gets its own copy of the vtable, other objects
+// of the same class keep calling original methods directly. All hooks of the object share the copy.
+// Every hook has its own state, like with `hook_function_stateless`. Hook must be uninstalled (or released)
+// before the object is destroyed, as uninstallation of the last one switches the object back to the original vtable.
+// Except for MSVC, objects of classes with virtual bases (or without RTTI) can't be hooked this way: their vtables
+// keep offsets before the type info, that aren't copied.
+
+template <class Signature, class F>
+void hook_instance_method(rcmp::address_t object, std::size_t index, F&& hook) {
+    const detail::vtable_slot_t slot{ object, index };
+    rcmp::generic_hook_function<detail::HookVtableCloneTlsStatePolicy, Signature>(&slot, std::forward<F>(hook));
+}
+
+template <class Signature, class F>
+[[nodiscard]] rcmp::hook_handle hook_instance_method_scoped(rcmp::address_t object, std::size_t index, F&& hook) {
+    const detail::vtable_slot_t slot{ object, index };
+    return rcmp::generic_hook_function_scoped<detail::HookVtableCloneTlsStatePolicy, Signature>(&slot, std::forward<F>(hook));
+}
+
+#endif
+
+}
@@ -2,6 +2,9 @@
 
 #include <rcmp/detail/exception.hpp>
 #include <rcmp/memory.hpp>
+#include <rcmp/hook_handle.hpp>
+
+#include <atomic>
 
 namespace rcmp::detail {
 
@@ -9,24 +12,34 @@ template <class StatelessPolicy, class... Tags>
 struct WithGlobalState {
     template <class HookState>
     class Policy {
-        inline static HookState g_state;
+        inline static HookState         g_state;
+        inline static std::atomic<bool> g_allocated = false;
 
     public:
-        static rcmp::address_t install_raw_hook([[maybe_unused]] HookState* state, rcmp::address_t address, rcmp::address_t wrapper_function) {
+        // State address is known at compile time, see `has_global_state_v`
+        static constexpr bool has_global_state = true;
+
+        static rcmp::address_t install_raw_hook([[maybe_unused]] HookState* state, rcmp::address_t address, rcmp::address_t wrapper_function, hook_record& record) {
             assert(state == &g_state);
 
-            return StatelessPolicy::install_stateless_hook(address, wrapper_function);
+            return StatelessPolicy::install_stateless_hook(address, wrapper_function, record);
         }
 
         static HookState* allocate_state(rcmp::address_t address) {
-            static bool allocated = false;
-            if (std::exchange(allocated, true)) {
+            if (g_allocated.exchange(true)) {
                 throw rcmp::error("Cannot install hook using same state twice, try to use different `Tag` (hooked address: %" PRIXPTR ")", address.as_number());
             }
 
             return &g_state;
         }
 
+        static void free_state([[maybe_unused]] HookState* state) noexcept {
+            assert(state == &g_state);
+
+            g_state.reset();
+            g_allocated = false;
+        }
+
         static HookState* get_state() {
             return &g_state;
         }
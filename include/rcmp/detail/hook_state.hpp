@@ -1,14 +1,26 @@
 #pragma once
 
 #include <rcmp/detail/calling_convention.hpp>
+#include <rcmp/detail/epoch.hpp>
+#include <rcmp/detail/scope_exit.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <utility>
 #include <type_traits>
+#include <vector>
 #include <cassert>
 
 namespace rcmp::detail {
 
+// Hooks without data members (i.e. captureless lambdas) don't need per-state storage:
+// their call operator never reads `*this`, so every instance is interchangeable
+template <class Hook>
+constexpr bool is_empty_hook_v = std::is_empty_v<Hook> && std::is_trivially_copyable_v<Hook> && std::is_trivially_destructible_v<Hook>;
+
 template <class GenericSignature, class Hook>
 struct hook_state_t;
 
@@ -20,13 +32,73 @@ struct hook_state_t<generic_signature_t<Ret(Args...), Convention>, Hook> {
 
     static_assert(std::is_invocable_r_v<Ret, hook_t, original_sig_t, Args...>);
 
-    std::optional<hook_t> hook     = std::nullopt;
+    std::optional<hook_t> hook     = std::nullopt; // callable given on installation
+    std::atomic<hook_t*>  current  = nullptr;      // callable invoked by wrapper: `*hook` or `*replacement`
     original_sig_t        original = nullptr;
 
+    // Callables replaced by `replace` may still be running on other threads, `reclaim` destroys them once
+    // every wrapper call entered before their replacement has returned
+    using retired_hook_t = std::pair<std::size_t, std::unique_ptr<hook_t>>; // (epoch it's retired in, callable)
+
+    std::mutex                  mutex; // guards members below
+    epoch_t                     epoch;
+    std::unique_ptr<hook_t>     replacement;
+    std::size_t                 hook_retired_in = 0; // valid once `*hook` isn't current
+    std::vector<retired_hook_t> retired;
+
     Ret call_hook(Args... args) {
-        assert(this->hook != std::nullopt);
+        const auto entered = this->epoch.enter();
+        scope_exit _ = [this, entered] { this->epoch.leave(entered); };
+
+        const auto current_hook = this->current.load(std::memory_order_acquire);
+        assert(current_hook != nullptr);
         assert(this->original != nullptr);
-        return (*this->hook)(this->original, std::forward<Args>(args)...);
+        return (*current_hook)(this->original, std::forward<Args>(args)...);
+    }
+
+    void emplace(hook_t new_hook) {
+        this->hook.emplace(std::move(new_hook));
+        this->current.store(&*this->hook, std::memory_order_release);
+    }
+
+    // Wrappers pick up `new_hook` on their next call, calls in progress keep using the previous one
+    void replace(hook_t new_hook) {
+        auto next = std::make_unique<hook_t>(std::move(new_hook));
+
+        const std::lock_guard lock(this->mutex);
+        this->current.store(next.get(), std::memory_order_release);
+
+        // tagged after it's unlinked, so wrappers entering later can't see it
+        if (this->replacement != nullptr) {
+            this->retired.emplace_back(this->epoch.current(), std::move(this->replacement));
+        }
+        else {
+            this->hook_retired_in = this->epoch.current();
+        }
+
+        this->replacement = std::move(next);
+    }
+
+    // Destroys replaced callables no wrapper call can be running anymore, the rest are kept for later
+    void reclaim() noexcept {
+        const std::lock_guard lock(this->mutex);
+        this->epoch.advance();
+
+        this->retired.erase(std::remove_if(this->retired.begin(), this->retired.end(), [this](const auto& retired_hook) {
+            return this->epoch.is_reclaimable(retired_hook.first);
+        }), this->retired.end());
+
+        if (this->replacement != nullptr && this->hook.has_value() && this->epoch.is_reclaimable(this->hook_retired_in)) {
+            this->hook.reset();
+        }
+    }
+
+    void reset() noexcept {
+        this->current.store(nullptr, std::memory_order_relaxed);
+        this->retired.clear();
+        this->replacement.reset();
+        this->hook.reset();
+        this->original = nullptr;
     }
 };
 
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "detail/address.hpp"
+#include "detail/config.hpp"
+
+#include <vector>
+
+#include <cstdint>
+
+namespace rcmp {
+
+#if RCMP_GET_PLATFORM() == RCMP_PLATFORM_LINUX
+
+#define RCMP_HAS_ELF
+
+// GOT entries (and other data pointers) of loaded modules filled with address of function `symbol` by dynamic linker
+// (JUMP_SLOT, GLOB_DAT and absolute relocations), sorted.
+// `module` is a file name (or path suffix) of importing module, "" is the main executable, null means every loaded module.
+std::vector<rcmp::address_t> find_import_slots(const char* symbol, const char* module = nullptr);
+
+// Load bias of `module`, i.e. what is added to addresses of its ELF file at runtime (zero for non-PIE executable).
+// `module` is a file name (or path suffix), "" is the main executable. Throws `rcmp::error` if the module isn't loaded.
+rcmp::address_t module_load_bias(const char* module);
+
+// Address of function or variable `symbol` defined by `module` (see `module_load_bias`, null means every loaded module).
+// Null if not found, throws `rcmp::error` if several local symbols share the name. Indirect functions are resolved.
+rcmp::address_t find_symbol(const char* module, const char* symbol);
+
+// Contents of NT_GNU_BUILD_ID note of loaded `module` (see `module_load_bias`), empty if it has none
+std::vector<std::uint8_t> module_build_id(const char* module);
+
+#endif
+
+} // namespace rcmp
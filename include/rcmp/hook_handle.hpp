@@ -0,0 +1,119 @@
+#pragma once
+
+#include "memory.hpp"
+#include "detail/address.hpp"
+
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <cstddef>
+
+namespace rcmp {
+
+namespace detail {
+
+template <class T>
+inline constexpr char type_tag = 0;
+
+// Unique per type, doesn't need RTTI
+template <class T>
+constexpr const void* type_id() noexcept {
+    return &type_tag<T>;
+}
+
+// Everything needed to undo a single installed hook
+struct hook_record {
+    // Queues writes that undo the hook, throws `rcmp::error` if it's not possible
+    std::function<void()>       unpatch;
+    // Queues writes that make the hook skipped (or called again), throws `rcmp::error` if it's not possible
+    std::function<void(bool)>   set_enabled;
+    bool                        enabled = true;
+    bool                        installed = true; // false once uninstallation is queued, back to true on rollback
+    std::vector<rcmp::code_ptr> code;                   // code generated for this hook only
+    rcmp::address_t             original_ref = nullptr; // where the hook keeps address of original function
+    void*                       state = nullptr;
+    void                        (*free_state)(void*) noexcept = nullptr;
+
+    const void*                 hook_type = nullptr;                        // `type_id` of the callable
+    void                        (*replace_hook)(void*, void*) = nullptr;    // (state, callable to move from)
+    void                        (*reclaim_hooks)(void*) noexcept = nullptr; // (state)
+
+    hook_record() = default;
+    hook_record(const hook_record&) = delete;
+    hook_record& operator=(const hook_record&) = delete;
+
+    // Unless resources are released explicitly, they live until the end of the program
+    ~hook_record();
+
+    // Frees generated code and hook state. Patch must be already reverted.
+    void release_resources() noexcept;
+};
+
+} // namespace detail
+
+// Owns installed hook: destroying the handle (or calling `uninstall`) restores original code,
+// frees generated code and releases hook state.
+// Function hooks may be uninstalled in any order, indirect hooks of the same slot - only in reverse order of installation.
+// Caller is responsible for making sure no thread is executing the hook during uninstallation.
+class hook_handle {
+    std::shared_ptr<detail::hook_record> m_record;
+
+public:
+    hook_handle() noexcept = default;
+    explicit hook_handle(std::shared_ptr<detail::hook_record> record) noexcept;
+
+    hook_handle(const hook_handle&) = delete;
+    hook_handle& operator=(const hook_handle&) = delete;
+
+    hook_handle(hook_handle&& other) noexcept;
+    hook_handle& operator=(hook_handle&& other) noexcept;
+
+    // If hook can't be uninstalled, it stays alive until the end of the program
+    ~hook_handle();
+
+    bool installed() const noexcept;
+
+    explicit operator bool() const noexcept {
+        return installed();
+    }
+
+    // Throws `rcmp::error` if hook is overridden by another one, that is still installed
+    void uninstall();
+
+    // Disabled hook is skipped, but keeps its generated code and state, so it can be enabled again cheaply.
+    // Once all hooks of a function are disabled, its original code is restored.
+    // Throws `rcmp::error` if hook is not installed or is overridden by another one (indirect hooks only).
+    void enable();
+    void disable();
+
+    bool enabled() const noexcept;
+
+    // Replaces callable of the installed hook without touching patched code: wrapper picks it up on its next call.
+    // `hook` must be of the same type as the installed one (i.e. the same lambda with other captures).
+    // Replaced callables are kept alive, as other threads may be still running them, until `reclaim` or uninstallation.
+    // Safe to call from several threads at once. Throws `rcmp::error` if hook is not installed or `Hook` doesn't match.
+    template <class Hook>
+    void replace(Hook&& hook);
+
+    // Destroys replaced callables which no call of the hook can be running anymore, the rest are kept until the next call.
+    void reclaim() noexcept;
+
+    // Keeps hook alive until the end of the program
+    void release() noexcept;
+
+private:
+    void set_enabled(bool enabled);
+
+    void replace_hook(const void* hook_type, void* hook);
+};
+
+template <class Hook>
+void hook_handle::replace(Hook&& hook) {
+    std::decay_t<Hook> new_hook(std::forward<Hook>(hook));
+    replace_hook(detail::type_id<std::decay_t<Hook>>(), &new_hook);
+}
+
+} // namespace rcmp
@@ -4,23 +4,70 @@
 
 #include <memory>
 #include <iterator>
+#include <utility>
+#include <vector>
 
 #include <cstddef>
 #include <cstring>
 
 namespace rcmp {
 
+// Makes memory writable for the rest of the program. Prefer `protection_scope`, which restores protection back.
 void unprotect_memory(rcmp::address_t where, std::size_t count);
 
+// Makes pages covering added ranges writable while the scope is alive, other access rights are kept.
+// Scopes may overlap: original protection of a page is restored when the last scope holding it ends.
+class protection_scope {
+    std::vector<std::uintptr_t> m_pages; // sorted
+
+public:
+    protection_scope() noexcept = default;
+    protection_scope(rcmp::address_t where, std::size_t count);
+
+    protection_scope(protection_scope&& other) noexcept;
+    protection_scope& operator=(protection_scope&& other) noexcept;
+
+    ~protection_scope();
+
+    // Adjacent pages with the same protection are changed at once
+    void add(rcmp::address_t where, std::size_t count);
+
+    // Same as above, but every page is looked up and changed once for all ranges
+    void add(const std::vector<std::pair<rcmp::address_t, std::size_t>>& ranges);
+
+    // Restores protection of all held pages
+    void reset() noexcept;
+};
+
+// Writes `size` bytes to (possibly protected) memory. Inside of `rcmp::hook_batch` the write is deferred until commit.
+void write_memory(rcmp::address_t where, const void* bytes, std::size_t size);
+
+// Same as `write_memory`, but `where` points to executable code. In `rcmp::patch_mode::live` a thread executing
+// the code while it's being patched continues execution at `resume`, that must behave the same way as original code.
+// Null `resume` means that the code is not executed concurrently.
+void patch_code(rcmp::address_t where, const void* bytes, std::size_t size, rcmp::address_t resume);
+
+// Reads `size` bytes, taking into account writes deferred by active `rcmp::hook_batch`
+void read_memory(rcmp::address_t where, void* bytes, std::size_t size);
+
 template <class Range>
 void set_opcode(rcmp::address_t where, Range&& bytes) {
     static_assert(sizeof(bytes.data()[0]) == 1);
 
-    unprotect_memory(where, std::size(bytes));
-
-    std::memcpy(where.as_ptr(), std::data(bytes), std::size(bytes));
+    write_memory(where, std::data(bytes), std::size(bytes));
 }
 
-std::unique_ptr<std::byte[]> allocate_code(std::size_t count);
+// Returns memory obtained from `allocate_code` back to the code arena
+struct code_deleter {
+    std::size_t size = 0;
+
+    void operator()(std::byte* code) const noexcept;
+};
+
+using code_ptr = std::unique_ptr<std::byte[], code_deleter>;
+
+// Allocates `count` bytes of executable memory from the code arena.
+// If `near` is not null, memory is placed within rel32 reach (+-2GB) of it whenever possible.
+code_ptr allocate_code(std::size_t count, rcmp::address_t near = nullptr);
 
 } // namespace rcmp
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "elf.hpp"
+
+#if defined(RCMP_HAS_ELF)
+
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace rcmp {
+
+// Addresses of hook targets in `module`, resolved once (by signature scan, symbol lookup, ...) and kept in a file
+// for the next runs. The file is mapped into memory and searched in place, no parsing at startup.
+// Offsets are stored relative to the module, so they survive ASLR. The file is bound to GNU build-id of the module:
+// once the module is rebuilt, the file is ignored and overwritten by the next `save`.
+//
+//     rcmp::offset_cache cache("/var/cache/app/hooks.bin", "");
+//     const auto address = cache.resolve("send_packet", [] {
+//         return rcmp::find_pattern(rcmp::byte_pattern("55 48 89 E5 ?? 8B"), "").at(0);
+//     });
+//     cache.save();
+class offset_cache {
+    std::string               m_path;
+    rcmp::address_t           m_load_bias;
+    std::vector<std::uint8_t> m_build_id;
+
+    // Valid file mapped for reading, if any
+    const std::byte* m_mapping      = nullptr;
+    std::size_t      m_mapping_size = 0;
+
+    // Resolved during this run (offsets from load bias)
+    std::map<std::string, std::uint64_t, std::less<>> m_pending;
+    bool                                              m_dirty = false;
+
+    std::optional<std::uint64_t> find_saved(std::string_view key) const;
+
+public:
+    // Throws `rcmp::error` if `module` (see `module_load_bias`) isn't loaded or has no build-id.
+    // Missing, corrupted or outdated file is treated as empty.
+    offset_cache(std::string path, const char* module);
+
+    offset_cache(const offset_cache&) = delete;
+    offset_cache& operator=(const offset_cache&) = delete;
+
+    ~offset_cache();
+
+    // Whether the file was valid for the module when the cache was opened
+    bool loaded() const noexcept {
+        return m_mapping != nullptr;
+    }
+
+    std::optional<rcmp::address_t> find(std::string_view key) const;
+
+    void insert(std::string_view key, rcmp::address_t address);
+
+    // Cached address of `key`, or result of `resolver()` that's cached then
+    template <class Resolver>
+    rcmp::address_t resolve(std::string_view key, Resolver&& resolver) {
+        if (const auto address = find(key)) {
+            return *address;
+        }
+
+        const rcmp::address_t address = resolver();
+        insert(key, address);
+        return address;
+    }
+
+    // Merges pending entries with the cache file as it is now, and writes them to a temporary file that replaces it.
+    // Saves are serialized by `flock` of "<path>.lock", so concurrent processes don't lose each other's entries,
+    // and readers never see the file half-written. Does nothing if there's nothing new.
+    void save();
+};
+
+} // namespace rcmp
+
+#endif
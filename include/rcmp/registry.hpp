@@ -0,0 +1,86 @@
+#pragma once
+
+#include "detail/address.hpp"
+#include "detail/calling_convention.hpp"
+
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include <cstddef>
+
+namespace rcmp {
+
+struct code_range {
+    rcmp::address_t begin;
+    rcmp::address_t end;
+
+    bool contains(rcmp::address_t address) const noexcept {
+        return begin <= address && address < end;
+    }
+};
+
+// Function hooked with `hook_function` (or any other prolog policy). Indirect hooks don't patch code and aren't tracked.
+struct hooked_function_info {
+    rcmp::address_t function;         // hooked address
+    std::size_t     hook_count;       // installed hooks, including disabled ones
+    bool            patched;          // entry jump is written, i.e. at least one hook is enabled
+    code_range      patched_code;     // part of the function overwritten by entry jump
+    code_range      relocated_prolog; // behaves as the original function, see `get_original`
+    code_range      dispatcher;       // jumps to the latest enabled hook
+};
+
+// Lookups below never lock or allocate, so they may be used from signal and crash handlers.
+// All of them see the registry as it was after some committed batch.
+
+std::optional<hooked_function_info> find_hooked_function(rcmp::address_t function) noexcept;
+
+// Function that owns code at `pc`: either its patched part, relocated prolog or dispatcher (i.e. faulting instruction)
+std::optional<hooked_function_info> find_hooked_function_by_code(rcmp::address_t pc) noexcept;
+
+std::size_t hooked_function_count() noexcept;
+
+// Total number of installed hooks of all functions
+std::size_t hook_count() noexcept;
+
+// Sorted by address
+std::vector<hooked_function_info> hooked_functions();
+
+// Address that behaves as original `function` bypassing all its hooks, or null if `function` is not hooked.
+// It's valid only while `function` stays hooked: the code is freed once its last hook is uninstalled.
+rcmp::address_t get_original(rcmp::address_t function) noexcept;
+
+namespace detail {
+
+// Code of functions found by lookups made while the guard is alive isn't freed until it's destroyed
+class registry_guard {
+    std::size_t m_epoch;
+
+public:
+    registry_guard() noexcept;
+    ~registry_guard();
+
+    registry_guard(const registry_guard&) = delete;
+    registry_guard& operator=(const registry_guard&) = delete;
+};
+
+[[noreturn]] void throw_not_hooked(rcmp::address_t function);
+
+} // namespace detail
+
+// Calls original `function` bypassing all its hooks, throws `rcmp::error` if `function` is not hooked.
+// Safe even if the last hook of `function` is uninstalled by another thread meanwhile.
+template <class Signature, class... Args>
+decltype(auto) call_original(rcmp::address_t function, Args&&... args) {
+    const detail::registry_guard guard;
+
+    const auto original = rcmp::get_original(function);
+    if (original == nullptr) {
+        detail::throw_not_hooked(function);
+    }
+
+    using function_t = rcmp::from_generic_signature<rcmp::to_generic_signature<Signature>>;
+    return original.template as<function_t>()(std::forward<Args>(args)...);
+}
+
+} // namespace rcmp
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "detail/address.hpp"
+
+#include <string_view>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace rcmp {
+
+// Addresses of `call rel32` and `jmp rel32` instructions branching to `function`, sorted.
+// Executable segments of the module containing `function` are scanned for the bytes, then disassembled linearly:
+// matches inside of other instructions are dropped. Data embedded into code may still decode as such a branch
+// (rare, whole displacement has to match), so results are candidates to check before patching them.
+std::vector<rcmp::address_t> find_direct_branches(rcmp::address_t function);
+
+// Byte signature with wildcards: hex bytes separated by spaces, `?` or `??` matches any byte, i.e. "E8 ?? ?? ?? ?? 48 8B D8".
+// Throws `rcmp::error` if the signature is malformed or has no exact bytes.
+class byte_pattern {
+    std::vector<std::uint8_t> m_bytes; // wildcards are zero
+    std::vector<std::uint8_t> m_mask;  // 0xFF for exact bytes, 0x00 for wildcards
+
+public:
+    explicit byte_pattern(std::string_view signature);
+
+    std::size_t size() const noexcept {
+        return m_bytes.size();
+    }
+
+    const std::uint8_t* bytes() const noexcept {
+        return m_bytes.data();
+    }
+
+    const std::uint8_t* mask() const noexcept {
+        return m_mask.data();
+    }
+};
+
+// Addresses of every match of `pattern` in `[begin, begin + size)`, sorted
+std::vector<rcmp::address_t> find_pattern(const byte_pattern& pattern, rcmp::address_t begin, std::size_t size);
+
+// Addresses of every match of `pattern` in executable segments of `module`, sorted.
+// Null `module` means every loaded module, empty string means the main executable (see `find_import_slots`).
+std::vector<rcmp::address_t> find_pattern(const byte_pattern& pattern, const char* module = nullptr);
+
+// Same as `find_pattern` for every pattern, but the code is read once: large segments are split into chunks,
+// that are scanned by several threads for all patterns at a time. `result[i]` holds matches of `patterns[i]`.
+std::vector<std::vector<rcmp::address_t>> find_patterns(const std::vector<byte_pattern>& patterns, const char* module = nullptr);
+
+// Target of an instruction with 32-bit relative operand: `instruction + instruction_size + operand`,
+// i.e. `resolve_rel32(match, 1, 5)` for `call rel32`, `resolve_rel32(match, 3, 7)` for `mov rax, [rip + X]`
+rcmp::address_t resolve_rel32(rcmp::address_t instruction, std::size_t operand_offset, std::size_t instruction_size);
+
+} // namespace rcmp
@@ -0,0 +1,158 @@
+#pragma once
+
+#include "batch.hpp"
+#include "codegen.hpp"
+#include "low_level.hpp"
+#include "detail/exception.hpp"
+
+#include <array>
+#include <type_traits>
+#include <utility>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace rcmp {
+
+#if RCMP_GET_PLATFORM() == RCMP_PLATFORM_WIN
+    #if RCMP_GET_ARCH() == RCMP_ARCH_X86
+        inline constexpr auto member_function_cconv = rcmp::cconv::thiscall_;
+    #elif RCMP_GET_ARCH() == RCMP_ARCH_X86_64
+        inline constexpr auto member_function_cconv = rcmp::cconv::native_x64;
+    #endif
+#elif RCMP_GET_PLATFORM() == RCMP_PLATFORM_LINUX
+    #if RCMP_GET_ARCH() == RCMP_ARCH_X86
+        inline constexpr auto member_function_cconv = rcmp::cconv::cdecl_;
+    #elif RCMP_GET_ARCH() == RCMP_ARCH_X86_64
+        inline constexpr auto member_function_cconv = rcmp::cconv::native_x64;
+    #endif
+#endif
+
+// Address of the first virtual method in the vtable of `object`
+template <class T>
+rcmp::address_t vtable_of(const T* object) noexcept {
+    static_assert(std::is_polymorphic_v<T>, "T has no vtable");
+
+    const void* vtable;
+    std::memcpy(&vtable, object, sizeof(vtable));
+    return vtable;
+}
+
+#if !defined(_MSC_VER)
+
+#define RCMP_HAS_VIRTUAL_METHOD_INDEX
+
+namespace detail {
+    // Itanium C++ ABI representation of pointer to member function
+    struct itanium_pmf_t {
+        std::uintptr_t ptr; // function address or 1 + vtable offset in bytes
+        std::ptrdiff_t adj; // `this` adjustment
+    };
+} // namespace detail
+
+// Index of virtual method `method` in the vtable of its class (the class of `PMF`). Throws if `method` isn't virtual
+// or belongs to a non-primary base of the class (`this` is adjusted then, index refers to the vtable of that base).
+template <class PMF>
+std::size_t virtual_method_index(PMF method) {
+    static_assert(std::is_member_function_pointer_v<PMF>);
+
+    const auto pmf = rcmp::bit_cast<detail::itanium_pmf_t>(method);
+
+#if RCMP_GET_ARCH() == RCMP_ARCH_ARM64
+    // ARM variant keeps virtual bit in `adj`, as function addresses may be odd
+    const bool           is_virtual = (pmf.adj & 1) != 0;
+    const std::uintptr_t offset     = pmf.ptr;
+    const std::ptrdiff_t adjustment = pmf.adj >> 1;
+#else
+    const bool           is_virtual = (pmf.ptr & 1) != 0;
+    const std::uintptr_t offset     = pmf.ptr - 1;
+    const std::ptrdiff_t adjustment = pmf.adj;
+#endif
+
+    if (!is_virtual) {
+        throw rcmp::error("unable to get vtable index of method %" PRIXPTR ", it's not virtual", pmf.ptr);
+    }
+
+    if (adjustment != 0) {
+        throw rcmp::error("unable to get vtable index of method %" PRIXPTR ", it belongs to the base at offset %td, take pointer to member of that base",
+                          pmf.ptr, adjustment);
+    }
+
+    return offset / sizeof(void*);
+}
+
+#endif
+
+#if defined(RCMP_HAS_HOOK_INDIRECT_POLICY) && defined(RCMP_HAS_VIRTUAL_METHOD_INDEX)
+
+// Hooks virtual method `Method` by its slot in `vtable`, that is the vtable of `Method`'s class or of a class derived from it
+// (see `vtable_of`). All objects sharing the vtable are affected. `original` and `hook` get `this` as the first argument.
+// Hooking the same method in another vtable with the same hook type needs a distinct `Tag`.
+
+template <class Tag, auto Method, class F>
+void hook_virtual_method(rcmp::address_t vtable, F&& hook) {
+    using Signature = rcmp::flatten_pmf_t<decltype(Method), rcmp::member_function_cconv>;
+
+    const auto slot = vtable + rcmp::virtual_method_index(Method) * sizeof(void*);
+    rcmp::hook_indirect_function<Tag, Signature>(slot, std::forward<F>(hook));
+}
+
+template <auto Method, class F>
+void hook_virtual_method(rcmp::address_t vtable, F&& hook) {
+    rcmp::hook_virtual_method<class Tag, Method>(vtable, std::forward<F>(hook));
+}
+
+template <class Tag, auto Method, class F>
+[[nodiscard]] rcmp::hook_handle hook_virtual_method_scoped(rcmp::address_t vtable, F&& hook) {
+    using Signature = rcmp::flatten_pmf_t<decltype(Method), rcmp::member_function_cconv>;
+
+    const auto slot = vtable + rcmp::virtual_method_index(Method) * sizeof(void*);
+    return rcmp::hook_indirect_function_scoped<Tag, Signature>(slot, std::forward<F>(hook));
+}
+
+template <auto Method, class F>
+[[nodiscard]] rcmp::hook_handle hook_virtual_method_scoped(rcmp::address_t vtable, F&& hook) {
+    return rcmp::hook_virtual_method_scoped<class Tag, Method>(vtable, std::forward<F>(hook));
+}
+
+// Hooks several virtual methods of `vtable` with the same (generic) hook, all slots are written at once.
+// Either all methods are hooked or none of them.
+
+template <auto... Methods, class F>
+void hook_virtual_methods(rcmp::address_t vtable, const F& hook) {
+    rcmp::hook_batch batch;
+    (rcmp::hook_virtual_method<Methods>(vtable, hook), ...);
+    batch.commit();
+}
+
+template <auto... Methods, class F>
+[[nodiscard]] std::array<rcmp::hook_handle, sizeof...(Methods)> hook_virtual_methods_scoped(rcmp::address_t vtable, const F& hook) {
+    rcmp::hook_batch batch;
+    std::array<rcmp::hook_handle, sizeof...(Methods)> handles{ rcmp::hook_virtual_method_scoped<Methods>(vtable, hook)... };
+    batch.commit();
+
+    return handles;
+}
+
+#endif
+
+#if defined(RCMP_HAS_HOOK_VTABLE_CLONE_POLICY) && defined(RCMP_HAS_VIRTUAL_METHOD_INDEX)
+
+// Same as `hook_instance_method`, but index and signature are taken from `Method`
+
+template <auto Method, class F>
+void hook_instance_method(rcmp::address_t object, F&& hook) {
+    using Signature = rcmp::flatten_pmf_t<decltype(Method), rcmp::member_function_cconv>;
+    rcmp::hook_instance_method<Signature>(object, rcmp::virtual_method_index(Method), std::forward<F>(hook));
+}
+
+template <auto Method, class F>
+[[nodiscard]] rcmp::hook_handle hook_instance_method_scoped(rcmp::address_t object, F&& hook) {
+    using Signature = rcmp::flatten_pmf_t<decltype(Method), rcmp::member_function_cconv>;
+    return rcmp::hook_instance_method_scoped<Signature>(object, rcmp::virtual_method_index(Method), std::forward<F>(hook));
+}
+
+#endif
+
+} // namespace rcmp
@@ -0,0 +1,245 @@
+#include <rcmp/batch.hpp>
+#include <rcmp/memory.hpp>
+#include <rcmp/detail/exception.hpp>
+
+#include "detail/platform/platform.hpp"
+#include "detail/arch/arch.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstring>
+#include <iterator>
+#include <utility>
+
+namespace {
+
+thread_local rcmp::hook_batch* g_current_batch = nullptr;
+
+std::atomic<rcmp::patch_mode> g_patch_mode{ rcmp::patch_mode::plain };
+
+} // unnamed namespace
+
+rcmp::hook_batch::hook_batch() : m_parent(g_current_batch) {
+    g_current_batch = this;
+}
+
+rcmp::hook_batch::~hook_batch() {
+    if (!m_finished) {
+        rollback();
+    }
+}
+
+void rcmp::hook_batch::finish() noexcept {
+    assert(g_current_batch == this && "batches must be finished in reverse order");
+
+    m_finished      = true;
+    g_current_batch = m_parent;
+}
+
+rcmp::hook_batch* rcmp::hook_batch::current() noexcept {
+    return g_current_batch;
+}
+
+void rcmp::set_patch_mode(patch_mode mode) {
+    if (!rcmp::is_patch_mode_supported(mode)) {
+        throw rcmp::error("unable to switch to live patch mode, cores can't be synchronized");
+    }
+
+    g_patch_mode.store(mode);
+}
+
+bool rcmp::is_patch_mode_supported(patch_mode mode) noexcept {
+    return mode != rcmp::patch_mode::live || rcmp::detail::platform::can_sync_cores();
+}
+
+rcmp::patch_mode rcmp::get_patch_mode() noexcept {
+    return g_patch_mode.load();
+}
+
+void rcmp::hook_batch::apply_writes() const {
+#if RCMP_GET_ARCH() == RCMP_ARCH_X86 || RCMP_GET_ARCH() == RCMP_ARCH_X86_64
+    if (rcmp::get_patch_mode() == rcmp::patch_mode::live) {
+        // Overlapping code writes are merged, so every patched region gets a single breakpoint
+        std::vector<const write_t*> code_writes;
+        for (const auto& write : m_writes) {
+            if (write.resume != nullptr) {
+                code_writes.push_back(&write);
+            }
+            else {
+                std::memcpy(write.where.as_ptr(), write.bytes.data(), write.bytes.size());
+            }
+        }
+
+        // Stable, so the first write of a region comes first: its `resume` matches the code in memory right now
+        std::stable_sort(code_writes.begin(), code_writes.end(), [](const write_t* lhs, const write_t* rhs) {
+            return lhs->where < rhs->where;
+        });
+
+        std::vector<rcmp::detail::arch::code_patch_t> patches;
+        for (const auto write : code_writes) {
+            const rcmp::address_t write_end = write->where + write->bytes.size();
+
+            if (!patches.empty() && write->where < patches.back().where + patches.back().bytes.size()) {
+                auto& patch = patches.back();
+                patch.bytes.resize((std::max)(patch.bytes.size(), static_cast<std::size_t>(write_end - patch.where)));
+            }
+            else {
+                patches.push_back({ write->where, std::vector<std::byte>(write->bytes.size()), write->resume });
+            }
+        }
+
+        // Final contents of every region, skip regions that stay the same (i.e. hook installed and removed in one batch)
+        patches.erase(std::remove_if(patches.begin(), patches.end(), [this](rcmp::detail::arch::code_patch_t& patch) {
+            read(patch.where, patch.bytes.data(), patch.bytes.size());
+            return std::memcmp(patch.where.as_ptr(), patch.bytes.data(), patch.bytes.size()) == 0;
+        }), patches.end());
+
+        rcmp::detail::arch::write_code_live(patches);
+        return;
+    }
+#endif
+
+    for (const auto& write : m_writes) {
+        std::memcpy(write.where.as_ptr(), write.bytes.data(), write.bytes.size());
+    }
+}
+
+void rcmp::hook_batch::commit() {
+    assert(!m_finished);
+
+    if (m_parent != nullptr) {
+        std::move(m_writes.begin(), m_writes.end(), std::back_inserter(m_parent->m_writes));
+        std::move(m_rollback_callbacks.begin(), m_rollback_callbacks.end(), std::back_inserter(m_parent->m_rollback_callbacks));
+        std::move(m_commit_callbacks.begin(), m_commit_callbacks.end(), std::back_inserter(m_parent->m_commit_callbacks));
+
+        m_writes.clear();
+        m_rollback_callbacks.clear();
+        m_commit_callbacks.clear();
+
+        finish();
+        return;
+    }
+
+    std::vector<std::pair<rcmp::address_t, std::size_t>> ranges;
+    for (const auto& write : m_writes) {
+        ranges.emplace_back(write.where, write.bytes.size());
+    }
+
+    try {
+        rcmp::protection_scope scope;
+        scope.add(ranges);
+
+        apply_writes();
+
+        // Writes may be spread over several modules and the arena: overlapping and adjacent ones are merged,
+        // distant ones are flushed separately
+        std::vector<std::pair<rcmp::address_t, rcmp::address_t>> flush_ranges;
+        for (const auto& [where, size] : ranges) {
+            flush_ranges.emplace_back(where, where + size);
+        }
+
+        std::sort(flush_ranges.begin(), flush_ranges.end());
+
+        for (auto it = flush_ranges.begin(); it != flush_ranges.end(); ) {
+            const rcmp::address_t begin = it->first;
+            rcmp::address_t       end   = it->second;
+
+            for (++it; it != flush_ranges.end() && it->first <= end; ++it) {
+                end = (std::max)(end, it->second);
+            }
+
+            rcmp::detail::platform::flush_instruction_cache(begin.as_number(), end - begin);
+        }
+    }
+    catch (...) {
+        rollback();
+        throw;
+    }
+
+    // batch is finished before callbacks, so they may start batches of their own
+    const auto callbacks = std::move(m_commit_callbacks);
+
+    m_writes.clear();
+    m_rollback_callbacks.clear();
+    m_commit_callbacks.clear();
+
+    finish();
+
+    for (const auto& callback : callbacks) {
+        callback();
+    }
+}
+
+void rcmp::hook_batch::rollback() noexcept {
+    assert(!m_finished);
+
+    m_writes.clear();
+
+    for (auto it = m_rollback_callbacks.rbegin(); it != m_rollback_callbacks.rend(); ++it) {
+        (*it)();
+    }
+    m_rollback_callbacks.clear();
+    m_commit_callbacks.clear();
+
+    finish();
+}
+
+void rcmp::hook_batch::write(rcmp::address_t where, const void* bytes, std::size_t size, rcmp::address_t resume) {
+    const auto begin = static_cast<const std::byte*>(bytes);
+    m_writes.push_back({ where, std::vector<std::byte>(begin, begin + size), resume });
+}
+
+void rcmp::hook_batch::read(rcmp::address_t where, void* bytes, std::size_t size) const {
+    if (m_parent != nullptr) {
+        m_parent->read(where, bytes, size);
+    }
+    else {
+        std::memcpy(bytes, where.as_ptr(), size);
+    }
+
+    const rcmp::address_t end = where + size;
+    for (const auto& write : m_writes) {
+        const rcmp::address_t write_end = write.where + write.bytes.size();
+
+        const rcmp::address_t overlap_begin = (std::max)(where, write.where);
+        const rcmp::address_t overlap_end   = (std::min)(end, write_end);
+        if (overlap_begin >= overlap_end) {
+            continue;
+        }
+
+        std::memcpy(static_cast<std::byte*>(bytes) + (overlap_begin - where), write.bytes.data() + (overlap_begin - write.where), overlap_end - overlap_begin);
+    }
+}
+
+void rcmp::hook_batch::on_rollback(std::function<void()> callback) {
+    m_rollback_callbacks.push_back(std::move(callback));
+}
+
+void rcmp::hook_batch::on_commit(std::function<void()> callback) {
+    m_commit_callbacks.push_back(std::move(callback));
+}
+
+void rcmp::write_memory(rcmp::address_t where, const void* bytes, std::size_t size) {
+    rcmp::patch_code(where, bytes, size, nullptr);
+}
+
+void rcmp::patch_code(rcmp::address_t where, const void* bytes, std::size_t size, rcmp::address_t resume) {
+    if (size == 0) {
+        return;
+    }
+
+    // Joins active batch, if any
+    rcmp::hook_batch batch;
+    batch.write(where, bytes, size, resume);
+    batch.commit();
+}
+
+void rcmp::read_memory(rcmp::address_t where, void* bytes, std::size_t size) {
+    if (auto batch = rcmp::hook_batch::current()) {
+        batch->read(where, bytes, size);
+        return;
+    }
+
+    std::memcpy(bytes, where.as_ptr(), size);
+}
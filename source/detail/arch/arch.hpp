@@ -0,0 +1,19 @@
+#pragma once
+
+#include <rcmp/detail/address.hpp>
+
+#include <cstddef>
+#include <vector>
+
+namespace rcmp::detail::arch {
+
+struct code_patch_t {
+    rcmp::address_t        where;
+    std::vector<std::byte> bytes;
+    rcmp::address_t        resume; // where thread hitting unfinished patch continues execution
+};
+
+// Writes code that may be executed by other threads at the same time. Memory must be writable already.
+void write_code_live(const std::vector<code_patch_t>& patches);
+
+} // namespace rcmp::detail::arch
@@ -1,16 +1,53 @@
 #include <rcmp/memory.hpp>
 #include <rcmp/codegen.hpp>
+#include <rcmp/hook_handle.hpp>
+#include <rcmp/registry.hpp>
+#include <rcmp/scan.hpp>
+#include <rcmp/detail/epoch.hpp>
+
+#include "../arch.hpp"
+#include "../../platform/platform.hpp"
 
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
 #include <optional>
+#include <thread>
+#include <tuple>
 #include <vector>
 #include <cassert>
 #include <algorithm>
 #include <limits>
+#include <map>
+#include <memory>
 
 static_assert(RCMP_GET_ARCH() == RCMP_ARCH_X86 || RCMP_GET_ARCH() == RCMP_ARCH_X86_64);
 
-static std::size_t opcode_length(rcmp::address_t address);
+namespace {
+
+// Memory operand of x86-64 instruction that is addressed relative to the next instruction, i.e. [rip + disp32]
+struct rip_operand_t {
+    std::size_t  disp_offset;      // offset of disp32 inside of instruction
+    std::uint8_t opcode;
+    std::uint8_t reg;              // ModRM.reg extended with REX.R
+    bool         is_64bit;         // REX.W
+    bool         is_rewritable;    // plain `mov reg, [rip + X]` or `lea reg, [rip + X]`
+};
+
+// Part of instruction information provided by disassembler
+struct raw_instruction_t {
+    std::size_t                  length = 0; // 0 for unknown opcode
+    std::optional<rip_operand_t> rip_operand;
+};
+
+} // unnamed namespace
+
+static raw_instruction_t decode_raw_instruction(const std::uint8_t* bytes);
+
+// Length of instruction at `bytes`, 0 for unknown opcode or instruction that doesn't fit in `size`
+static std::size_t decode_instruction_length(const std::uint8_t* bytes, std::size_t size);
 
 namespace {
 
@@ -31,72 +68,144 @@ std::string hex_dump(rcmp::address_t address, std::size_t count) {
 
 using jmp_diff_t = std::int32_t;
 
-#if RCMP_GET_ARCH() == RCMP_ARCH_X86
-constexpr std::size_t g_jmp_size = 1 + sizeof(jmp_diff_t);
-constexpr std::size_t g_call_size = g_jmp_size;
+// Writes `code` to memory owned by the code arena (it's writable already)
+template <class Range>
+void write_code(rcmp::address_t where, const Range& code) {
+    std::memcpy(where.as_ptr(), std::data(code), std::size(code));
+}
+
+// Machine code of a few instructions, small enough to live on stack
+class code_buffer {
+    std::array<std::byte, 32> m_bytes{};
+    std::size_t m_size = 0;
+
+public:
+    code_buffer& append(const code_buffer& code) {
+        assert(m_size + code.size() <= m_bytes.size());
+
+        std::memcpy(m_bytes.data() + m_size, code.data(), code.size());
+        m_size += code.size();
+        return *this;
+    }
+
+    template <class T>
+    code_buffer& append(const T& value) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        assert(m_size + sizeof(value) <= m_bytes.size());
+
+        std::memcpy(m_bytes.data() + m_size, &value, sizeof(value));
+        m_size += sizeof(value);
+        return *this;
+    }
+
+    const std::byte* data() const {
+        return m_bytes.data();
+    }
+
+    std::size_t size() const {
+        return m_size;
+    }
+};
 
-void make_jmp_or_call_impl(rcmp::address_t from, rcmp::address_t to, std::uint8_t opcode) {
-    const jmp_diff_t delta = to - (from + g_jmp_size);
-    static_assert(sizeof(delta) == 4);
+bool is_rel32_reachable(rcmp::address_t next_instruction, rcmp::address_t to) {
+    const std::ptrdiff_t delta = to - next_instruction;
+    return delta == static_cast<jmp_diff_t>(delta);
+}
 
-    std::array<std::byte, g_jmp_size> code;
-    code[0] = std::byte{ opcode };
-    std::memcpy(&code[1], &delta, sizeof(delta));
+// jmp/call rel32
+constexpr std::size_t g_rel_jmp_size = 1 + sizeof(jmp_diff_t);
 
-    rcmp::set_opcode(from, code);
+code_buffer encode_rel_jmp_or_call(rcmp::address_t from, rcmp::address_t to, std::uint8_t opcode) {
+    const jmp_diff_t delta = static_cast<jmp_diff_t>(to - (from + g_rel_jmp_size));
+    return code_buffer{}.append(opcode).append(delta);
 }
 
-void make_jmp(rcmp::address_t from, rcmp::address_t to) {
-    return make_jmp_or_call_impl(from, to, 0xE9);
+#if RCMP_GET_ARCH() == RCMP_ARCH_X86
+constexpr std::size_t g_max_jmp_size = g_rel_jmp_size;
+constexpr std::size_t g_max_call_size = g_rel_jmp_size;
+
+code_buffer encode_jmp(rcmp::address_t from, rcmp::address_t to) {
+    return encode_rel_jmp_or_call(from, to, 0xE9);
 }
 
-void make_call(rcmp::address_t from, rcmp::address_t to) {
-    return make_jmp_or_call_impl(from, to, 0xE8);
+code_buffer encode_call(rcmp::address_t from, rcmp::address_t to) {
+    return encode_rel_jmp_or_call(from, to, 0xE8);
 }
 
 #else
-constexpr std::size_t g_jmp_size = 8 + sizeof(std::uintptr_t);
+// jmp [rip + disp32]
+constexpr std::size_t g_indirect_jmp_size = 2 + sizeof(jmp_diff_t);
 
-// Reference: https://github.com/stevemk14ebr/PolyHook/blob/master/PolyHook/PolyHook.hpp#L1184
-void make_jmp(rcmp::address_t from, rcmp::address_t to) {
-    std::uintptr_t to_value = to.as_number();
+// jmp [rip + 0]; dq `to`
+constexpr std::size_t g_max_jmp_size = g_indirect_jmp_size + sizeof(std::uintptr_t);
 
-    std::array<std::byte, g_jmp_size> code;
-    code[0] = std::byte{ 0x50 };
-    code[1] = std::byte{ 0x48 };
-    code[2] = std::byte{ 0xB8 };
-    std::memcpy(&code[3], &to_value, sizeof(to_value));
-    code[11] = std::byte{ 0x48 };
-    code[12] = std::byte{ 0x87 };
-    code[13] = std::byte{ 0x04 };
-    code[14] = std::byte{ 0x24 };
-    code[15] = std::byte{ 0xC3 };
+// call [rip + 2]; jmp $+8; dq `to`
+constexpr std::size_t g_max_call_size = g_indirect_jmp_size + 2 + sizeof(std::uintptr_t);
+
+code_buffer encode_indirect_jmp(rcmp::address_t from, rcmp::address_t slot) {
+    const jmp_diff_t delta = static_cast<jmp_diff_t>(slot - (from + g_indirect_jmp_size));
+    return code_buffer{}.append(std::uint8_t{ 0xFF }).append(std::uint8_t{ 0x25 }).append(delta);
+}
+
+// Unlike `push; mov; xchg; ret` sequence, none of these jumps unbalances return stack buffer
+code_buffer encode_jmp(rcmp::address_t from, rcmp::address_t to) {
+    if (is_rel32_reachable(from + g_rel_jmp_size, to)) {
+        return encode_rel_jmp_or_call(from, to, 0xE9);
+    }
 
-    rcmp::set_opcode(from, code);
+    return encode_indirect_jmp(from, from + g_indirect_jmp_size).append(to.as_number());
 }
 
-constexpr std::size_t g_call_size = 8 + sizeof(std::uintptr_t);
+code_buffer encode_call(rcmp::address_t from, rcmp::address_t to) {
+    if (is_rel32_reachable(from + g_rel_jmp_size, to)) {
+        return encode_rel_jmp_or_call(from, to, 0xE8);
+    }
+
+    return code_buffer{}
+        .append(std::array<std::uint8_t, 8>{{ 0xFF, 0x15, 0x02, 0x00, 0x00, 0x00, 0xEB, 0x08 }})
+        .append(to.as_number());
+}
 
-[[maybe_unused]]
-void make_call(rcmp::address_t from, rcmp::address_t to) {
-    std::uintptr_t to_value = to.as_number();
+#endif
 
-    std::array<std::byte, g_call_size> code;
-    code[0] = std::byte{ 0xFF };
-    code[1] = std::byte{ 0x15 };
-    code[2] = std::byte{ 0x02 };
-    code[3] = std::byte{ 0x00 };
-    code[4] = std::byte{ 0x00 };
-    code[5] = std::byte{ 0x00 };
-    code[6] = std::byte{ 0xEB };
-    code[7] = std::byte{ 0x08 };
-    std::memcpy(&code[8], &to_value, sizeof(to_value));
+// Every hooked function jumps to its own dispatcher: `jmp [slot]`, where slot holds address of the latest hook
+#if RCMP_GET_ARCH() == RCMP_ARCH_X86_64
+// jmp [rip + 2]; int3; int3; dq `slot`
+#else
+// jmp [`slot`]; int3; int3; dd `slot`
+#endif
+constexpr std::size_t g_dispatcher_slot_offset = 8;
+constexpr std::size_t g_dispatcher_size        = g_dispatcher_slot_offset + sizeof(std::uintptr_t);
+
+code_buffer encode_dispatcher(rcmp::address_t dispatcher, rcmp::address_t destination) {
+    code_buffer code;
+    code.append(std::uint8_t{ 0xFF });
+    code.append(std::uint8_t{ 0x25 });
+#if RCMP_GET_ARCH() == RCMP_ARCH_X86_64
+    code.append(static_cast<jmp_diff_t>(g_dispatcher_slot_offset - 6));
+#else
+    code.append((dispatcher + g_dispatcher_slot_offset).as_number());
+#endif
+    code.append(std::uint8_t{ 0xCC });
+    code.append(std::uint8_t{ 0xCC });
+    code.append(destination.as_number());
 
-    rcmp::set_opcode(from, code);
+    static_cast<void>(dispatcher);
+    return code;
 }
 
+// Jump that overwrites prolog of hooked function, so it should be as short as possible
+code_buffer encode_entry_jmp(rcmp::address_t from, rcmp::address_t dispatcher) {
+#if RCMP_GET_ARCH() == RCMP_ARCH_X86_64
+    // Dispatcher is far away, but its slot can be used directly
+    if (const auto slot = dispatcher + g_dispatcher_slot_offset; !is_rel32_reachable(from + g_rel_jmp_size, dispatcher) && is_rel32_reachable(from + g_indirect_jmp_size, slot)) {
+        return encode_indirect_jmp(from, slot);
+    }
 #endif
 
+    return encode_jmp(from, dispatcher);
+}
+
 class opcode {
     uint8_t m_len = 0;
     uint8_t m_bytes[2]{};
@@ -183,213 +292,1502 @@ public:
     }
 };
 
-std::size_t relocate_opcode(rcmp::address_t from, rcmp::address_t to) {
-    char dummy[30];
-    if (to == nullptr) {
-        to = &dummy;
+#if RCMP_GET_ARCH() == RCMP_ARCH_X86_64
+// mov r64, imm64 + mov r, [r64]
+constexpr std::size_t g_max_rip_operand_fallback_size = 2 + sizeof(std::uintptr_t) + 4;
+
+// Replaces `mov/lea reg, [rip + X]` with an equivalent sequence that doesn't depend on instruction address
+code_buffer encode_rip_operand_fallback(const rip_operand_t& operand, rcmp::address_t target) {
+    assert(operand.is_rewritable);
+
+    const std::uint8_t reg_low  = operand.reg & 0b111;
+    const bool         reg_high = operand.reg >= 8;
+
+    code_buffer code;
+
+    if (operand.opcode == 0x8D && !operand.is_64bit) {
+        // lea r32, [rip + X] -> mov r32, imm32
+        if (reg_high) {
+            code.append(std::uint8_t{ 0x41 });
+        }
+        return code.append(static_cast<std::uint8_t>(0xB8 + reg_low)).append(static_cast<std::uint32_t>(target.as_number()));
+    }
+
+    // mov r64, imm64
+    code.append(static_cast<std::uint8_t>(reg_high ? 0x49 : 0x48));
+    code.append(static_cast<std::uint8_t>(0xB8 + reg_low));
+    code.append(target.as_number());
+
+    if (operand.opcode == 0x8D) {
+        // lea r64, [rip + X] is done
+        return code;
+    }
+
+    // mov r, [r64]
+    const std::uint8_t rex = 0x40 | (operand.is_64bit ? 0b1000 : 0) | (reg_high ? 0b0101 : 0);
+    if (rex != 0x40) {
+        code.append(rex);
+    }
+    code.append(std::uint8_t{ 0x8B });
+
+    if (reg_low == 0b100) {
+        // [r12] requires SIB
+        code.append(static_cast<std::uint8_t>((reg_low << 3) | 0b100)).append(std::uint8_t{ 0x24 });
+    }
+    else if (reg_low == 0b101) {
+        // [rbp]/[r13] requires disp8
+        code.append(static_cast<std::uint8_t>(0b01000000 | (reg_low << 3) | 0b101)).append(std::uint8_t{ 0x00 });
     }
+    else {
+        code.append(static_cast<std::uint8_t>((reg_low << 3) | reg_low));
+    }
+
+    return code;
+}
+#endif
+
+enum class instruction_kind {
+    plain,           // copied as is
+    relative_branch, // jmp/call/j* rel8/rel32
+    rip_operand,     // has [rip + disp32] operand
+};
+
+// Prolog instruction, decoded once and then used by every relocation stage
+struct decoded_instruction {
+    rcmp::address_t  address;
+    std::size_t      length;
+    instruction_kind kind;
+    rcmp::address_t  target;      // branch destination or address referenced by rip-relative operand
+    opcode           long_opcode; // rel32 form of branch
+    rip_operand_t    rip_operand;
 
-    const auto cmd_len    = opcode_length(from);
-    const auto bytes_from = from.as_ptr<const uint8_t>();
-    const auto bytes_to   = to.as_ptr<uint8_t>();
+    std::array<std::uint8_t, 15> bytes;
 
-    if (cmd_len == 0) {
-        throw rcmp::error("unknown opcode: %s...", hex_dump(from, 4).c_str());
+    // Index of instruction targeted by branch, if it's a part of relocated prolog too
+    std::optional<std::size_t> internal_target;
+};
+
+decoded_instruction decode_instruction(rcmp::address_t address) {
+    // Read through batch, so prolog patched by not yet committed hook is relocated as well
+    std::array<std::uint8_t, 15> buffer;
+    rcmp::read_memory(address, buffer.data(), buffer.size());
+
+    const auto bytes = buffer.data();
+    const auto raw   = decode_raw_instruction(bytes);
+
+    if (raw.length == 0) {
+        throw rcmp::error("unknown opcode: %s...", hex_dump(address, 4).c_str());
     }
 
-    if (!jmp_translator::instance().is_relocatable(cmd_len, bytes_from[0])) {
-        throw rcmp::error("unsupported opcode: %s", hex_dump(from, cmd_len).c_str());
+    if (!jmp_translator::instance().is_relocatable(raw.length, bytes[0])) {
+        throw rcmp::error("unsupported opcode: %s", hex_dump(address, raw.length).c_str());
     }
 
-    std::optional<std::pair<opcode /* long jmp */, std::ptrdiff_t /* old_offset */>> jmp_info;
+    decoded_instruction result{ address, raw.length, instruction_kind::plain, nullptr, opcode{ 0x90 }, {}, {}, std::nullopt };
+    std::memcpy(result.bytes.data(), bytes, raw.length);
 
-    if (cmd_len == 2) {
-        if (auto maybe_long_opcode = jmp_translator::instance().short_to_long(opcode{ bytes_from[0] })) {
+    const auto set_branch = [&](opcode long_opcode, std::ptrdiff_t offset) {
+        result.kind        = instruction_kind::relative_branch;
+        result.long_opcode = long_opcode;
+        result.target      = address + raw.length + offset;
+    };
+
+    if (raw.length == 2) {
+        if (auto maybe_long_opcode = jmp_translator::instance().short_to_long(opcode{ bytes[0] })) {
             // relative jmp [XX YY], where YY is offset
             std::int8_t jmp_offset = 0;
-            std::memcpy(&jmp_offset, bytes_from + 1, sizeof(jmp_offset));
+            std::memcpy(&jmp_offset, bytes + 1, sizeof(jmp_offset));
 
-            jmp_info.emplace(*maybe_long_opcode, jmp_offset);
+            set_branch(*maybe_long_opcode, jmp_offset);
         }
     }
-    else if (cmd_len == 1 + sizeof(jmp_diff_t)) {
-        opcode cmd = opcode{ bytes_from[0] };
+    else if (raw.length == 1 + sizeof(jmp_diff_t)) {
+        opcode cmd = opcode{ bytes[0] };
         if (jmp_translator::instance().is_long(cmd)) {
             // relative jmp [XX YY YY YY YY], where YY is offset
             jmp_diff_t jmp_offset = 0;
-            std::memcpy(&jmp_offset, bytes_from + 1, sizeof(jmp_offset));
+            std::memcpy(&jmp_offset, bytes + 1, sizeof(jmp_offset));
 
-            jmp_info.emplace(cmd, jmp_offset);
+            set_branch(cmd, jmp_offset);
         }
     }
-    else if (cmd_len == 2 + sizeof(jmp_diff_t)) {
-        opcode cmd = opcode{ bytes_from[0], bytes_from[1] };
+    else if (raw.length == 2 + sizeof(jmp_diff_t)) {
+        opcode cmd = opcode{ bytes[0], bytes[1] };
         if (jmp_translator::instance().is_long(cmd)) {
             // relative jmp [XX XX YY YY YY YY], where YY is offset
             jmp_diff_t jmp_offset = 0;
-            std::memcpy(&jmp_offset, bytes_from + 2, sizeof(jmp_offset));
+            std::memcpy(&jmp_offset, bytes + 2, sizeof(jmp_offset));
 
-            jmp_info.emplace(cmd, jmp_offset);
+            set_branch(cmd, jmp_offset);
         }
     }
 
-    // requires relocation
-    if (jmp_info) {
-        const auto [long_opcode, old_jmp_offset] = *jmp_info;
+    if (result.kind == instruction_kind::plain && raw.rip_operand) {
+        jmp_diff_t disp = 0;
+        std::memcpy(&disp, bytes + raw.rip_operand->disp_offset, sizeof(disp));
+
+        result.kind        = instruction_kind::rip_operand;
+        result.rip_operand = *raw.rip_operand;
+        result.target      = address + raw.length + disp;
+    }
+
+    return result;
+}
 
-        const std::uint8_t* jmp_destination_address = (bytes_from + cmd_len) + old_jmp_offset;
+// Decodes whole instructions covering at least `min_size` bytes starting from `address`
+std::vector<decoded_instruction> decode_prolog(rcmp::address_t address, std::size_t min_size) {
+    std::vector<decoded_instruction> result;
 
-        const std::ptrdiff_t new_jmp_offset_long = jmp_destination_address - (bytes_to + long_opcode.len() + sizeof(jmp_diff_t));
-        const jmp_diff_t new_jmp_offset = static_cast<jmp_diff_t>(new_jmp_offset_long);
+    for (rcmp::address_t it = address; it < address + min_size; it += result.back().length) {
+        result.push_back(decode_instruction(it));
+    }
 
-#if RCMP_GET_ARCH() == RCMP_ARCH_X86
-        static_assert(sizeof(jmp_diff_t) == sizeof(std::ptrdiff_t));
-#else
-        if (new_jmp_offset_long != new_jmp_offset) {
-            // Use direct jump
-            make_jmp(bytes_to, jmp_destination_address);
-            return g_jmp_size;
+    return result;
+}
+
+// Branches to relocated instructions must follow them, branches to the middle of instruction can't be relocated at all
+void verify_prolog(std::vector<decoded_instruction>& prolog) {
+    const rcmp::address_t begin = prolog.front().address;
+    const rcmp::address_t end   = prolog.back().address + prolog.back().length;
+
+    for (auto& instruction : prolog) {
+        if (instruction.kind != instruction_kind::relative_branch) {
+            continue;
+        }
+
+        // jump to the beginning of function is fine, it's the address of new entry
+        if (instruction.target <= begin || instruction.target >= end) {
+            continue;
+        }
+
+        const auto it = std::find_if(prolog.begin(), prolog.end(), [&instruction](const decoded_instruction& other) {
+            return other.address == instruction.target;
+        });
+
+        if (it == prolog.end()) {
+            throw rcmp::error("unable to relocate jump into the middle of instruction: %s", hex_dump(instruction.address, instruction.length).c_str());
+        }
+
+        instruction.internal_target = static_cast<std::size_t>(it - prolog.begin());
+    }
+}
+
+// Upper bound of relocated instruction size, doesn't depend on where instruction is relocated to
+std::size_t max_relocated_size(const decoded_instruction& instruction) {
+    switch (instruction.kind) {
+        case instruction_kind::plain:
+            return instruction.length;
+
+        case instruction_kind::relative_branch:
+#if RCMP_GET_ARCH() == RCMP_ARCH_X86_64
+            if (!instruction.internal_target) {
+                if (instruction.long_opcode == opcode{ 0xE9 }) {
+                    return g_max_jmp_size;
+                }
+                if (instruction.long_opcode == opcode{ 0xE8 }) {
+                    return g_max_call_size;
+                }
+                return 2 + g_max_jmp_size;
+            }
+#endif
+            return instruction.long_opcode.len() + sizeof(jmp_diff_t);
+
+        case instruction_kind::rip_operand:
+#if RCMP_GET_ARCH() == RCMP_ARCH_X86_64
+            if (instruction.rip_operand.is_rewritable) {
+                return (std::max)(instruction.length, g_max_rip_operand_fallback_size);
+            }
+#endif
+            return instruction.length;
+    }
+
+    return instruction.length;
+}
+
+code_buffer encode_long_branch(const opcode& long_opcode, rcmp::address_t from, rcmp::address_t to) {
+    const jmp_diff_t offset = static_cast<jmp_diff_t>(to - (from + long_opcode.len() + sizeof(jmp_diff_t)));
+
+    code_buffer code;
+    code.append(long_opcode.first());
+    if (long_opcode.len() == 2) {
+        code.append(long_opcode.second());
+    }
+    return code.append(offset);
+}
+
+code_buffer relocate_branch(const decoded_instruction& instruction, rcmp::address_t to) {
+    const opcode& long_opcode = instruction.long_opcode;
+
+#if RCMP_GET_ARCH() == RCMP_ARCH_X86_64
+    if (!is_rel32_reachable(to + long_opcode.len() + sizeof(jmp_diff_t), instruction.target)) {
+        // Destination is out of rel32 reach, use absolute jump/call instead
+        if (long_opcode == opcode{ 0xE9 }) {
+            return encode_jmp(to, instruction.target);
+        }
+
+        if (long_opcode == opcode{ 0xE8 }) {
+            return encode_call(to, instruction.target);
         }
+
+        // j*: short jump with inverted condition over absolute jump
+        const auto jmp = encode_jmp(to + 2, instruction.target);
+
+        code_buffer code;
+        code.append(static_cast<std::uint8_t>(0x70 + ((long_opcode.second() - 0x80) ^ 1)));
+        code.append(static_cast<std::uint8_t>(jmp.size()));
+        return code.append(jmp);
+    }
 #endif
 
-        std::memcpy(bytes_to, long_opcode.data(), long_opcode.len());
-        std::memcpy(bytes_to + long_opcode.len(), &new_jmp_offset, sizeof(new_jmp_offset));
+    return encode_long_branch(long_opcode, to, instruction.target);
+}
+
+code_buffer relocate_rip_operand(const decoded_instruction& instruction, rcmp::address_t to) {
+    const auto& operand = instruction.rip_operand;
 
-        return long_opcode.len() + sizeof(jmp_diff_t);
+    const std::ptrdiff_t new_disp_long = instruction.target - (to + instruction.length);
+    const jmp_diff_t new_disp = static_cast<jmp_diff_t>(new_disp_long);
+
+    if (new_disp_long == new_disp) {
+        auto bytes = instruction.bytes;
+        std::memcpy(bytes.data() + operand.disp_offset, &new_disp, sizeof(new_disp));
+
+        code_buffer code;
+        for (std::size_t i = 0; i < instruction.length; i++) {
+            code.append(bytes[i]);
+        }
+        return code;
     }
-    else {
-        // default
-        std::memcpy(bytes_to, bytes_from, cmd_len);
-        return cmd_len;
+
+#if RCMP_GET_ARCH() == RCMP_ARCH_X86_64
+    if (operand.is_rewritable) {
+        return encode_rip_operand_fallback(operand, instruction.target);
     }
+#endif
+
+    throw rcmp::error("unable to relocate rip-relative operand, target is out of reach: %s", hex_dump(instruction.address, instruction.length).c_str());
 }
 
-std::unique_ptr<std::byte[]> relocate_function(rcmp::address_t address, std::size_t bytes) {
+struct relocated_prolog_t {
+    rcmp::code_ptr code; // relocated prolog followed by jump back to original function
+    std::size_t    size; // number of whole-instruction bytes moved from original function
+};
+
+relocated_prolog_t relocate_function(rcmp::address_t address, std::size_t bytes) {
     if (bytes == 0) {
-        return nullptr;
+        return { nullptr, 0 };
     }
 
-    const std::size_t relocated_size = [address, bytes]{
-        rcmp::address_t from_it  = address;
-        std::size_t     out_size = 0;
+    auto prolog = decode_prolog(address, bytes);
+    verify_prolog(prolog);
 
-        while (from_it < address + bytes) {
-            out_size += relocate_opcode(from_it, nullptr);
-            from_it  += opcode_length(from_it);
-        }
-        return out_size;
-    }();
+    std::size_t relocated_size = 0;
+    for (const auto& instruction : prolog) {
+        relocated_size += max_relocated_size(instruction);
+    }
+
+    // Keep relocated code close to the original one, so relative jumps stay short
+    auto result = rcmp::allocate_code(relocated_size + g_max_jmp_size, address);
 
-    // 1 + sizeof(..) == sizeof(jmp)
-    auto result = rcmp::allocate_code(relocated_size + g_jmp_size);
+    // Internal branches are resolved when all instructions are placed
+    std::vector<rcmp::address_t> new_addresses;
+    new_addresses.reserve(prolog.size());
 
     // copy beginning of func to result
-    rcmp::address_t from_it = address;
-    rcmp::address_t out_it  = result.get();
+    rcmp::address_t out_it = result.get();
+
+    for (const auto& instruction : prolog) {
+        new_addresses.push_back(out_it);
+
+        switch (instruction.kind) {
+            case instruction_kind::plain:
+                std::memcpy(out_it.as_ptr(), instruction.bytes.data(), instruction.length);
+                out_it += instruction.length;
+                break;
+
+            case instruction_kind::relative_branch: {
+                const auto code = instruction.internal_target ? encode_long_branch(instruction.long_opcode, out_it, out_it)
+                                                              : relocate_branch(instruction, out_it);
+                write_code(out_it, code);
+                out_it += code.size();
+                break;
+            }
+
+            case instruction_kind::rip_operand: {
+                const auto code = relocate_rip_operand(instruction, out_it);
+                write_code(out_it, code);
+                out_it += code.size();
+                break;
+            }
+        }
+    }
 
-    while (from_it < address + bytes) {
-        out_it  += relocate_opcode(from_it, out_it);
-        from_it += opcode_length(from_it);
+    for (std::size_t i = 0; i < prolog.size(); i++) {
+        if (const auto& instruction = prolog[i]; instruction.internal_target) {
+            write_code(new_addresses[i], encode_long_branch(instruction.long_opcode, new_addresses[i], new_addresses[*instruction.internal_target]));
+        }
     }
 
-    rcmp::unprotect_memory(address, from_it - address);
-    std::memset(rcmp::bit_cast<char*>(address), 0x90, from_it - address);
+    const rcmp::address_t from_it = prolog.back().address + prolog.back().length;
 
     // jump from end of result to original func
-    make_jmp(out_it, from_it);
+    write_code(out_it, encode_jmp(out_it, from_it));
 
-    return result;
+    return { std::move(result), static_cast<std::size_t>(from_it - address) };
 }
 
-} // unnamed namespace
+// All hooks of a single function share entry jump, relocated prolog and dispatcher.
+// Each enabled hook calls the enabled one installed before it as `original`, the first one calls relocated prolog.
+struct hooked_function_t {
+    struct layer_t {
+        rcmp::address_t wrapper;
+        rcmp::address_t original_ref; // where the hook keeps address of `original`, identifies the layer
+        bool            enabled = true;
+    };
 
-// returns relocated original address
-rcmp::address_t rcmp::detail::install_x86_x86_64_raw_hook(rcmp::address_t original_function, rcmp::address_t wrapper_function) {
-    // Move the beginning of `original_function` to a new address
-    auto new_original = relocate_function(original_function, g_jmp_size);
+    rcmp::address_t        address;
+    std::vector<std::byte> original_bytes; // overwritten by entry jump
+    std::vector<std::byte> entry_bytes;    // entry jump padded with nops
+    bool                   entry_patched = false;
+    rcmp::code_ptr         relocated_prolog;
+    rcmp::code_ptr         dispatcher;
+    std::vector<layer_t>   layers;         // in order of installation
 
-    // Jump from `original_function` to our wrapper
-    make_jmp(original_function, wrapper_function);
+    rcmp::address_t slot() const {
+        return dispatcher.get() + g_dispatcher_slot_offset;
+    }
 
-    // Return address of moved `original_function`, so it can be later called from `wrapper_function`
-    // force memory leak
-    return new_original.release();
-}
+    // `original` for the layer with given index
+    rcmp::address_t original(std::size_t index) const {
+        for (std::size_t i = index; i > 0; i--) {
+            if (layers[i - 1].enabled) {
+                return layers[i - 1].wrapper;
+            }
+        }
 
-#if RCMP_GET_ARCH() == RCMP_ARCH_X86
-rcmp::address_t rcmp::detail::install_x86_x86_64_hook_with_tls_state(rcmp::address_t original_function, rcmp::address_t wrapper_function, void* state, void(*state_saver)(void*)) {
-#if RCMP_GET_ARCH() == RCMP_ARCH_X86
-    auto tls_injector_size = 0;
-    tls_injector_size += 5;           // push `state`
-    tls_injector_size += g_call_size; // call `state_saver`
-    tls_injector_size += 3 ;          // add esp, 4
-    tls_injector_size += g_jmp_size;  // jmp to wrapper
+        return relocated_prolog.get();
+    }
 
-    auto tls_injector = allocate_code(tls_injector_size);
-    auto ptr = tls_injector.get();
+    std::vector<layer_t>::iterator find_layer(rcmp::address_t original_ref) {
+        const auto it = std::find_if(layers.begin(), layers.end(), [original_ref](const layer_t& layer) {
+            return layer.original_ref == original_ref;
+        });
 
-    auto write = [&ptr](auto value) {
-        std::memcpy(ptr, &value, sizeof value);
-        ptr += sizeof value;
+        if (it == layers.end()) {
+            throw rcmp::error("hook of %" PRIXPTR " is not installed", address.as_number());
+        }
+
+        return it;
+    }
+};
+
+// Immutable copy of the registry for lock-free lookups
+struct registry_snapshot_t {
+    struct code_owner_t {
+        rcmp::code_range range;
+        std::size_t      function_index;
     };
 
-    // push `state`
-    write(std::uint8_t{ 0x68 });
-    write(rcmp::bit_cast<std::uintptr_t>(state));
+    std::vector<rcmp::hooked_function_info> functions; // sorted by address
+    std::vector<code_owner_t>               code;      // sorted by range, ranges don't overlap
+    std::size_t                             hook_count = 0;
 
-    // call `state_saver`
-    make_call(ptr, rcmp::bit_cast<std::uintptr_t>(state_saver));
-    ptr += g_call_size;
+    // Generated code of listed functions isn't freed while somebody may still read the snapshot
+    std::vector<std::shared_ptr<const hooked_function_t>> owners;
+};
 
-    // add esp, 4
-    write(std::array<std::uint8_t, 3>{{ 0x83, 0xC4, 0x04 }});
-#else
-    static_assert(false, "Not supported yet");
-#endif
+std::atomic<const registry_snapshot_t*> g_registry_snapshot{ nullptr };
 
-    // Jump from `tls_injector` to our wrapper
-    make_jmp(ptr, wrapper_function);
+// Retired snapshot is freed once every reader that could have seen it has left
+rcmp::detail::epoch_t g_registry_epoch;
 
-    // Move the beginning of `original_function` to a new address
-    auto new_original = relocate_function(original_function, g_jmp_size);
+class registry_reader {
+    std::size_t                m_epoch;
+    const registry_snapshot_t* m_snapshot;
 
-    // Jump from `original_function` to `tls_injector`
-    make_jmp(original_function, tls_injector.get());
+public:
+    registry_reader() noexcept : m_epoch(g_registry_epoch.enter()), m_snapshot(g_registry_snapshot.load()) {}
 
-    // force memory leak
-    tls_injector.release();
+    registry_reader(const registry_reader&) = delete;
+    registry_reader& operator=(const registry_reader&) = delete;
 
-    // Return address of moved `original_function`, so it can be later called from `wrapper_function`
-    // force memory leak
-    return new_original.release();
-}
-#endif
+    ~registry_reader() {
+        g_registry_epoch.leave(m_epoch);
+    }
 
-#define RCMP_ENABLE_ONLY_LENGTH_DISASM
+    // May be null, if nothing was hooked yet
+    const registry_snapshot_t* operator->() const noexcept {
+        return m_snapshot;
+    }
 
-#define NMD_ASSEMBLY_IMPLEMENTATION
+    explicit operator bool() const noexcept {
+        return m_snapshot != nullptr;
+    }
 
-#if RCMP_GET_COMPILER() == RCMP_COMPILER_GCC
-    #pragma GCC diagnostic push
-    // nothing
-#elif RCMP_GET_COMPILER() == RCMP_COMPILER_CLANG
-    #pragma clang diagnostic push
-    #pragma clang diagnostic ignored "-Wmissing-braces"
-#elif RCMP_GET_COMPILER() == RCMP_COMPILER_MSVC
-    #pragma warning(push)
-    // nothing
-#endif
+    const rcmp::hooked_function_info* find(rcmp::address_t function) const noexcept {
+        if (m_snapshot == nullptr) {
+            return nullptr;
+        }
 
-#include <nmd_assembly.h>
+        const auto& functions = m_snapshot->functions;
+        const auto it = std::lower_bound(functions.begin(), functions.end(), function, [](const rcmp::hooked_function_info& info, rcmp::address_t address) {
+            return info.function < address;
+        });
 
-#if RCMP_GET_COMPILER() == RCMP_COMPILER_GCC
-    #pragma GCC diagnostic pop
-#elif RCMP_GET_COMPILER() == RCMP_COMPILER_CLANG
-    #pragma clang diagnostic pop
-#elif RCMP_GET_COMPILER() == RCMP_COMPILER_MSVC
-    #pragma warning(pop)
-#endif
+        return it != functions.end() && it->function == function ? &*it : nullptr;
+    }
+
+    const rcmp::hooked_function_info* find_by_code(rcmp::address_t pc) const noexcept {
+        if (m_snapshot == nullptr) {
+            return nullptr;
+        }
+
+        // the last range starting at or before `pc`
+        const auto& code = m_snapshot->code;
+        const auto it = std::upper_bound(code.begin(), code.end(), pc, [](rcmp::address_t address, const registry_snapshot_t::code_owner_t& owner) {
+            return address < owner.range.begin;
+        });
+
+        if (it == code.begin() || !std::prev(it)->range.contains(pc)) {
+            return nullptr;
+        }
+
+        return &m_snapshot->functions[std::prev(it)->function_index];
+    }
+};
+
+// Changes of a hooked function are serialized by its stripe, that is held by the changing thread until its batch ends:
+// otherwise another thread could build upon a layer that is rolled back later.
+class function_locks {
+    static constexpr std::size_t g_stripe_count = 64;
+
+    // Waiting while holding other stripes may deadlock, so it's limited
+    static constexpr std::chrono::milliseconds g_nested_lock_timeout{ 500 };
+
+    std::array<std::recursive_timed_mutex, g_stripe_count> m_stripes;
+
+    inline static thread_local std::size_t t_held_count = 0;
+
+    std::recursive_timed_mutex& stripe_of(rcmp::address_t address) {
+        return m_stripes[(address.as_number() / 16) % g_stripe_count];
+    }
+
+    std::function<void()> unlocker(rcmp::address_t address) {
+        return [&stripe = stripe_of(address)] {
+            t_held_count--;
+            stripe.unlock();
+        };
+    }
+
+public:
+    // Stripe is released if the current batch is rolled back, see `unlock_on_commit` otherwise
+    void lock(rcmp::address_t address) {
+        auto& stripe = stripe_of(address);
+
+        if (t_held_count == 0) {
+            stripe.lock();
+        }
+        else if (!stripe.try_lock_for(g_nested_lock_timeout)) {
+            throw rcmp::error("function %" PRIXPTR " is being changed by another thread for too long", address.as_number());
+        }
+
+        t_held_count++;
+        rcmp::hook_batch::current()->on_rollback(unlocker(address));
+    }
+
+    // Stripe is released after commit callbacks registered so far, so changes are published in order
+    void unlock_on_commit(rcmp::address_t address) {
+        rcmp::hook_batch::current()->on_commit(unlocker(address));
+    }
+};
+
+class hook_registry {
+    function_locks m_locks;
+
+    // Guards containers below, never held while waiting for a stripe
+    std::mutex m_mutex;
+
+    std::map<std::uintptr_t, std::shared_ptr<hooked_function_t>> m_functions;
+
+    struct committed_function_t {
+        rcmp::hooked_function_info               info;
+        std::shared_ptr<const hooked_function_t> owner;
+    };
+
+    using retired_snapshot_t = std::pair<std::size_t, std::unique_ptr<const registry_snapshot_t>>; // (epoch it's retired in, snapshot)
+
+    // As of the last commit
+    std::map<std::uintptr_t, committed_function_t> m_committed;
+    std::vector<retired_snapshot_t>                m_retired_snapshots;
+
+    static rcmp::hooked_function_info make_info(const hooked_function_t& function) {
+        const auto range = [](const rcmp::code_ptr& code) {
+            return rcmp::code_range{ code.get(), code.get() + code.get_deleter().size };
+        };
+
+        return {
+            function.address,
+            function.layers.size(),
+            function.entry_patched,
+            { function.address, function.address + function.original_bytes.size() },
+            range(function.relocated_prolog),
+            range(function.dispatcher),
+        };
+    }
+
+    // Snapshot is published once the batch is committed, so readers never see code that isn't written yet.
+    // Info is taken right away: the function may be changed by another thread once the batch releases its stripe.
+    void on_changed(const std::shared_ptr<hooked_function_t>& function) {
+        std::optional<committed_function_t> committed;
+        if (!function->layers.empty()) {
+            committed = committed_function_t{ make_info(*function), function };
+        }
+
+        rcmp::hook_batch::current()->on_commit([this, address = function->address, committed] {
+            const std::lock_guard lock(m_mutex);
+
+            if (committed.has_value()) {
+                m_committed[address.as_number()] = *committed;
+            }
+            else {
+                m_committed.erase(address.as_number());
+            }
+
+            publish_snapshot();
+        });
+    }
+
+    void publish_snapshot() {
+        auto snapshot = std::make_unique<registry_snapshot_t>();
+        snapshot->functions.reserve(m_committed.size());
+        snapshot->code.reserve(m_committed.size() * 3);
+        snapshot->owners.reserve(m_committed.size());
+
+        for (const auto& [address, committed] : m_committed) {
+            const auto& info  = committed.info;
+            const auto  index = snapshot->functions.size();
+            snapshot->functions.push_back(info);
+            snapshot->owners.push_back(committed.owner);
+            snapshot->hook_count += info.hook_count;
+
+            for (const auto& code : { info.patched_code, info.relocated_prolog, info.dispatcher }) {
+                snapshot->code.push_back({ code, index });
+            }
+        }
+
+        std::sort(snapshot->code.begin(), snapshot->code.end(), [](const registry_snapshot_t::code_owner_t& lhs, const registry_snapshot_t::code_owner_t& rhs) {
+            return lhs.range.begin < rhs.range.begin;
+        });
+
+        // Readers that come later see the new snapshot only
+        const auto previous = g_registry_snapshot.exchange(snapshot.release());
+        m_retired_snapshots.emplace_back(g_registry_epoch.current(), previous);
+
+        g_registry_epoch.advance();
+        m_retired_snapshots.erase(std::remove_if(m_retired_snapshots.begin(), m_retired_snapshots.end(), [](const retired_snapshot_t& retired) {
+            return g_registry_epoch.is_reclaimable(retired.first);
+        }), m_retired_snapshots.end());
+    }
+
+    static void write_address(rcmp::address_t where, rcmp::address_t value) {
+        rcmp::write_memory(where, &value, sizeof(value));
+    }
+
+    // Relocates prolog, entry jump is written by `link_layers`
+    static std::shared_ptr<hooked_function_t> hook_function(rcmp::address_t address) {
+        auto function = std::make_shared<hooked_function_t>();
+        function->address = address;
+
+        function->dispatcher = rcmp::allocate_code(g_dispatcher_size, address);
+        const auto entry_jmp = encode_entry_jmp(address, function->dispatcher.get());
+
+        // Move the beginning of `address` to a new place
+        auto relocated = relocate_function(address, entry_jmp.size());
+        function->relocated_prolog = std::move(relocated.code);
+
+        // Nobody is using the dispatcher yet
+        write_code(function->dispatcher.get(), encode_dispatcher(function->dispatcher.get(), function->relocated_prolog.get()));
+
+        // Overwrite prolog with entry jump, the rest of relocated instructions is filled with nops
+        code_buffer patch;
+        patch.append(entry_jmp);
+        while (patch.size() < relocated.size) {
+            patch.append(std::uint8_t{ 0x90 });
+        }
+
+        function->original_bytes.resize(patch.size());
+        rcmp::read_memory(address, function->original_bytes.data(), function->original_bytes.size());
+
+        function->entry_bytes.assign(patch.data(), patch.data() + patch.size());
+
+        return function;
+    }
+
+    // Chains enabled layers together. Entry jump is there only while at least one layer is enabled,
+    // so a function with all hooks disabled runs its original code.
+    static void link_layers(const std::shared_ptr<hooked_function_t>& function) {
+        rcmp::address_t top = function->relocated_prolog.get();
+        for (const auto& layer : function->layers) {
+            if (layer.enabled) {
+                write_address(layer.original_ref, top);
+                top = layer.wrapper;
+            }
+        }
+
+        write_address(function->slot(), top);
 
-std::size_t opcode_length(rcmp::address_t address) {
-    return nmd_x86_ldisasm(address.as_ptr(), (std::numeric_limits<std::size_t>::max)(), RCMP_GET_ARCH() == RCMP_ARCH_X86 ? NMD_X86_MODE_32 : NMD_X86_MODE_64);
+        const bool patch_entry = top != rcmp::address_t(function->relocated_prolog.get());
+        if (patch_entry == function->entry_patched) {
+            return;
+        }
+
+        // Relocated prolog behaves just like the original one, so threads hitting the prolog while it's patched continue there
+        const auto& bytes = patch_entry ? function->entry_bytes : function->original_bytes;
+        rcmp::patch_code(function->address, bytes.data(), bytes.size(), function->relocated_prolog.get());
+
+        function->entry_patched = patch_entry;
+        rcmp::hook_batch::current()->on_rollback([function, patch_entry] {
+            function->entry_patched = !patch_entry;
+        });
+    }
+
+    std::shared_ptr<hooked_function_t> find_function(rcmp::address_t address) {
+        const std::lock_guard lock(m_mutex);
+
+        const auto it = m_functions.find(address.as_number());
+        if (it == m_functions.end()) {
+            throw rcmp::error("function %" PRIXPTR " is not hooked", address.as_number());
+        }
+
+        return it->second;
+    }
+
+    void set_function(rcmp::address_t address, std::shared_ptr<hooked_function_t> function) noexcept {
+        const std::lock_guard lock(m_mutex);
+
+        if (function != nullptr) {
+            m_functions[address.as_number()] = std::move(function);
+        }
+        else {
+            m_functions.erase(address.as_number());
+        }
+    }
+
+public:
+    // Never destroyed, hooks that aren't uninstalled explicitly stay until the end of the program
+    static hook_registry& instance() {
+        static const auto instance = new hook_registry;
+        return *instance;
+    }
+
+    // Jumps to the latest enabled hook of the hooked function, exists while it has hooks
+    rcmp::address_t dispatcher(rcmp::address_t address) {
+        return find_function(address)->dispatcher.get();
+    }
+
+    // Returns `original` for the new hook
+    rcmp::address_t install(rcmp::address_t address, rcmp::address_t wrapper, rcmp::address_t original_ref) {
+        rcmp::hook_batch batch;
+
+        m_locks.lock(address);
+
+        std::shared_ptr<hooked_function_t> function;
+        {
+            const std::lock_guard lock(m_mutex);
+            if (const auto it = m_functions.find(address.as_number()); it != m_functions.end()) {
+                function = it->second;
+            }
+        }
+
+        if (function == nullptr) {
+            // Relocation is done without `m_mutex`, so different functions are hooked in parallel
+            function = hook_function(address);
+            set_function(address, function);
+
+            batch.on_rollback([this, address] {
+                set_function(address, nullptr);
+            });
+        }
+
+        const auto original = function->original(function->layers.size());
+
+        function->layers.push_back({ wrapper, original_ref });
+        batch.on_rollback([function] {
+            function->layers.pop_back();
+        });
+
+        link_layers(function);
+        on_changed(function);
+        m_locks.unlock_on_commit(address);
+
+        batch.commit();
+        return original;
+    }
+
+    // Disabled hook stays installed, but is skipped by the chain
+    void set_enabled(rcmp::address_t address, rcmp::address_t original_ref, bool enabled) {
+        rcmp::hook_batch batch;
+
+        m_locks.lock(address);
+
+        const auto function = find_function(address);
+        auto& layer = *function->find_layer(original_ref);
+
+        if (layer.enabled == enabled) {
+            return;
+        }
+
+        layer.enabled = enabled;
+        batch.on_rollback([function, original_ref, enabled] {
+            function->find_layer(original_ref)->enabled = !enabled;
+        });
+
+        link_layers(function);
+        on_changed(function);
+        m_locks.unlock_on_commit(address);
+
+        batch.commit();
+    }
+
+    // Hooks may be uninstalled in any order
+    void uninstall(rcmp::address_t address, rcmp::address_t original_ref) {
+        rcmp::hook_batch batch;
+
+        m_locks.lock(address);
+
+        const auto function = find_function(address);
+        auto& layers = function->layers;
+
+        const auto layer_it = function->find_layer(original_ref);
+        const auto index    = static_cast<std::size_t>(layer_it - layers.begin());
+
+        batch.on_rollback([function, index, layer = *layer_it] {
+            function->layers.insert(function->layers.begin() + index, layer);
+        });
+        layers.erase(layer_it);
+
+        // Links the next layer (or dispatcher) to the previous one, restores original bytes after the last one
+        link_layers(function);
+        on_changed(function);
+        m_locks.unlock_on_commit(address);
+
+        if (layers.empty()) {
+            // Generated code is freed together with the last reference to `function`, after original bytes are written back
+            // and snapshots referring to it are reclaimed
+            set_function(address, nullptr);
+            batch.on_rollback([this, function] {
+                set_function(function->address, function);
+            });
+
+            // Threads redirected from the breakpoint or preempted in the dispatcher may be still there, and there's
+            // no way to tell when they leave: live patched code is never reused
+            if (rcmp::get_patch_mode() == rcmp::patch_mode::live) {
+                batch.on_commit([function] {
+                    function->relocated_prolog.release();
+                    function->dispatcher.release();
+                });
+            }
+        }
+
+        batch.commit();
+    }
+};
+
+// Returns `original` for the new hook
+rcmp::address_t install_layer(rcmp::address_t address, rcmp::address_t wrapper, rcmp::detail::hook_record& record) {
+    const auto original_ref = record.original_ref;
+    assert(original_ref != nullptr);
+
+    const auto original = hook_registry::instance().install(address, wrapper, original_ref);
+
+    record.unpatch = [address, original_ref] {
+        hook_registry::instance().uninstall(address, original_ref);
+    };
+
+    record.set_enabled = [address, original_ref](bool enabled) {
+        hook_registry::instance().set_enabled(address, original_ref, enabled);
+    };
+
+    return original;
+}
+
+} // unnamed namespace
+
+std::optional<rcmp::hooked_function_info> rcmp::find_hooked_function(rcmp::address_t function) noexcept {
+    const registry_reader reader;
+    if (const auto info = reader.find(function)) {
+        return *info;
+    }
+
+    return std::nullopt;
+}
+
+std::optional<rcmp::hooked_function_info> rcmp::find_hooked_function_by_code(rcmp::address_t pc) noexcept {
+    const registry_reader reader;
+    if (const auto info = reader.find_by_code(pc)) {
+        return *info;
+    }
+
+    return std::nullopt;
+}
+
+std::size_t rcmp::hooked_function_count() noexcept {
+    const registry_reader reader;
+    return reader ? reader->functions.size() : 0;
+}
+
+std::size_t rcmp::hook_count() noexcept {
+    const registry_reader reader;
+    return reader ? reader->hook_count : 0;
+}
+
+std::vector<rcmp::hooked_function_info> rcmp::hooked_functions() {
+    const registry_reader reader;
+    return reader ? reader->functions : std::vector<rcmp::hooked_function_info>{};
+}
+
+rcmp::address_t rcmp::get_original(rcmp::address_t function) noexcept {
+    const registry_reader reader;
+    const auto info = reader.find(function);
+    return info != nullptr ? info->relocated_prolog.begin : nullptr;
+}
+
+rcmp::detail::registry_guard::registry_guard() noexcept : m_epoch(g_registry_epoch.enter()) {}
+
+rcmp::detail::registry_guard::~registry_guard() {
+    g_registry_epoch.leave(m_epoch);
+}
+
+void rcmp::detail::throw_not_hooked(rcmp::address_t function) {
+    throw rcmp::error("function %" PRIXPTR " is not hooked", function.as_number());
+}
+
+// returns relocated original address
+rcmp::address_t rcmp::detail::install_x86_x86_64_raw_hook(rcmp::address_t original_function, rcmp::address_t wrapper_function, hook_record& record) {
+    return install_layer(original_function, wrapper_function, record);
+}
+
+#if RCMP_GET_ARCH() == RCMP_ARCH_X86
+rcmp::address_t rcmp::detail::make_x86_register_state_stub(rcmp::address_t wrapper_function, void* state, rcmp::address_t near, hook_record& record) {
+    auto thunk = allocate_code(5 + g_max_jmp_size, near);
+    auto ptr = thunk.get();
+
+    // mov eax, `state`
+    const auto mov = code_buffer{}.append(std::uint8_t{ 0xB8 }).append(rcmp::bit_cast<std::uintptr_t>(state));
+    write_code(ptr, mov);
+    ptr += mov.size();
+
+    // jmp to wrapper
+    write_code(ptr, encode_jmp(ptr, wrapper_function));
+
+    // Thunk lives as long as the hook does
+    const rcmp::address_t result = thunk.get();
+    record.code.push_back(std::move(thunk));
+
+    return result;
+}
+#endif
+
+rcmp::address_t rcmp::detail::install_x86_x86_64_call_site_hook(rcmp::address_t call_site, rcmp::address_t wrapper_function, hook_record& record) {
+    const auto instruction = decode_instruction(call_site);
+
+    // optional REX prefix (i.e. `rex.w call [rip + X]` emitted by MSVC for imports) is skipped
+    const std::size_t prefix_size = (RCMP_GET_ARCH() == RCMP_ARCH_X86_64 && (instruction.bytes[0] & 0xF0) == 0x40) ? 1 : 0;
+
+    rcmp::address_t original_function;
+
+    if (instruction.kind == instruction_kind::relative_branch && instruction.long_opcode == opcode{ 0xE8 } && instruction.length == g_rel_jmp_size) {
+        // call rel32
+        original_function = instruction.target;
+    }
+    else if (instruction.length == prefix_size + 2 + sizeof(jmp_diff_t) && instruction.bytes[prefix_size] == 0xFF && instruction.bytes[prefix_size + 1] == 0x15) {
+        // call [rip + X] on x86-64, call [X] on x86. The slot may be shared by other callers, so it's left untouched.
+#if RCMP_GET_ARCH() == RCMP_ARCH_X86_64
+        const rcmp::address_t slot = instruction.target;
+#else
+        std::uint32_t slot_address = 0;
+        std::memcpy(&slot_address, instruction.bytes.data() + 2, sizeof(slot_address));
+        const rcmp::address_t slot = std::uintptr_t{ slot_address };
+#endif
+        rcmp::read_memory(slot, &original_function, sizeof(original_function));
+    }
+    else {
+        throw rcmp::error("unable to hook call site, it's not a `call rel32` or `call [X]`: %s", hex_dump(call_site, instruction.length).c_str());
+    }
+
+    // Call site is rewritten to `call rel32` padded with nops, so destination must be within rel32 reach
+    rcmp::address_t destination = wrapper_function;
+    if (!is_rel32_reachable(call_site + g_rel_jmp_size, destination)) {
+        auto relay = rcmp::allocate_code(g_max_jmp_size, call_site);
+        if (!is_rel32_reachable(call_site + g_rel_jmp_size, relay.get())) {
+            throw rcmp::error("unable to hook call site %" PRIXPTR ", no free memory within rel32 reach", call_site.as_number());
+        }
+
+        write_code(relay.get(), encode_jmp(relay.get(), wrapper_function));
+        destination = relay.get();
+        record.code.push_back(std::move(relay));
+    }
+
+    using call_bytes_t = std::array<std::uint8_t, 3 + sizeof(jmp_diff_t)>;
+    const std::size_t length = instruction.length;
+
+    call_bytes_t original_bytes{};
+    std::memcpy(original_bytes.data(), instruction.bytes.data(), length);
+
+    call_bytes_t patched_bytes{};
+    const auto call = encode_rel_jmp_or_call(call_site, destination, 0xE8);
+    std::memcpy(patched_bytes.data(), call.data(), call.size());
+    std::fill(patched_bytes.begin() + call.size(), patched_bytes.begin() + length, std::uint8_t{ 0x90 });
+
+    // Thread stopped at the call site while it's patched live executes the original call relocated here
+    auto relocated = relocate_function(call_site, length);
+    const rcmp::address_t resume = relocated.code.get();
+    record.code.push_back(std::move(relocated.code));
+
+    const auto read_call = [call_site, length] {
+        call_bytes_t bytes{};
+        rcmp::read_memory(call_site, bytes.data(), length);
+        return bytes;
+    };
+
+    rcmp::patch_code(call_site, patched_bytes.data(), length, resume);
+
+    // Disabled hook isn't in the call site anymore, nothing to undo. `record` owns the callback, so it outlives it.
+    record.unpatch = [call_site, length, original_bytes, patched_bytes, resume, read_call, &record] {
+        if (!record.enabled) {
+            return;
+        }
+
+        const auto current = read_call();
+
+        // disabled earlier in the same batch
+        if (current == original_bytes) {
+            return;
+        }
+
+        if (current != patched_bytes) {
+            throw rcmp::error("unable to uninstall hook of call site %" PRIXPTR ", it's overridden by another hook", call_site.as_number());
+        }
+
+        rcmp::patch_code(call_site, original_bytes.data(), length, resume);
+    };
+
+    record.set_enabled = [call_site, length, original_bytes, patched_bytes, resume, read_call](bool enabled) {
+        const auto& [from, to] = enabled ? std::tie(original_bytes, patched_bytes) : std::tie(patched_bytes, original_bytes);
+
+        if (read_call() != from) {
+            throw rcmp::error("unable to %s hook of call site %" PRIXPTR ", it's overridden by another hook", enabled ? "enable" : "disable", call_site.as_number());
+        }
+
+        rcmp::patch_code(call_site, to.data(), length, resume);
+    };
+
+    return original_function;
+}
+
+std::vector<rcmp::address_t> rcmp::find_direct_branches(rcmp::address_t function) {
+    std::vector<rcmp::address_t> result;
+
+    for (const auto& region : rcmp::detail::platform::module_code_regions(function.as_number())) {
+        const auto bytes = reinterpret_cast<const std::uint8_t*>(region.begin);
+        const std::size_t size = region.end - region.begin;
+
+        std::vector<std::size_t> candidates;
+        for (std::size_t i = 0; i + g_rel_jmp_size <= size; i++) {
+            // call rel32 (E8) or jmp rel32 (E9)
+            if ((bytes[i] & 0xFE) != 0xE8) {
+                continue;
+            }
+
+            jmp_diff_t offset = 0;
+            std::memcpy(&offset, bytes + i + 1, sizeof(offset));
+
+            if (region.begin + i + g_rel_jmp_size + offset == function) {
+                candidates.push_back(i);
+            }
+        }
+
+        // Bytes matched inside of another instruction aren't branches: only candidates that linear disassembly
+        // of the region steps on are kept. Undecodable bytes (data, padding) are skipped one by one.
+        auto candidate = candidates.begin();
+        for (std::size_t i = 0; candidate != candidates.end() && i < size; ) {
+            const std::size_t length = decode_instruction_length(bytes + i, size - i);
+
+            while (candidate != candidates.end() && *candidate < i) {
+                ++candidate;
+            }
+
+            if (candidate != candidates.end() && *candidate == i && length == g_rel_jmp_size) {
+                result.push_back(region.begin + i);
+            }
+
+            i += length != 0 ? length : 1;
+        }
+    }
+
+    return result;
+}
+
+rcmp::address_t rcmp::detail::install_x86_x86_64_hook_with_call_sites(const function_call_sites_t& function, rcmp::address_t wrapper_function, hook_record& record) {
+    const rcmp::address_t original_function = function.function;
+
+    using branch_bytes_t = std::array<std::uint8_t, g_rel_jmp_size>;
+
+    const auto read_branch = [](rcmp::address_t where) {
+        branch_bytes_t bytes;
+        rcmp::read_memory(where, bytes.data(), bytes.size());
+        return bytes;
+    };
+
+    const auto is_branch_to_function = [&](rcmp::address_t where) {
+        const auto bytes = read_branch(where);
+
+        jmp_diff_t offset = 0;
+        std::memcpy(&offset, bytes.data() + 1, sizeof(offset));
+
+        return (bytes[0] & 0xFE) == 0xE8 && where + g_rel_jmp_size + offset == original_function;
+    };
+
+    auto branches = function.call_sites;
+    std::sort(branches.begin(), branches.end());
+    branches.erase(std::unique(branches.begin(), branches.end()), branches.end());
+
+    for (const auto where : branches) {
+        if (!is_branch_to_function(where)) {
+            throw rcmp::error("%" PRIXPTR " is not a `call/jmp rel32` to %" PRIXPTR, where.as_number(), original_function.as_number());
+        }
+    }
+
+    const auto original = install_layer(original_function, wrapper_function, record);
+
+    // Branches overwritten by prolog hook (read through batch) are left to it
+    branches.erase(std::remove_if(branches.begin(), branches.end(), [&](rcmp::address_t where) {
+        return !is_branch_to_function(where);
+    }), branches.end());
+
+    if (branches.empty()) {
+        return original;
+    }
+
+    // Lives while the function has hooks, and this one is uninstalled (with its branches) before the last of them
+    const auto dispatcher = hook_registry::instance().dispatcher(original_function);
+
+    struct branch_t {
+        rcmp::address_t where;
+        branch_bytes_t  original_bytes;
+        branch_bytes_t  patched_bytes;
+        rcmp::address_t resume; // repeats original branch for a thread stopped here by live patching
+    };
+
+    // Relay to dispatcher (used by branches that can't reach it) followed by resume stubs of all branches
+    constexpr std::size_t resume_size = g_max_call_size + g_max_jmp_size;
+    auto code = rcmp::allocate_code(g_max_jmp_size + branches.size() * resume_size, branches.front());
+
+    const rcmp::address_t relay = code.get();
+    write_code(relay, encode_jmp(relay, dispatcher));
+
+    std::vector<branch_t> patched;
+    patched.reserve(branches.size());
+
+    rcmp::address_t resume = relay + g_max_jmp_size;
+    for (const auto where : branches) {
+        const auto next = where + g_rel_jmp_size;
+
+        rcmp::address_t destination = dispatcher;
+        if (!is_rel32_reachable(next, destination)) {
+            destination = relay;
+        }
+
+        // Too far even from relay, such callers keep going through the prolog hook
+        if (!is_rel32_reachable(next, destination)) {
+            continue;
+        }
+
+        branch_t branch{ where, read_branch(where), {}, resume };
+
+        const auto patched_code = encode_rel_jmp_or_call(where, destination, branch.original_bytes[0]);
+        std::memcpy(branch.patched_bytes.data(), patched_code.data(), patched_code.size());
+
+        if (branch.original_bytes[0] == 0xE8) {
+            const auto call = encode_call(resume, original_function);
+            write_code(resume, call);
+            write_code(resume + call.size(), encode_jmp(resume + call.size(), next));
+        }
+        else {
+            write_code(resume, encode_jmp(resume, original_function));
+        }
+
+        resume += resume_size;
+        patched.push_back(branch);
+    }
+
+    record.code.push_back(std::move(code));
+
+    // Branches already in the requested state are skipped, so it's fine to undo them twice in a batch
+    const auto retarget = [branches = std::move(patched), read_branch](bool hooked, const char* action) {
+        for (const auto& branch : branches) {
+            const auto current = read_branch(branch.where);
+            if (current != branch.original_bytes && current != branch.patched_bytes) {
+                throw rcmp::error("unable to %s hook of %" PRIXPTR ", it's overridden by another hook", action, branch.where.as_number());
+            }
+        }
+
+        for (const auto& branch : branches) {
+            const auto& bytes = hooked ? branch.patched_bytes : branch.original_bytes;
+            if (read_branch(branch.where) != bytes) {
+                rcmp::patch_code(branch.where, bytes.data(), bytes.size(), branch.resume);
+            }
+        }
+    };
+
+    retarget(true, "install");
+
+    record.unpatch = [retarget, unpatch_prolog = std::move(record.unpatch), &record] {
+        if (record.enabled) {
+            retarget(false, "uninstall");
+        }
+
+        unpatch_prolog();
+    };
+
+    record.set_enabled = [retarget, set_prolog_enabled = std::move(record.set_enabled)](bool enabled) {
+        retarget(enabled, enabled ? "enable" : "disable");
+        set_prolog_enabled(enabled);
+    };
+
+    return original;
+}
+
+#if RCMP_GET_PLATFORM() == RCMP_PLATFORM_LINUX
+namespace {
+
+// Value of gs:0 (x86) or fs:0 (x86-64) - address of the thread control block that static TLS offsets are relative to
+std::uintptr_t thread_pointer() noexcept {
+    std::uintptr_t result;
+#if RCMP_GET_ARCH() == RCMP_ARCH_X86
+    asm("movl %%gs:0, %0" : "=r"(result));
+#else
+    asm("movq %%fs:0, %0" : "=r"(result));
+#endif
+    return result;
+}
+
+code_buffer encode_tls_store(std::int32_t offset, void* state) {
+#if RCMP_GET_ARCH() == RCMP_ARCH_X86
+    // mov dword ptr gs:[offset], `state`
+    return code_buffer{}
+        .append(std::array<std::uint8_t, 3>{{ 0x65, 0xC7, 0x05 }})
+        .append(offset)
+        .append(rcmp::bit_cast<std::uintptr_t>(state));
+#else
+    // push rax; mov rax, `state`; mov qword ptr fs:[offset], rax; pop rax
+    return code_buffer{}
+        .append(std::array<std::uint8_t, 3>{{ 0x50, 0x48, 0xB8 }})
+        .append(rcmp::bit_cast<std::uintptr_t>(state))
+        .append(std::array<std::uint8_t, 5>{{ 0x64, 0x48, 0x89, 0x04, 0x25 }})
+        .append(offset)
+        .append(std::uint8_t{ 0x58 });
+#endif
+}
+
+} // unnamed namespace
+#endif
+
+rcmp::address_t rcmp::detail::make_x86_x86_64_tls_state_stub(rcmp::address_t wrapper_function, void* state, void(*state_saver)(void*), void* tls_slot, rcmp::address_t near, hook_record& record) {
+    const auto finish = [&](rcmp::code_ptr tls_injector, rcmp::address_t ptr) {
+        // Jump from `tls_injector` to our wrapper
+        write_code(ptr, encode_jmp(ptr, wrapper_function));
+
+        // Injector lives as long as the hook does
+        const rcmp::address_t result = tls_injector.get();
+        record.code.push_back(std::move(tls_injector));
+
+        return result;
+    };
+
+#if RCMP_GET_PLATFORM() == RCMP_PLATFORM_LINUX
+    // Store right to the thread-local slot, without calling `state_saver` (and saving registers around the call)
+    if (tls_slot != nullptr) {
+        const std::ptrdiff_t offset = rcmp::address_t(tls_slot) - rcmp::address_t(thread_pointer());
+
+        if (offset == static_cast<std::int32_t>(offset)) {
+            const auto store = encode_tls_store(static_cast<std::int32_t>(offset), state);
+
+            auto tls_injector = allocate_code(store.size() + g_max_jmp_size, near);
+            write_code(tls_injector.get(), store);
+
+            const rcmp::address_t ptr = tls_injector.get() + store.size();
+            return finish(std::move(tls_injector), ptr);
+        }
+    }
+#else
+    static_cast<void>(tls_slot);
+#endif
+
+#if RCMP_GET_ARCH() == RCMP_ARCH_X86
+    auto tls_injector_size = 0;
+    tls_injector_size += 5;               // push `state`
+    tls_injector_size += g_max_call_size; // call `state_saver`
+    tls_injector_size += 3 ;              // add esp, 4
+    tls_injector_size += g_max_jmp_size;  // jmp to wrapper
+
+    auto tls_injector = allocate_code(tls_injector_size, near);
+    auto ptr = tls_injector.get();
+
+    auto write = [&ptr](auto value) {
+        std::memcpy(ptr, &value, sizeof value);
+        ptr += sizeof value;
+    };
+
+    // push `state`
+    write(std::uint8_t{ 0x68 });
+    write(rcmp::bit_cast<std::uintptr_t>(state));
+
+    // call `state_saver`
+    const auto call = encode_call(ptr, rcmp::bit_cast<std::uintptr_t>(state_saver));
+    write_code(ptr, call);
+    ptr += call.size();
+
+    // add esp, 4
+    write(std::array<std::uint8_t, 3>{{ 0x83, 0xC4, 0x04 }});
+#else
+    // `state_saver` is a regular function, so every register that may carry an argument is preserved around the call.
+    // Union of SysV and Win64 conventions: rdi, rsi, rdx, rcx, r8, r9, rax (vector argument count), xmm0-7.
+    constexpr std::size_t xmm_count   = 8;
+    constexpr std::size_t shadow_size = 0x20; // Win64 home space of the callee
+    constexpr std::uint32_t frame_size = shadow_size + xmm_count * 16;
+
+    // Entry rsp is 8 mod 16, 7 pushes make it aligned, `frame_size` keeps it aligned for the call
+    static_assert(frame_size % 16 == 0);
+
+    constexpr std::array<std::uint8_t, 9> push_registers{{ 0x50, 0x51, 0x52, 0x56, 0x57, 0x41, 0x50, 0x41, 0x51 }};
+    constexpr std::array<std::uint8_t, 9> pop_registers{{ 0x41, 0x59, 0x41, 0x58, 0x5F, 0x5E, 0x5A, 0x59, 0x58 }};
+
+    auto tls_injector_size = 0;
+    tls_injector_size += push_registers.size();
+    tls_injector_size += 7;                 // sub rsp, `frame_size`
+    tls_injector_size += 8 * xmm_count;     // movups [rsp + disp32], xmm
+    tls_injector_size += 10 + 10;           // mov rdi, `state`; mov rcx, `state`
+    tls_injector_size += g_max_call_size;   // call `state_saver`
+    tls_injector_size += 8 * xmm_count;     // movups xmm, [rsp + disp32]
+    tls_injector_size += 7;                 // add rsp, `frame_size`
+    tls_injector_size += pop_registers.size();
+    tls_injector_size += g_max_jmp_size;    // jmp to wrapper
+
+    auto tls_injector = allocate_code(tls_injector_size, near);
+    auto ptr = tls_injector.get();
+
+    auto write = [&ptr](auto value) {
+        std::memcpy(ptr, &value, sizeof value);
+        ptr += sizeof value;
+    };
+
+    auto write_movups = [&write](std::uint8_t opcode, std::size_t xmm) {
+        write(std::array<std::uint8_t, 4>{{ 0x0F, opcode, static_cast<std::uint8_t>(0x84 | (xmm << 3)), 0x24 }});
+        write(static_cast<std::uint32_t>(shadow_size + xmm * 16));
+    };
+
+    write(push_registers);
+
+    // sub rsp, `frame_size`
+    write(std::array<std::uint8_t, 3>{{ 0x48, 0x81, 0xEC }});
+    write(frame_size);
+
+    for (std::size_t xmm = 0; xmm < xmm_count; xmm++) {
+        write_movups(0x11, xmm);
+    }
+
+    // mov rdi, `state` (SysV); mov rcx, `state` (Win64)
+    write(std::array<std::uint8_t, 2>{{ 0x48, 0xBF }});
+    write(rcmp::bit_cast<std::uintptr_t>(state));
+    write(std::array<std::uint8_t, 2>{{ 0x48, 0xB9 }});
+    write(rcmp::bit_cast<std::uintptr_t>(state));
+
+    // call `state_saver`
+    const auto call = encode_call(ptr, rcmp::bit_cast<std::uintptr_t>(state_saver));
+    write_code(ptr, call);
+    ptr += call.size();
+
+    for (std::size_t xmm = 0; xmm < xmm_count; xmm++) {
+        write_movups(0x10, xmm);
+    }
+
+    // add rsp, `frame_size`
+    write(std::array<std::uint8_t, 3>{{ 0x48, 0x81, 0xC4 }});
+    write(frame_size);
+
+    write(pop_registers);
+#endif
+
+    return finish(std::move(tls_injector), ptr);
+}
+
+namespace {
+
+constexpr std::uint8_t g_int3 = 0xCC;
+
+struct breakpoint_redirect_t {
+    std::uintptr_t breakpoint;
+    std::uintptr_t resume;
+};
+
+// Redirects of a single live patch, sorted by breakpoint address
+struct redirect_table_t {
+    std::vector<breakpoint_redirect_t> redirects;
+    const redirect_table_t*            next;
+};
+
+// Tables are never freed: a thread that hit the breakpoint may enter the handler long after patching is done
+std::atomic<const redirect_table_t*> g_redirect_tables{ nullptr };
+
+std::uintptr_t on_breakpoint(std::uintptr_t breakpoint) noexcept {
+    for (auto table = g_redirect_tables.load(std::memory_order_acquire); table != nullptr; table = table->next) {
+        const auto it = std::lower_bound(table->redirects.begin(), table->redirects.end(), breakpoint, [](const breakpoint_redirect_t& redirect, std::uintptr_t address) {
+            return redirect.breakpoint < address;
+        });
+
+        if (it != table->redirects.end() && it->breakpoint == breakpoint) {
+            // While breakpoint is there, the rest of instruction may be torn. Once it's gone, patched code is complete.
+            const bool is_patching = *reinterpret_cast<const volatile std::uint8_t*>(breakpoint) == g_int3;
+            return is_patching ? it->resume : breakpoint;
+        }
+    }
+
+    return 0;
+}
+
+// How many times `write_code_live` samples other threads before giving up
+constexpr int g_max_live_patch_attempts = 1000;
+
+// Whether any other thread is in the middle of the code being patched, i.e. past its first byte
+bool is_executed_by_other_threads(const std::vector<rcmp::detail::arch::code_patch_t>& patches) {
+    const auto pcs = rcmp::detail::platform::other_thread_pcs();
+    return std::any_of(pcs.begin(), pcs.end(), [&](std::uintptr_t pc) {
+        return std::any_of(patches.begin(), patches.end(), [&](const rcmp::detail::arch::code_patch_t& patch) {
+            return pc > patch.where.as_number() && pc < patch.where.as_number() + patch.bytes.size();
+        });
+    });
+}
+
+} // unnamed namespace
+
+// Same protocol as linux's text_poke_bp: int3 first, then the tail, then the first byte
+void rcmp::detail::arch::write_code_live(const std::vector<code_patch_t>& patches) {
+    static std::mutex live_patch_mutex;
+    const std::lock_guard lock(live_patch_mutex);
+
+    auto table = std::make_unique<redirect_table_t>();
+    for (const auto& patch : patches) {
+        table->redirects.push_back({ patch.where.as_number(), patch.resume.as_number() });
+    }
+
+    std::sort(table->redirects.begin(), table->redirects.end(), [](const breakpoint_redirect_t& lhs, const breakpoint_redirect_t& rhs) {
+        return lhs.breakpoint < rhs.breakpoint;
+    });
+
+    table->next = g_redirect_tables.load(std::memory_order_relaxed);
+    g_redirect_tables.store(table.release(), std::memory_order_release);
+
+    rcmp::detail::platform::set_breakpoint_handler(&on_breakpoint);
+
+    std::vector<std::uint8_t> first_bytes;
+    for (const auto& patch : patches) {
+        first_bytes.push_back(*patch.where.as_ptr<const std::uint8_t>());
+        *patch.where.as_ptr<volatile std::uint8_t>() = g_int3;
+    }
+    rcmp::detail::platform::sync_cores();
+
+    // Threads entering patched code now stop at int3, but the ones preempted in the middle of it must leave first
+    for (int attempt = 0; is_executed_by_other_threads(patches); attempt++) {
+        if (attempt == g_max_live_patch_attempts) {
+            for (std::size_t i = 0; i < patches.size(); i++) {
+                *patches[i].where.as_ptr<volatile std::uint8_t>() = first_bytes[i];
+            }
+            rcmp::detail::platform::sync_cores();
+
+            throw rcmp::error("Patched code is still executed by other threads after %d attempts", attempt);
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    for (const auto& patch : patches) {
+        std::memcpy((patch.where + 1).as_ptr(), patch.bytes.data() + 1, patch.bytes.size() - 1);
+    }
+    rcmp::detail::platform::sync_cores();
+
+    for (const auto& patch : patches) {
+        *patch.where.as_ptr<volatile std::uint8_t>() = static_cast<std::uint8_t>(patch.bytes[0]);
+    }
+    rcmp::detail::platform::sync_cores();
+}
+
+// Full decoder is needed for rip-relative operands, so length-only build (RCMP_ENABLE_ONLY_LENGTH_DISASM) isn't used
+
+#define NMD_ASSEMBLY_IMPLEMENTATION
+
+#if RCMP_GET_COMPILER() == RCMP_COMPILER_GCC
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wparentheses"
+#elif RCMP_GET_COMPILER() == RCMP_COMPILER_CLANG
+    #pragma clang diagnostic push
+    #pragma clang diagnostic ignored "-Wmissing-braces"
+    #pragma clang diagnostic ignored "-Wparentheses"
+#elif RCMP_GET_COMPILER() == RCMP_COMPILER_MSVC
+    #pragma warning(push)
+    // nothing
+#endif
+
+#include <nmd_assembly.h>
+
+#if RCMP_GET_COMPILER() == RCMP_COMPILER_GCC
+    #pragma GCC diagnostic pop
+#elif RCMP_GET_COMPILER() == RCMP_COMPILER_CLANG
+    #pragma clang diagnostic pop
+#elif RCMP_GET_COMPILER() == RCMP_COMPILER_MSVC
+    #pragma warning(pop)
+#endif
+
+std::size_t decode_instruction_length(const std::uint8_t* bytes, std::size_t size) {
+    constexpr auto mode = RCMP_GET_ARCH() == RCMP_ARCH_X86 ? NMD_X86_MODE_32 : NMD_X86_MODE_64;
+    return nmd_x86_ldisasm(bytes, (std::min)(size, std::size_t{ NMD_X86_MAXIMUM_INSTRUCTION_LENGTH }), mode);
+}
+
+raw_instruction_t decode_raw_instruction(const std::uint8_t* bytes) {
+    constexpr auto mode = RCMP_GET_ARCH() == RCMP_ARCH_X86 ? NMD_X86_MODE_32 : NMD_X86_MODE_64;
+
+    nmd_x86_instruction instruction;
+    if (!nmd_x86_decode_buffer(bytes, NMD_X86_MAXIMUM_INSTRUCTION_LENGTH, &instruction, mode, NMD_X86_DECODER_FLAGS_MINIMAL)) {
+        return {};
+    }
+
+    raw_instruction_t result;
+    result.length = instruction.length;
+
+#if RCMP_GET_ARCH() == RCMP_ARCH_X86_64
+    // ModRM.mod == 00 and ModRM.rm == 101 means [rip + disp32] in 64-bit mode
+    if (instruction.hasModrm && instruction.modrm.fields.mod == 0b00 && instruction.modrm.fields.rm == 0b101) {
+        if (instruction.prefixes & NMD_X86_PREFIXES_ADDRESS_SIZE_OVERRIDE) {
+            throw rcmp::error("unsupported eip-relative opcode: %s", hex_dump(bytes, instruction.length).c_str());
+        }
+
+        constexpr std::uint16_t rex_prefixes = NMD_X86_PREFIXES_REX_B | NMD_X86_PREFIXES_REX_X | NMD_X86_PREFIXES_REX_R | NMD_X86_PREFIXES_REX_W;
+
+        rip_operand_t operand;
+        operand.disp_offset = instruction.length - instruction.immMask - sizeof(std::int32_t);
+        operand.opcode      = instruction.opcode;
+        operand.reg         = static_cast<std::uint8_t>(instruction.modrm.fields.reg | ((instruction.prefixes & NMD_X86_PREFIXES_REX_R) ? 0b1000 : 0));
+        operand.is_64bit    = (instruction.prefixes & NMD_X86_PREFIXES_REX_W) != 0;
+
+        operand.is_rewritable = instruction.encoding == NMD_X86_ENCODING_LEGACY &&
+                                instruction.opcodeMap == NMD_X86_OPCODE_MAP_DEFAULT &&
+                                (instruction.opcode == 0x8B || instruction.opcode == 0x8D) &&
+                                (instruction.prefixes & ~rex_prefixes) == 0 &&
+                                operand.reg != 0b100; // rsp must point to stack all the time
+
+        result.rip_operand = operand;
+    }
+#endif
+
+    return result;
 }
@@ -1,23 +1,506 @@
 #include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/membarrier.h>
+#include <unistd.h>
+#include <signal.h>
+#include <ucontext.h>
+#include <dirent.h>
 #include <errno.h>
 #include <limits.h>
+#include <link.h>
+
+#include "../platform.hpp"
 
 #include <rcmp/memory.hpp>
 #include <rcmp/detail/exception.hpp>
+#include <rcmp/detail/scope_exit.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace {
+
+std::vector<rcmp::detail::platform::memory_region_t> read_mappings() {
+    std::vector<rcmp::detail::platform::memory_region_t> result;
+
+    std::FILE* maps = std::fopen("/proc/self/maps", "r");
+    if (maps == nullptr) {
+        return result;
+    }
+
+    char line[512];
+    while (std::fgets(line, sizeof(line), maps)) {
+        unsigned long long begin = 0, end = 0;
+        char permissions[5] = {};
+        if (std::sscanf(line, "%llx-%llx %4s", &begin, &end, permissions) == 3) {
+            rcmp::detail::platform::protection_t protection = PROT_NONE;
+            protection |= permissions[0] == 'r' ? PROT_READ : 0;
+            protection |= permissions[1] == 'w' ? PROT_WRITE : 0;
+            protection |= permissions[2] == 'x' ? PROT_EXEC : 0;
+
+            result.push_back({ static_cast<std::uintptr_t>(begin), static_cast<std::uintptr_t>(end), protection });
+        }
+    }
+
+    std::fclose(maps);
+
+    // /proc/self/maps is already sorted, but it costs nothing to be sure
+    std::sort(result.begin(), result.end(), [](const auto& lhs, const auto& rhs) {
+        return lhs.begin < rhs.begin;
+    });
+
+    return result;
+}
+
+rcmp::address_t map_executable(std::uintptr_t hint, std::size_t size) {
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#if defined(MAP_FIXED_NOREPLACE)
+    if (hint != 0) {
+        flags |= MAP_FIXED_NOREPLACE;
+    }
+#endif
+
+    void* result = ::mmap(reinterpret_cast<void*>(hint), size, PROT_EXEC | PROT_WRITE | PROT_READ, flags, -1, 0);
+    if (result == MAP_FAILED) {
+        return nullptr;
+    }
+
+    // Older kernels treat MAP_FIXED_NOREPLACE as a hint only
+    if (hint != 0 && reinterpret_cast<std::uintptr_t>(result) != hint) {
+        ::munmap(result, size);
+        return nullptr;
+    }
+
+    return result;
+}
+
+#if RCMP_GET_ARCH() == RCMP_ARCH_X86 || RCMP_GET_ARCH() == RCMP_ARCH_X86_64
+greg_t& context_pc(void* context) {
+    auto& registers = static_cast<ucontext_t*>(context)->uc_mcontext.gregs;
+#if RCMP_GET_ARCH() == RCMP_ARCH_X86_64
+    return registers[REG_RIP];
+#else
+    return registers[REG_EIP];
+#endif
+}
+#endif
+
+std::atomic<rcmp::detail::platform::breakpoint_handler_t> g_breakpoint_handler{ nullptr };
+struct sigaction g_previous_sigtrap_action;
+
+void on_sigtrap(int signal, siginfo_t* info, void* context) {
+#if RCMP_GET_ARCH() == RCMP_ARCH_X86 || RCMP_GET_ARCH() == RCMP_ARCH_X86_64
+    // ignore SIGTRAP sent by kill/raise
+    if (info->si_code > 0) {
+        auto& pc = context_pc(context);
+
+        // pc points to the instruction after int3
+        const auto handler = g_breakpoint_handler.load(std::memory_order_acquire);
+        if (const auto resume = handler(static_cast<std::uintptr_t>(pc) - 1); resume != 0) {
+            pc = static_cast<greg_t>(resume);
+            return;
+        }
+    }
+#endif
+
+    if (g_previous_sigtrap_action.sa_flags & SA_SIGINFO) {
+        g_previous_sigtrap_action.sa_sigaction(signal, info, context);
+    }
+    else if (g_previous_sigtrap_action.sa_handler == SIG_DFL) {
+        ::signal(signal, SIG_DFL);
+        ::raise(signal);
+    }
+    else if (g_previous_sigtrap_action.sa_handler != SIG_IGN) {
+        g_previous_sigtrap_action.sa_handler(signal);
+    }
+}
+
+// Executable PT_LOAD segments of the module
+void append_code_segments(const dl_phdr_info* info, std::vector<rcmp::detail::platform::memory_region_t>& regions) {
+    for (std::size_t i = 0; i < info->dlpi_phnum; i++) {
+        const auto& header = info->dlpi_phdr[i];
+
+        if (header.p_type == PT_LOAD && (header.p_flags & PF_X)) {
+            const std::uintptr_t begin = info->dlpi_addr + header.p_vaddr;
+            regions.push_back({ begin, begin + header.p_memsz, PROT_READ | PROT_EXEC });
+        }
+    }
+}
+
+} // unnamed namespace
+
+std::size_t rcmp::detail::platform::page_size() {
+    static const std::size_t value = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+    return value;
+}
+
+std::size_t rcmp::detail::platform::allocation_granularity() {
+    return page_size();
+}
+
+rcmp::address_t rcmp::detail::platform::allocate_executable(rcmp::address_t near, std::size_t size, std::ptrdiff_t max_distance) {
+    if (near == nullptr) {
+        return map_executable(0, size);
+    }
+
+    const std::uintptr_t granularity = allocation_granularity();
+    const std::uintptr_t origin      = near.as_number();
+
+    const std::uintptr_t lowest  = origin > static_cast<std::uintptr_t>(max_distance) ? origin - max_distance : granularity;
+    const std::uintptr_t highest = origin + max_distance - size;
+
+    const auto align_up   = [granularity](std::uintptr_t value) { return (value + granularity - 1) & ~(granularity - 1); };
+    const auto align_down = [granularity](std::uintptr_t value) { return value & ~(granularity - 1); };
+    const auto distance   = [origin](std::uintptr_t value) { return value > origin ? value - origin : origin - value; };
+
+    // Collect the closest suitable address of every free gap between mappings
+    std::vector<std::uintptr_t> candidates;
+
+    std::uintptr_t gap_begin = granularity;
+    for (const auto& mapping : read_mappings()) {
+        const std::uintptr_t gap_end = mapping.begin;
+
+        if (gap_end > gap_begin && gap_end - gap_begin >= size) {
+            const std::uintptr_t first = (std::max)(align_up(gap_begin), align_up(lowest));
+            const std::uintptr_t last  = (std::min)(align_down(gap_end - size), align_down(highest));
+
+            if (first <= last) {
+                candidates.push_back(std::clamp(align_down(origin), first, last));
+            }
+        }
+
+        gap_begin = (std::max)(gap_begin, mapping.end);
+    }
+
+    std::sort(candidates.begin(), candidates.end(), [&distance](std::uintptr_t lhs, std::uintptr_t rhs) {
+        return distance(lhs) < distance(rhs);
+    });
+
+    for (const auto candidate : candidates) {
+        if (auto result = map_executable(candidate, size); result != nullptr) {
+            return result;
+        }
+    }
+
+    return nullptr;
+}
+
+std::vector<rcmp::detail::platform::memory_region_t> rcmp::detail::platform::query_regions(std::uintptr_t begin, std::uintptr_t end) {
+    auto result = read_mappings();
+
+    result.erase(std::remove_if(result.begin(), result.end(), [begin, end](const memory_region_t& region) {
+        return region.end <= begin || end <= region.begin;
+    }), result.end());
+
+    return result;
+}
+
+std::vector<rcmp::detail::platform::memory_region_t> rcmp::detail::platform::module_code_regions(std::uintptr_t address) {
+    struct context_t {
+        std::uintptr_t               address;
+        std::vector<memory_region_t> regions;
+    } context{ address, {} };
+
+    ::dl_iterate_phdr([](dl_phdr_info* info, std::size_t, void* data) {
+        auto& context = *static_cast<context_t*>(data);
+
+        bool contains = false;
+        for (std::size_t i = 0; i < info->dlpi_phnum; i++) {
+            const auto& header = info->dlpi_phdr[i];
+            if (header.p_type != PT_LOAD) {
+                continue;
+            }
+
+            const std::uintptr_t begin = info->dlpi_addr + header.p_vaddr;
+            const std::uintptr_t end   = begin + header.p_memsz;
+
+            contains = contains || (begin <= context.address && context.address < end);
+        }
+
+        if (!contains) {
+            return 0;
+        }
+
+        append_code_segments(info, context.regions);
+        return 1;
+    }, &context);
+
+    std::sort(context.regions.begin(), context.regions.end(), [](const auto& lhs, const auto& rhs) {
+        return lhs.begin < rhs.begin;
+    });
+
+    return context.regions;
+}
+
+std::vector<rcmp::detail::platform::memory_region_t> rcmp::detail::platform::module_code_regions(const char* module) {
+    struct context_t {
+        const char*                  module;
+        std::vector<memory_region_t> regions;
+    } context{ module, {} };
+
+    ::dl_iterate_phdr([](dl_phdr_info* info, std::size_t, void* data) {
+        auto& context = *static_cast<context_t*>(data);
+
+        if (matches_module(info->dlpi_name, context.module)) {
+            append_code_segments(info, context.regions);
+        }
+
+        return 0;
+    }, &context);
+
+    std::sort(context.regions.begin(), context.regions.end(), [](const auto& lhs, const auto& rhs) {
+        return lhs.begin < rhs.begin;
+    });
 
-void rcmp::unprotect_memory(rcmp::address_t where, std::size_t count) {
-    if (count == 0) {
+    return context.regions;
+}
+
+bool rcmp::detail::platform::matches_module(const char* path, const char* module) {
+    if (module == nullptr) {
+        return true;
+    }
+
+    const std::string_view path_view   = path != nullptr ? path : "";
+    const std::string_view module_view = module;
+
+    // main executable has no name
+    if (module_view.empty()) {
+        return path_view.empty();
+    }
+
+    if (path_view.size() < module_view.size() || path_view.substr(path_view.size() - module_view.size()) != module_view) {
+        return false;
+    }
+
+    // whole file name or directory only
+    return path_view.size() == module_view.size() || module_view.front() == '/' || path_view[path_view.size() - module_view.size() - 1] == '/';
+}
+
+bool rcmp::detail::platform::is_writable(protection_t protection) {
+    return (protection & PROT_WRITE) != 0;
+}
+
+bool rcmp::detail::platform::is_executable(protection_t protection) {
+    return (protection & PROT_EXEC) != 0;
+}
+
+rcmp::detail::platform::protection_t rcmp::detail::platform::make_writable(protection_t protection) {
+    return protection | PROT_READ | PROT_WRITE;
+}
+
+void rcmp::detail::platform::set_protection(std::uintptr_t begin, std::size_t size, protection_t protection) {
+    if (::mprotect(reinterpret_cast<void*>(begin), size, static_cast<int>(protection))) {
+        throw rcmp::error("mprotect(%" PRIXPTR ", %zu) fails with error: %s", begin, size, ::strerror(errno));
+    }
+}
+
+void rcmp::detail::platform::flush_instruction_cache(std::uintptr_t begin, std::size_t size) {
+    // no-op on x86, but required for other architectures
+    __builtin___clear_cache(reinterpret_cast<char*>(begin), reinterpret_cast<char*>(begin + size));
+}
+
+namespace {
+
+// membarrier command serializing all cores of the process, 0 if the kernel has none
+int sync_cores_command() {
+    static const int command = [] {
+        if (::syscall(__NR_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED_SYNC_CORE, 0, 0) == 0) {
+            return static_cast<int>(MEMBARRIER_CMD_PRIVATE_EXPEDITED_SYNC_CORE);
+        }
+
+        // On x86 return from IPI is serializing anyway
+        if (::syscall(__NR_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0, 0) == 0) {
+            return static_cast<int>(MEMBARRIER_CMD_PRIVATE_EXPEDITED);
+        }
+
+        return 0;
+    }();
+
+    return command;
+}
+
+// Signal sent by `other_thread_pcs` to make threads report their instruction pointers
+int sample_signal() {
+    return SIGRTMAX - 1;
+}
+
+struct pc_sample_t {
+    pid_t             tid;
+    std::uintptr_t    pc;
+    std::atomic<bool> sampled;
+};
+
+// Samples of the ongoing `other_thread_pcs` call
+std::atomic<std::vector<pc_sample_t>*> g_pc_samples{ nullptr };
+std::atomic<int>                       g_pc_sample_handlers{ 0 };
+
+pid_t current_tid() {
+    return static_cast<pid_t>(::syscall(SYS_gettid));
+}
+
+int send_signal(pid_t tid, int signal) {
+    return static_cast<int>(::syscall(SYS_tgkill, ::getpid(), tid, signal));
+}
+
+void on_sample_signal(int, siginfo_t* info, void* context) {
+    // ignore signals sent by other processes
+    if (info->si_code != SI_TKILL || info->si_pid != ::getpid()) {
         return;
     }
 
-    constexpr const std::uintptr_t page_size = 0x1000;
-    constexpr const std::uintptr_t page_mask = page_size - 1;
+    const int saved_errno = errno;
+    g_pc_sample_handlers.fetch_add(1);
+
+    // null if the signal is late, i.e. sampling is over
+    if (auto* samples = g_pc_samples.load()) {
+        const pid_t tid = current_tid();
+        for (auto& sample : *samples) {
+            if (sample.tid == tid) {
+#if RCMP_GET_ARCH() == RCMP_ARCH_X86 || RCMP_GET_ARCH() == RCMP_ARCH_X86_64
+                sample.pc = static_cast<std::uintptr_t>(context_pc(context));
+#endif
+                sample.sampled.store(true, std::memory_order_release);
+                break;
+            }
+        }
+    }
+
+    g_pc_sample_handlers.fetch_sub(1);
+    errno = saved_errno;
+}
+
+std::vector<pid_t> other_thread_ids() {
+    DIR* tasks = ::opendir("/proc/self/task");
+    if (tasks == nullptr) {
+        throw rcmp::error("opendir(/proc/self/task) fails with error: %s", ::strerror(errno));
+    }
+
+    std::vector<pid_t> result;
+
+    const pid_t self = current_tid();
+    while (const dirent* entry = ::readdir(tasks)) {
+        if (entry->d_name[0] != '.') {
+            if (const auto tid = static_cast<pid_t>(std::atol(entry->d_name)); tid != self) {
+                result.push_back(tid);
+            }
+        }
+    }
+
+    ::closedir(tasks);
+    return result;
+}
+
+} // unnamed namespace
+
+bool rcmp::detail::platform::can_sync_cores() {
+    return sync_cores_command() != 0;
+}
+
+void rcmp::detail::platform::sync_cores() {
+    if (const int command = sync_cores_command(); command != 0) {
+        ::syscall(__NR_membarrier, command, 0, 0);
+    }
+}
+
+void rcmp::detail::platform::set_breakpoint_handler(breakpoint_handler_t handler) {
+    g_breakpoint_handler.store(handler, std::memory_order_release);
+
+    // Handler is never uninstalled: thread may hit the breakpoint right before it's removed
+    static std::once_flag installed;
+    std::call_once(installed, [] {
+        struct sigaction action = {};
+        action.sa_sigaction = &on_sigtrap;
+        action.sa_flags     = SA_SIGINFO | SA_RESTART;
+        sigemptyset(&action.sa_mask);
+
+        if (::sigaction(SIGTRAP, &action, &g_previous_sigtrap_action)) {
+            throw rcmp::error("sigaction(SIGTRAP) fails with error: %s", ::strerror(errno));
+        }
+    });
+}
+
+std::vector<std::uintptr_t> rcmp::detail::platform::other_thread_pcs() {
+    static std::mutex mutex;
+    const std::lock_guard lock(mutex);
 
-    rcmp::address_t page_begin = where.as_number() & ~page_mask;
-    rcmp::address_t page_end = (where + count - 1).as_number() & ~page_mask;
-    for (; page_begin <= page_end; page_begin += page_size) {
-        if (::mprotect(page_begin.as_ptr(), page_size, PROT_EXEC | PROT_WRITE | PROT_READ)) {
-            throw rcmp::error("mprotect(%" PRIXPTR ", %lu) fails with error: %s", page_begin, page_size, ::strerror(errno));
+    static std::once_flag installed;
+    std::call_once(installed, [] {
+        struct sigaction action = {};
+        action.sa_sigaction = &on_sample_signal;
+        action.sa_flags     = SA_SIGINFO | SA_RESTART;
+        sigfillset(&action.sa_mask);
+
+        if (::sigaction(sample_signal(), &action, nullptr)) {
+            throw rcmp::error("sigaction(%d) fails with error: %s", sample_signal(), ::strerror(errno));
         }
+    });
+
+    const auto tids = other_thread_ids();
+
+    std::vector<pc_sample_t> samples(tids.size());
+    std::vector<bool> exited(tids.size(), false);
+    for (std::size_t i = 0; i < tids.size(); i++) {
+        samples[i].tid = tids[i];
     }
+
+    g_pc_samples.store(&samples);
+    const rcmp::detail::scope_exit unpublish = [] {
+        // handlers which have seen `samples` must finish before it's destroyed
+        g_pc_samples.store(nullptr);
+        while (g_pc_sample_handlers.load() != 0) {
+            std::this_thread::yield();
+        }
+    };
+
+    for (std::size_t i = 0; i < tids.size(); i++) {
+        if (send_signal(tids[i], sample_signal()) != 0) {
+            if (errno != ESRCH) {
+                throw rcmp::error("tgkill(%d) fails with error: %s", static_cast<int>(tids[i]), ::strerror(errno));
+            }
+
+            exited[i] = true;
+        }
+    }
+
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+    for (;;) {
+        std::size_t pending = tids.size();
+        for (std::size_t i = 0; i < tids.size(); i++) {
+            if (exited[i] || samples[i].sampled.load(std::memory_order_acquire)) {
+                pending--;
+            }
+            else if (send_signal(tids[i], 0) != 0 && errno == ESRCH) {
+                exited[i] = true;
+                pending--;
+            }
+        }
+
+        if (pending == 0) {
+            break;
+        }
+
+        if (std::chrono::steady_clock::now() > deadline) {
+            throw rcmp::error("%zu threads don't handle signal %d", pending, sample_signal());
+        }
+
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+
+    std::vector<std::uintptr_t> result;
+    for (std::size_t i = 0; i < tids.size(); i++) {
+        if (!exited[i]) {
+            result.push_back(samples[i].pc);
+        }
+    }
+
+    return result;
 }
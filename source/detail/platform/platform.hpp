@@ -0,0 +1,78 @@
+#pragma once
+
+#include <rcmp/detail/address.hpp>
+#include <rcmp/detail/config.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace rcmp::detail::platform {
+
+// Size of a single memory page
+std::size_t page_size();
+
+// Granularity of addresses returned by `allocate_executable`
+std::size_t allocation_granularity();
+
+// Allocates `size` bytes of readable, writable and executable memory.
+// If `near` is not null, tries to place it no further than `max_distance` bytes from `near`.
+// Returns null address on failure.
+rcmp::address_t allocate_executable(rcmp::address_t near, std::size_t size, std::ptrdiff_t max_distance);
+
+// Native page protection flags (PROT_* on linux, PAGE_* on windows)
+using protection_t = std::uint32_t;
+
+struct memory_region_t {
+    std::uintptr_t begin;
+    std::uintptr_t end;
+    protection_t   protection;
+};
+
+// Returns mapped regions intersecting `[begin, end)`, sorted by address. Unmapped gaps are skipped.
+std::vector<memory_region_t> query_regions(std::uintptr_t begin, std::uintptr_t end);
+
+// Executable segments of the module (executable or shared library) containing `address`, sorted by address.
+// Empty if `address` doesn't belong to any module.
+std::vector<memory_region_t> module_code_regions(std::uintptr_t address);
+
+// Executable segments of modules named `module`, sorted by address: null means every loaded module,
+// empty string means the main executable, otherwise it's a file name (or path) of the module.
+std::vector<memory_region_t> module_code_regions(const char* module);
+
+#if RCMP_GET_PLATFORM() == RCMP_PLATFORM_LINUX
+// Whether module loaded from `path` is `module` (see `module_code_regions`)
+bool matches_module(const char* path, const char* module);
+#endif
+
+bool is_writable(protection_t protection);
+
+bool is_executable(protection_t protection);
+
+// Returns `protection` with write access added, other access rights are kept as is
+protection_t make_writable(protection_t protection);
+
+// Changes protection of pages `[begin, begin + size)`, throws `rcmp::error` on failure
+void set_protection(std::uintptr_t begin, std::size_t size, protection_t protection);
+
+// Makes sure modified code `[begin, begin + size)` is visible to instruction fetch
+void flush_instruction_cache(std::uintptr_t begin, std::size_t size);
+
+// Whether `sync_cores` works, i.e. it's supported by the kernel
+bool can_sync_cores();
+
+// Makes every thread of the process execute core serializing instruction, so modified code is refetched.
+// Does nothing if `can_sync_cores` is false.
+void sync_cores();
+
+// Instruction pointers of every other thread of the process, each sampled at some moment during the call.
+// Throws `rcmp::error` if some thread can't be sampled.
+std::vector<std::uintptr_t> other_thread_pcs();
+
+// Returns address to continue execution from, or zero if breakpoint is not handled
+using breakpoint_handler_t = std::uintptr_t(*)(std::uintptr_t breakpoint) noexcept;
+
+// Installs process-wide breakpoint (int3) handler, unhandled breakpoints are passed to previous handler
+void set_breakpoint_handler(breakpoint_handler_t handler);
+
+} // namespace rcmp::detail::platform
@@ -1,17 +1,331 @@
+#include "../platform.hpp"
+
 #include <rcmp/memory.hpp>
 #include <rcmp/detail/exception.hpp>
 
 #include <Windows.h>
+#include <TlHelp32.h>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+
+namespace {
+
+const SYSTEM_INFO& system_info() {
+    static const SYSTEM_INFO info = []{
+        SYSTEM_INFO result;
+        ::GetSystemInfo(&result);
+        return result;
+    }();
+
+    return info;
+}
+
+rcmp::address_t allocate_at(std::uintptr_t address, std::size_t size) {
+    return ::VirtualAlloc(reinterpret_cast<void*>(address), size, MEM_RESERVE | MEM_COMMIT, PAGE_EXECUTE_READWRITE);
+}
+
+// Reference: https://github.com/TsudaKageyu/minhook/blob/master/src/buffer.c
+rcmp::address_t allocate_below(std::uintptr_t origin, std::uintptr_t lowest, std::size_t size) {
+    const std::uintptr_t granularity = rcmp::detail::platform::allocation_granularity();
+
+    std::uintptr_t address = (origin & ~(granularity - 1)) - granularity;
+    while (address >= lowest) {
+        MEMORY_BASIC_INFORMATION mbi;
+        if (::VirtualQuery(reinterpret_cast<void*>(address), &mbi, sizeof(mbi)) == 0) {
+            break;
+        }
+
+        if (mbi.State == MEM_FREE && mbi.RegionSize >= size) {
+            if (auto result = allocate_at(address, size); result != nullptr) {
+                return result;
+            }
+        }
+
+        const auto allocation_base = reinterpret_cast<std::uintptr_t>(mbi.AllocationBase);
+        if (allocation_base < granularity) {
+            break;
+        }
+
+        address = (mbi.State == MEM_FREE ? address : allocation_base) - granularity;
+    }
+
+    return nullptr;
+}
+
+rcmp::address_t allocate_above(std::uintptr_t origin, std::uintptr_t highest, std::size_t size) {
+    const std::uintptr_t granularity = rcmp::detail::platform::allocation_granularity();
+
+    std::uintptr_t address = (origin & ~(granularity - 1)) + granularity;
+    while (address <= highest) {
+        MEMORY_BASIC_INFORMATION mbi;
+        if (::VirtualQuery(reinterpret_cast<void*>(address), &mbi, sizeof(mbi)) == 0) {
+            break;
+        }
+
+        if (mbi.State == MEM_FREE && mbi.RegionSize >= size) {
+            if (auto result = allocate_at(address, size); result != nullptr) {
+                return result;
+            }
+        }
+
+        const auto region_end = reinterpret_cast<std::uintptr_t>(mbi.BaseAddress) + mbi.RegionSize;
+        address = (region_end + granularity - 1) & ~(granularity - 1);
+    }
+
+    return nullptr;
+}
+
+std::atomic<rcmp::detail::platform::breakpoint_handler_t> g_breakpoint_handler{ nullptr };
+
+LONG CALLBACK on_exception(EXCEPTION_POINTERS* info) {
+    if (info->ExceptionRecord->ExceptionCode != EXCEPTION_BREAKPOINT) {
+        return EXCEPTION_CONTINUE_SEARCH;
+    }
 
-void rcmp::unprotect_memory(rcmp::address_t where, std::size_t count) {
-    if (count == 0) {
-        return;
+    // exception address points to int3 itself
+    const auto handler = g_breakpoint_handler.load(std::memory_order_acquire);
+    const auto resume  = handler(reinterpret_cast<std::uintptr_t>(info->ExceptionRecord->ExceptionAddress));
+    if (resume == 0) {
+        return EXCEPTION_CONTINUE_SEARCH;
     }
 
-    DWORD protect;
-    const auto result = VirtualProtect(where.as_ptr(), count, PAGE_EXECUTE_READWRITE, &protect);
+#if RCMP_GET_ARCH() == RCMP_ARCH_X86_64
+    info->ContextRecord->Rip = resume;
+#elif RCMP_GET_ARCH() == RCMP_ARCH_X86
+    info->ContextRecord->Eip = resume;
+#endif
+
+    return EXCEPTION_CONTINUE_EXECUTION;
+}
+
+// Sections of the module mapped as executable
+void append_code_sections(HMODULE module, std::vector<rcmp::detail::platform::memory_region_t>& regions) {
+    const auto base       = reinterpret_cast<std::uintptr_t>(module);
+    const auto dos_header = reinterpret_cast<const IMAGE_DOS_HEADER*>(base);
+    const auto nt_headers = reinterpret_cast<const IMAGE_NT_HEADERS*>(base + dos_header->e_lfanew);
+
+    const IMAGE_SECTION_HEADER* section = IMAGE_FIRST_SECTION(nt_headers);
+    for (WORD i = 0; i < nt_headers->FileHeader.NumberOfSections; i++, section++) {
+        if (section->Characteristics & IMAGE_SCN_MEM_EXECUTE) {
+            const std::uintptr_t begin = base + section->VirtualAddress;
+            regions.push_back({ begin, begin + section->Misc.VirtualSize, PAGE_EXECUTE_READ });
+        }
+    }
+}
+
+} // unnamed namespace
+
+std::size_t rcmp::detail::platform::page_size() {
+    return system_info().dwPageSize;
+}
+
+std::size_t rcmp::detail::platform::allocation_granularity() {
+    return system_info().dwAllocationGranularity;
+}
+
+rcmp::address_t rcmp::detail::platform::allocate_executable(rcmp::address_t near, std::size_t size, std::ptrdiff_t max_distance) {
+    if (near == nullptr) {
+        return allocate_at(0, size);
+    }
+
+    const auto min_address = reinterpret_cast<std::uintptr_t>(system_info().lpMinimumApplicationAddress);
+    const auto max_address = reinterpret_cast<std::uintptr_t>(system_info().lpMaximumApplicationAddress);
+
+    const std::uintptr_t origin  = near.as_number();
+    const std::uintptr_t lowest  = origin > min_address + max_distance ? origin - max_distance : min_address;
+    const std::uintptr_t highest = origin < max_address - max_distance ? origin + max_distance - size : max_address - size;
+
+    if (auto result = allocate_below(origin, lowest, size); result != nullptr) {
+        return result;
+    }
+
+    return allocate_above(origin, highest, size);
+}
+
+std::vector<rcmp::detail::platform::memory_region_t> rcmp::detail::platform::query_regions(std::uintptr_t begin, std::uintptr_t end) {
+    std::vector<memory_region_t> result;
+
+    for (std::uintptr_t address = begin; address < end; ) {
+        MEMORY_BASIC_INFORMATION mbi;
+        if (::VirtualQuery(reinterpret_cast<void*>(address), &mbi, sizeof(mbi)) == 0) {
+            break;
+        }
+
+        const auto region_begin = reinterpret_cast<std::uintptr_t>(mbi.BaseAddress);
+        const auto region_end   = region_begin + mbi.RegionSize;
+
+        if (mbi.State == MEM_COMMIT) {
+            result.push_back({ region_begin, region_end, mbi.Protect });
+        }
+
+        address = region_end;
+    }
+
+    return result;
+}
+
+std::vector<rcmp::detail::platform::memory_region_t> rcmp::detail::platform::module_code_regions(std::uintptr_t address) {
+    std::vector<memory_region_t> result;
+
+    HMODULE module = nullptr;
+    const DWORD flags = GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT;
+    if (::GetModuleHandleExW(flags, reinterpret_cast<LPCWSTR>(address), &module) == FALSE) {
+        return result;
+    }
+
+    append_code_sections(module, result);
+
+    return result;
+}
+
+std::vector<rcmp::detail::platform::memory_region_t> rcmp::detail::platform::module_code_regions(const char* module) {
+    std::vector<memory_region_t> result;
+
+    if (module != nullptr) {
+        // Loader matches file name (or path) itself, null name means the main executable
+        if (const HMODULE handle = ::GetModuleHandleA(*module != '\0' ? module : nullptr); handle != nullptr) {
+            append_code_sections(handle, result);
+        }
+    }
+    else {
+        const HANDLE snapshot = ::CreateToolhelp32Snapshot(TH32CS_SNAPMODULE | TH32CS_SNAPMODULE32, 0);
+        if (snapshot == INVALID_HANDLE_VALUE) {
+            return result;
+        }
+
+        MODULEENTRY32W entry;
+        entry.dwSize = sizeof(entry);
+
+        for (BOOL found = ::Module32FirstW(snapshot, &entry); found != FALSE; found = ::Module32NextW(snapshot, &entry)) {
+            append_code_sections(entry.hModule, result);
+        }
+
+        ::CloseHandle(snapshot);
+    }
+
+    std::sort(result.begin(), result.end(), [](const auto& lhs, const auto& rhs) {
+        return lhs.begin < rhs.begin;
+    });
+
+    return result;
+}
+
+bool rcmp::detail::platform::is_writable(protection_t protection) {
+    switch (protection & 0xFF) {
+        case PAGE_READWRITE:
+        case PAGE_WRITECOPY:
+        case PAGE_EXECUTE_READWRITE:
+        case PAGE_EXECUTE_WRITECOPY:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool rcmp::detail::platform::is_executable(protection_t protection) {
+    return (protection & (PAGE_EXECUTE | PAGE_EXECUTE_READ | PAGE_EXECUTE_READWRITE | PAGE_EXECUTE_WRITECOPY)) != 0;
+}
+
+rcmp::detail::platform::protection_t rcmp::detail::platform::make_writable(protection_t protection) {
+    // Keep modifiers (PAGE_GUARD, PAGE_NOCACHE, ...) untouched
+    const protection_t modifiers = protection & ~protection_t{ 0xFF };
+
+    switch (protection & 0xFF) {
+        case PAGE_EXECUTE:
+        case PAGE_EXECUTE_READ:
+            return modifiers | PAGE_EXECUTE_READWRITE;
+        case PAGE_NOACCESS:
+        case PAGE_READONLY:
+            return modifiers | PAGE_READWRITE;
+        default:
+            return protection;
+    }
+}
+
+void rcmp::detail::platform::set_protection(std::uintptr_t begin, std::size_t size, protection_t protection) {
+    DWORD old_protection;
+    const auto result = ::VirtualProtect(reinterpret_cast<void*>(begin), size, protection, &old_protection);
 
     if (result == FALSE) {
         throw rcmp::error("VirtualProtect fails with error %lu", ::GetLastError());
     }
 }
+
+void rcmp::detail::platform::flush_instruction_cache(std::uintptr_t begin, std::size_t size) {
+    ::FlushInstructionCache(::GetCurrentProcess(), reinterpret_cast<const void*>(begin), size);
+}
+
+bool rcmp::detail::platform::can_sync_cores() {
+    return true;
+}
+
+void rcmp::detail::platform::sync_cores() {
+    ::FlushProcessWriteBuffers();
+}
+
+void rcmp::detail::platform::set_breakpoint_handler(breakpoint_handler_t handler) {
+    g_breakpoint_handler.store(handler, std::memory_order_release);
+
+    // Handler is never uninstalled: thread may hit the breakpoint right before it's removed
+    static std::once_flag installed;
+    std::call_once(installed, [] {
+        if (::AddVectoredExceptionHandler(1, &on_exception) == nullptr) {
+            throw rcmp::error("AddVectoredExceptionHandler fails with error %lu", ::GetLastError());
+        }
+    });
+}
+
+std::vector<std::uintptr_t> rcmp::detail::platform::other_thread_pcs() {
+    const HANDLE snapshot = ::CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+    if (snapshot == INVALID_HANDLE_VALUE) {
+        throw rcmp::error("CreateToolhelp32Snapshot fails with error %lu", ::GetLastError());
+    }
+
+    std::vector<DWORD> thread_ids;
+
+    THREADENTRY32 entry;
+    entry.dwSize = sizeof(entry);
+
+    const DWORD process = ::GetCurrentProcessId();
+    const DWORD self    = ::GetCurrentThreadId();
+    for (BOOL found = ::Thread32First(snapshot, &entry); found != FALSE; found = ::Thread32Next(snapshot, &entry)) {
+        if (entry.th32OwnerProcessID == process && entry.th32ThreadID != self) {
+            thread_ids.push_back(entry.th32ThreadID);
+        }
+    }
+
+    ::CloseHandle(snapshot);
+
+    // no allocations while a thread is suspended, it may hold the heap lock
+    std::vector<std::uintptr_t> result;
+    result.reserve(thread_ids.size());
+
+    for (const DWORD id : thread_ids) {
+        // the thread has exited
+        const HANDLE thread = ::OpenThread(THREAD_SUSPEND_RESUME | THREAD_GET_CONTEXT, FALSE, id);
+        if (thread == nullptr) {
+            continue;
+        }
+
+        if (::SuspendThread(thread) != static_cast<DWORD>(-1)) {
+            // waits until the thread is actually suspended
+            CONTEXT context = {};
+            context.ContextFlags = CONTEXT_CONTROL;
+            if (::GetThreadContext(thread, &context)) {
+#if RCMP_GET_ARCH() == RCMP_ARCH_X86_64
+                result.push_back(static_cast<std::uintptr_t>(context.Rip));
+#elif RCMP_GET_ARCH() == RCMP_ARCH_X86
+                result.push_back(static_cast<std::uintptr_t>(context.Eip));
+#endif
+            }
+
+            ::ResumeThread(thread);
+        }
+
+        ::CloseHandle(thread);
+    }
+
+    return result;
+}
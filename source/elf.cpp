@@ -0,0 +1,626 @@
+#include <rcmp/elf.hpp>
+#include <rcmp/codegen.hpp>
+#include <rcmp/memory.hpp>
+#include <rcmp/detail/exception.hpp>
+
+#include "detail/platform/platform.hpp"
+
+#if RCMP_GET_PLATFORM() == RCMP_PLATFORM_LINUX
+
+#include <dlfcn.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <link.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace {
+
+#if RCMP_GET_ARCH() == RCMP_ARCH_X86
+std::uint32_t relocation_type(Elf32_Word info) { return ELF32_R_TYPE(info); }
+std::uint32_t relocation_symbol(Elf32_Word info) { return ELF32_R_SYM(info); }
+unsigned symbol_type(unsigned char info) { return ELF32_ST_TYPE(info); }
+unsigned symbol_binding(unsigned char info) { return ELF32_ST_BIND(info); }
+#else
+std::uint32_t relocation_type(Elf64_Xword info) { return ELF64_R_TYPE(info); }
+std::uint32_t relocation_symbol(Elf64_Xword info) { return ELF64_R_SYM(info); }
+unsigned symbol_type(unsigned char info) { return ELF64_ST_TYPE(info); }
+unsigned symbol_binding(unsigned char info) { return ELF64_ST_BIND(info); }
+#endif
+
+// Absolute relocation stores symbol address to data (function pointers of non-PIC code on x86) or to code (text relocations)
+#if RCMP_GET_ARCH() == RCMP_ARCH_X86_64
+constexpr std::uint32_t g_jump_slot = R_X86_64_JUMP_SLOT;
+constexpr std::uint32_t g_glob_dat  = R_X86_64_GLOB_DAT;
+constexpr std::uint32_t g_absolute  = R_X86_64_64;
+#elif RCMP_GET_ARCH() == RCMP_ARCH_X86
+constexpr std::uint32_t g_jump_slot = R_386_JMP_SLOT;
+constexpr std::uint32_t g_glob_dat  = R_386_GLOB_DAT;
+constexpr std::uint32_t g_absolute  = R_386_32;
+#elif RCMP_GET_ARCH() == RCMP_ARCH_ARM64
+constexpr std::uint32_t g_jump_slot = R_AARCH64_JUMP_SLOT;
+constexpr std::uint32_t g_glob_dat  = R_AARCH64_GLOB_DAT;
+constexpr std::uint32_t g_absolute  = R_AARCH64_ABS64;
+#endif
+
+// Implicit addend of REL relocation is overwritten by the relocated value already, function symbols have none in practice
+ElfW(Sxword) relocation_addend(const ElfW(Rel)&) { return 0; }
+ElfW(Sxword) relocation_addend(const ElfW(Rela)& relocation) { return relocation.r_addend; }
+
+// Undefined symbols may be untyped, variables (i.e. `stdout`, type info) are imported through GOT as well
+bool is_function_symbol(const ElfW(Sym)& symbol) {
+    const auto type = symbol_type(symbol.st_info);
+    return type == STT_FUNC || type == STT_GNU_IFUNC || (type == STT_NOTYPE && symbol.st_shndx == SHN_UNDEF);
+}
+
+// Unbound JUMP_SLOT entry points to the PLT code of its own module, that calls dynamic linker
+bool is_lazy_binding_stub(rcmp::address_t code) {
+    const auto bytes = code.as_ptr<const std::uint8_t>();
+
+#if RCMP_GET_ARCH() == RCMP_ARCH_X86 || RCMP_GET_ARCH() == RCMP_ARCH_X86_64
+    // [endbr32/endbr64] push imm32
+    const std::size_t endbr_size = (bytes[0] == 0xF3 && bytes[1] == 0x0F && bytes[2] == 0x1E && (bytes[3] & 0xFE) == 0xFA) ? 4 : 0;
+    return bytes[endbr_size] == 0x68;
+#elif RCMP_GET_ARCH() == RCMP_ARCH_ARM64
+    // PLT0: stp x16, x30, [sp, #-16]!
+    std::uint32_t instruction;
+    std::memcpy(&instruction, bytes, sizeof(instruction));
+    return instruction == 0xA9BF7BF0;
+#endif
+}
+
+struct import_slot_t {
+    rcmp::address_t slot;
+    bool            bound; // holds imported function, not the lazy binding stub of its own module
+};
+
+struct import_search_t {
+    const char*                symbol;
+    const char*                module;
+    std::vector<import_slot_t> slots;
+};
+
+int find_module_slots(dl_phdr_info* info, std::size_t, void* data) {
+    auto& search = *static_cast<import_search_t*>(data);
+
+    if (!rcmp::detail::platform::matches_module(info->dlpi_name, search.module)) {
+        return 0;
+    }
+
+    const ElfW(Addr) base = info->dlpi_addr;
+
+    const ElfW(Dyn)* dynamic = nullptr;
+    std::vector<std::pair<std::uintptr_t, std::uintptr_t>> segments;
+    std::vector<std::pair<std::uintptr_t, std::uintptr_t>> code_segments;
+
+    for (std::size_t i = 0; i < info->dlpi_phnum; i++) {
+        const auto& header = info->dlpi_phdr[i];
+
+        if (header.p_type == PT_DYNAMIC) {
+            dynamic = reinterpret_cast<const ElfW(Dyn)*>(base + header.p_vaddr);
+        }
+        else if (header.p_type == PT_LOAD) {
+            segments.emplace_back(base + header.p_vaddr, base + header.p_vaddr + header.p_memsz);
+
+            if (header.p_flags & PF_X) {
+                code_segments.push_back(segments.back());
+            }
+        }
+    }
+
+    const auto contains = [](const std::vector<std::pair<std::uintptr_t, std::uintptr_t>>& ranges, rcmp::address_t address) {
+        return std::any_of(ranges.begin(), ranges.end(), [&address](const auto& range) {
+            return range.first <= address.as_number() && address.as_number() < range.second;
+        });
+    };
+
+    if (dynamic == nullptr) {
+        return 0;
+    }
+
+    // glibc relocates pointers of .dynamic in place, other loaders (and vdso) may keep them as is
+    const auto to_address = [base](ElfW(Addr) pointer) {
+        return pointer < base ? pointer + base : pointer;
+    };
+
+    const ElfW(Sym)* symbols = nullptr;
+    const char*      strings = nullptr;
+
+    ElfW(Addr)  plt_relocations = 0, rela_relocations = 0, rel_relocations = 0;
+    std::size_t plt_size = 0, rela_size = 0, rel_size = 0;
+    ElfW(Sxword) plt_type = DT_NULL;
+
+    for (auto entry = dynamic; entry->d_tag != DT_NULL; entry++) {
+        switch (entry->d_tag) {
+            case DT_SYMTAB:   symbols = reinterpret_cast<const ElfW(Sym)*>(to_address(entry->d_un.d_ptr)); break;
+            case DT_STRTAB:   strings = reinterpret_cast<const char*>(to_address(entry->d_un.d_ptr)); break;
+            case DT_JMPREL:   plt_relocations = to_address(entry->d_un.d_ptr); break;
+            case DT_PLTRELSZ: plt_size = entry->d_un.d_val; break;
+            case DT_PLTREL:   plt_type = static_cast<ElfW(Sxword)>(entry->d_un.d_val); break;
+            case DT_RELA:     rela_relocations = to_address(entry->d_un.d_ptr); break;
+            case DT_RELASZ:   rela_size = entry->d_un.d_val; break;
+            case DT_REL:      rel_relocations = to_address(entry->d_un.d_ptr); break;
+            case DT_RELSZ:    rel_size = entry->d_un.d_val; break;
+            default:          break;
+        }
+    }
+
+    if (symbols == nullptr || strings == nullptr) {
+        return 0;
+    }
+
+    const auto visit = [&](const auto* relocations, std::size_t size) {
+        for (std::size_t i = 0; i < size / sizeof(*relocations); i++) {
+            const auto& relocation = relocations[i];
+
+            const auto type = relocation_type(relocation.r_info);
+            if (type != g_jump_slot && type != g_glob_dat && type != g_absolute) {
+                continue;
+            }
+
+            const auto& symbol = symbols[relocation_symbol(relocation.r_info)];
+            if (!is_function_symbol(symbol) || std::strcmp(strings + symbol.st_name, search.symbol) != 0) {
+                continue;
+            }
+
+            const rcmp::address_t slot = base + relocation.r_offset;
+
+            // only plain pointers in data are slots, not operands of instructions or pointers into the function
+            if (type == g_absolute && (contains(code_segments, slot) || relocation_addend(relocation) != 0)) {
+                continue;
+            }
+
+            rcmp::address_t value;
+            rcmp::read_memory(slot, &value, sizeof(value));
+
+            const bool bound = value != nullptr && !(contains(segments, value) && is_lazy_binding_stub(value));
+
+            // .rela.dyn may cover .rela.plt as well
+            const bool known = std::any_of(search.slots.begin(), search.slots.end(), [&slot](const import_slot_t& other) {
+                return other.slot == slot;
+            });
+
+            if (!known) {
+                search.slots.push_back({ slot, bound });
+            }
+        }
+    };
+
+    if (plt_relocations != 0) {
+        if (plt_type == DT_RELA) {
+            visit(reinterpret_cast<const ElfW(Rela)*>(plt_relocations), plt_size);
+        }
+        else {
+            visit(reinterpret_cast<const ElfW(Rel)*>(plt_relocations), plt_size);
+        }
+    }
+
+    if (rela_relocations != 0) {
+        visit(reinterpret_cast<const ElfW(Rela)*>(rela_relocations), rela_size);
+    }
+
+    if (rel_relocations != 0) {
+        visit(reinterpret_cast<const ElfW(Rel)*>(rel_relocations), rel_size);
+    }
+
+    return 0;
+}
+
+// In load order, so slots of the main executable come first
+std::vector<import_slot_t> find_slots(const char* symbol, const char* module) {
+    import_search_t search{ symbol, module, {} };
+    ::dl_iterate_phdr(&find_module_slots, &search);
+
+    return search.slots;
+}
+
+struct loaded_module_t {
+    ElfW(Addr)        base;
+    const ElfW(Phdr)* headers;
+    std::size_t       header_count;
+    std::string       path; // file the module is mapped from
+};
+
+// Loaded modules matching `module`, in load order
+std::vector<loaded_module_t> find_modules(const char* module) {
+    struct context_t {
+        const char*                  name;
+        std::vector<loaded_module_t> modules;
+    } context{ module, {} };
+
+    ::dl_iterate_phdr([](dl_phdr_info* info, std::size_t, void* data) {
+        auto& context = *static_cast<context_t*>(data);
+
+        if (rcmp::detail::platform::matches_module(info->dlpi_name, context.name)) {
+            // main executable has no name
+            const bool executable = info->dlpi_name == nullptr || *info->dlpi_name == '\0';
+            context.modules.push_back({ info->dlpi_addr, info->dlpi_phdr, info->dlpi_phnum, executable ? "/proc/self/exe" : info->dlpi_name });
+        }
+
+        return 0;
+    }, &context);
+
+    return context.modules;
+}
+
+// The first loaded module matching `module`
+loaded_module_t find_module(const char* module) {
+    auto modules = find_modules(module);
+
+    if (modules.empty()) {
+        throw rcmp::error("module \"%s\" is not loaded", module);
+    }
+
+    return std::move(modules.front());
+}
+
+// Calls resolver of indirect function (STT_GNU_IFUNC) the way dynamic linker does
+rcmp::address_t resolve_ifunc(rcmp::address_t resolver, const char* symbol) {
+#if RCMP_GET_ARCH() == RCMP_ARCH_X86 || RCMP_GET_ARCH() == RCMP_ARCH_X86_64
+    static_cast<void>(symbol);
+    return resolver.as_ptr<void*()>()();
+#else
+    throw rcmp::error("unable to find symbol %s, it's an indirect function (resolved at runtime)", symbol);
+#endif
+}
+
+constexpr std::size_t align_note(std::size_t size) {
+    return (size + 3) / 4 * 4;
+}
+
+// Functions and variables defined by ELF file of a module, both exported (.dynsym) and local (.symtab).
+// The file stays mapped while the index exists, names refer to its string tables.
+class symbol_index {
+    struct symbol_t {
+        ElfW(Addr) value;     // without load bias
+        bool       global;
+        bool       ambiguous; // several local symbols with different values
+        bool       ifunc;     // `value` is a resolver returning the function
+    };
+
+    void*                                          m_mapping = MAP_FAILED;
+    std::size_t                                    m_size    = 0;
+    std::unordered_map<std::string_view, symbol_t> m_symbols;
+
+#if RCMP_GET_ARCH() == RCMP_ARCH_X86
+    static constexpr unsigned char g_class = ELFCLASS32;
+#else
+    static constexpr unsigned char g_class = ELFCLASS64;
+#endif
+
+    const std::uint8_t* data() const {
+        return static_cast<const std::uint8_t*>(m_mapping);
+    }
+
+    bool contains(std::uint64_t offset, std::uint64_t size) const {
+        return offset <= m_size && size <= m_size - offset;
+    }
+
+    void add(std::string_view name, const symbol_t& symbol) {
+        const auto [it, inserted] = m_symbols.emplace(name, symbol);
+        if (inserted || it->second.value == symbol.value) {
+            it->second.global = it->second.global || symbol.global;
+            return;
+        }
+
+        // Like linker does, exported symbol wins over local ones. Local (static) functions of different
+        // translation units may share a name, there's no way to tell which one is asked for then.
+        if (symbol.global && !it->second.global) {
+            it->second = symbol;
+        }
+        else if (!symbol.global && !it->second.global) {
+            it->second.ambiguous = true;
+        }
+    }
+
+    void add_section(const ElfW(Shdr)* sections, std::size_t section_count, std::size_t index, const std::string& path) {
+        const auto& section = sections[index];
+
+        if (!contains(section.sh_offset, section.sh_size) || section.sh_link >= section_count) {
+            throw rcmp::error("unable to read symbols of %s, section %zu is malformed", path.c_str(), index);
+        }
+
+        const auto& strings_section = sections[section.sh_link];
+        if (!contains(strings_section.sh_offset, strings_section.sh_size)) {
+            throw rcmp::error("unable to read symbols of %s, section %u is malformed", path.c_str(), static_cast<unsigned>(section.sh_link));
+        }
+
+        const auto symbols      = reinterpret_cast<const ElfW(Sym)*>(data() + section.sh_offset);
+        const auto symbol_count = section.sh_size / sizeof(ElfW(Sym));
+        const auto strings      = reinterpret_cast<const char*>(data() + strings_section.sh_offset);
+
+        // Exported symbol may have several versions, only the default one is found by name (as with dlsym)
+        const ElfW(Half)* versions = nullptr;
+        if (section.sh_type == SHT_DYNSYM) {
+            for (std::size_t i = 0; i < section_count; i++) {
+                if (sections[i].sh_type == SHT_GNU_versym && sections[i].sh_link == index && contains(sections[i].sh_offset, symbol_count * sizeof(ElfW(Half)))) {
+                    versions = reinterpret_cast<const ElfW(Half)*>(data() + sections[i].sh_offset);
+                }
+            }
+        }
+
+        m_symbols.reserve(m_symbols.size() + symbol_count);
+
+        for (std::size_t i = 0; i < symbol_count; i++) {
+            const auto& symbol = symbols[i];
+
+            const auto type = symbol_type(symbol.st_info);
+            if ((type != STT_FUNC && type != STT_OBJECT && type != STT_GNU_IFUNC) || symbol.st_shndx == SHN_UNDEF || symbol.st_shndx >= SHN_LORESERVE || symbol.st_name == 0 || symbol.st_name >= strings_section.sh_size) {
+                continue;
+            }
+
+            if (versions != nullptr && (versions[i] & 0x8000) != 0) {
+                continue;
+            }
+
+            const auto name = strings + symbol.st_name;
+            const auto end  = static_cast<const char*>(std::memchr(name, '\0', strings_section.sh_size - symbol.st_name));
+            if (end == nullptr) {
+                continue;
+            }
+
+            add({ name, static_cast<std::size_t>(end - name) }, { symbol.st_value, symbol_binding(symbol.st_info) != STB_LOCAL, false, type == STT_GNU_IFUNC });
+        }
+    }
+
+public:
+    explicit symbol_index(const std::string& path) {
+        const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            throw rcmp::error("unable to read symbols of %s: %s", path.c_str(), std::strerror(errno));
+        }
+
+        int error = ENOEXEC;
+
+        struct stat info;
+        if (::fstat(fd, &info) != 0) {
+            error = errno;
+        }
+        else if (info.st_size > 0) {
+            m_size    = static_cast<std::size_t>(info.st_size);
+            m_mapping = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            error     = errno;
+        }
+
+        ::close(fd);
+
+        if (m_mapping == MAP_FAILED) {
+            throw rcmp::error("unable to read symbols of %s: %s", path.c_str(), std::strerror(error));
+        }
+
+        try {
+            if (!contains(0, sizeof(ElfW(Ehdr))) || std::memcmp(data(), ELFMAG, SELFMAG) != 0 || data()[EI_CLASS] != g_class) {
+                throw rcmp::error("unable to read symbols of %s, it's not an ELF file of this architecture", path.c_str());
+            }
+
+            const auto header = reinterpret_cast<const ElfW(Ehdr)*>(data());
+            if (header->e_shentsize != sizeof(ElfW(Shdr)) || !contains(header->e_shoff, std::uint64_t{ header->e_shnum } * sizeof(ElfW(Shdr)))) {
+                throw rcmp::error("unable to read symbols of %s, its section headers are malformed", path.c_str());
+            }
+
+            const auto sections = reinterpret_cast<const ElfW(Shdr)*>(data() + header->e_shoff);
+
+            for (std::size_t i = 0; i < header->e_shnum; i++) {
+                if (sections[i].sh_type == SHT_DYNSYM || sections[i].sh_type == SHT_SYMTAB) {
+                    add_section(sections, header->e_shnum, i, path);
+                }
+            }
+        }
+        catch (...) {
+            ::munmap(m_mapping, m_size);
+            throw;
+        }
+    }
+
+    symbol_index(const symbol_index&) = delete;
+    symbol_index& operator=(const symbol_index&) = delete;
+
+    ~symbol_index() {
+        ::munmap(m_mapping, m_size);
+    }
+
+    // Value of the symbol without load bias, null if there's no such one
+    const symbol_t* find(std::string_view name) const {
+        const auto it = m_symbols.find(name);
+        return it != m_symbols.end() ? &it->second : nullptr;
+    }
+};
+
+// Every module is indexed once, on the first lookup
+class symbol_indexes {
+    std::mutex                                                                     m_mutex;
+    std::map<std::pair<std::string, ElfW(Addr)>, std::shared_ptr<const symbol_index>> m_indexes; // by (path, load bias)
+
+public:
+    static symbol_indexes& instance() {
+        // Never destroyed, see `hook_registry::instance`
+        static auto instance = new symbol_indexes;
+        return *instance;
+    }
+
+    std::shared_ptr<const symbol_index> get(const loaded_module_t& module) {
+        std::lock_guard lock(m_mutex);
+
+        auto& index = m_indexes[{ module.path, module.base }];
+        if (index == nullptr) {
+            try {
+                index = std::make_shared<const symbol_index>(module.path);
+            }
+            catch (...) {
+                m_indexes.erase({ module.path, module.base });
+                throw;
+            }
+        }
+
+        return index;
+    }
+};
+
+} // unnamed namespace
+
+std::vector<rcmp::address_t> rcmp::find_import_slots(const char* symbol, const char* module) {
+    std::vector<rcmp::address_t> result;
+
+    for (const auto& slot : find_slots(symbol, module)) {
+        result.push_back(slot.slot);
+    }
+
+    std::sort(result.begin(), result.end());
+
+    return result;
+}
+
+rcmp::address_t rcmp::module_load_bias(const char* module) {
+    return find_module(module).base;
+}
+
+std::vector<std::uint8_t> rcmp::module_build_id(const char* module) {
+    const auto loaded = find_module(module);
+
+    for (std::size_t i = 0; i < loaded.header_count; i++) {
+        const auto& header = loaded.headers[i];
+        if (header.p_type != PT_NOTE) {
+            continue;
+        }
+
+        const auto notes = reinterpret_cast<const std::uint8_t*>(loaded.base + header.p_vaddr);
+
+        for (std::size_t offset = 0; offset + sizeof(ElfW(Nhdr)) <= header.p_memsz; ) {
+            ElfW(Nhdr) note;
+            std::memcpy(&note, notes + offset, sizeof(note));
+
+            const auto name        = notes + offset + sizeof(note);
+            const auto description = name + align_note(note.n_namesz);
+
+            if (note.n_type == NT_GNU_BUILD_ID && note.n_namesz == sizeof(ELF_NOTE_GNU) && std::memcmp(name, ELF_NOTE_GNU, sizeof(ELF_NOTE_GNU)) == 0) {
+                return { description, description + note.n_descsz };
+            }
+
+            offset += sizeof(note) + align_note(note.n_namesz) + align_note(note.n_descsz);
+        }
+    }
+
+    return {};
+}
+
+rcmp::address_t rcmp::find_symbol(const char* module, const char* symbol) {
+    const auto modules = find_modules(module);
+
+    if (module != nullptr && modules.empty()) {
+        throw rcmp::error("unable to find symbol %s, module \"%s\" is not loaded", symbol, module);
+    }
+
+    for (const auto& loaded : modules) {
+        std::shared_ptr<const symbol_index> index;
+
+        try {
+            index = symbol_indexes::instance().get(loaded);
+        }
+        catch (const rcmp::error&) {
+            // Modules without a file (vdso) are skipped when every module is searched
+            if (module != nullptr) {
+                throw;
+            }
+            continue;
+        }
+
+        if (const auto found = index->find(symbol)) {
+            if (found->ambiguous) {
+                throw rcmp::error("unable to find symbol %s, %s has several local symbols with this name", symbol, loaded.path.c_str());
+            }
+
+            if (found->ifunc) {
+                return resolve_ifunc(loaded.base + found->value, symbol);
+            }
+
+            return loaded.base + found->value;
+        }
+    }
+
+    return nullptr;
+}
+
+rcmp::address_t rcmp::detail::install_import_hook(const import_t& import, rcmp::address_t wrapper_function, hook_record& record) {
+    const auto slots = find_slots(import.symbol, import.module);
+
+    if (slots.empty()) {
+        throw rcmp::error("unable to hook import of %s, no module imports it", import.symbol);
+    }
+
+    // The first module importing the symbol (i.e. main executable) decides what `original` is.
+    // Lazy binding stub would overwrite the slot with resolved function once called, so it can't be `original`.
+    rcmp::address_t original_function = nullptr;
+
+    const auto bound = std::find_if(slots.begin(), slots.end(), [](const import_slot_t& slot) {
+        return slot.bound;
+    });
+
+    if (bound != slots.end()) {
+        rcmp::read_memory(bound->slot, &original_function, sizeof(original_function));
+    }
+    else {
+        original_function = ::dlsym(RTLD_DEFAULT, import.symbol);
+    }
+
+    if (original_function == nullptr) {
+        throw rcmp::error("unable to hook import of %s, it's neither bound nor found by dlsym", import.symbol);
+    }
+
+    // Every slot gets its own value back on uninstallation
+    std::vector<std::pair<rcmp::address_t, rcmp::address_t>> previous; // (slot, value)
+    previous.reserve(slots.size());
+
+    for (const auto& slot : slots) {
+        rcmp::address_t value;
+        rcmp::read_memory(slot.slot, &value, sizeof(value));
+        rcmp::write_memory(slot.slot, &wrapper_function, sizeof(wrapper_function));
+
+        previous.emplace_back(slot.slot, value);
+    }
+
+    // All slots are checked before any of them is written, so the hook is never half-enabled
+    const auto set_slots = [previous, wrapper_function, symbol = std::string(import.symbol)](bool hooked, const char* action) {
+        for (const auto& [slot, value] : previous) {
+            rcmp::address_t current;
+            rcmp::read_memory(slot, &current, sizeof(current));
+
+            if (current != wrapper_function && current != value) {
+                throw rcmp::error("unable to %s hook of %s (GOT entry %" PRIXPTR "), it's overridden by another hook", action, symbol.c_str(), slot.as_number());
+            }
+        }
+
+        for (const auto& [slot, value] : previous) {
+            const rcmp::address_t new_value = hooked ? wrapper_function : value;
+            rcmp::write_memory(slot, &new_value, sizeof(new_value));
+        }
+    };
+
+    // Disabled hook isn't in the slots anymore, nothing to undo. `record` owns the callback, so it outlives it.
+    record.unpatch = [set_slots, &record] {
+        if (record.enabled) {
+            set_slots(false, "uninstall");
+        }
+    };
+
+    record.set_enabled = [set_slots](bool enabled) {
+        set_slots(enabled, enabled ? "enable" : "disable");
+    };
+
+    return original_function;
+}
+
+#endif
@@ -0,0 +1,138 @@
+#include <rcmp/hook_handle.hpp>
+#include <rcmp/batch.hpp>
+#include <rcmp/detail/exception.hpp>
+
+#include <utility>
+
+rcmp::detail::hook_record::~hook_record() {
+    for (auto& code_block : code) {
+        // force memory leak
+        code_block.release();
+    }
+}
+
+void rcmp::detail::hook_record::release_resources() noexcept {
+    code.clear();
+
+    if (state != nullptr && free_state != nullptr) {
+        free_state(std::exchange(state, nullptr));
+    }
+}
+
+rcmp::hook_handle::hook_handle(std::shared_ptr<detail::hook_record> record) noexcept : m_record(std::move(record)) {
+    // empty
+}
+
+rcmp::hook_handle::hook_handle(hook_handle&& other) noexcept : m_record(std::move(other.m_record)) {
+    // empty
+}
+
+rcmp::hook_handle& rcmp::hook_handle::operator=(hook_handle&& other) noexcept {
+    if (this != &other) {
+        // current hook is uninstalled when `previous` goes out of scope
+        hook_handle previous(std::move(*this));
+        m_record = std::move(other.m_record);
+    }
+    return *this;
+}
+
+rcmp::hook_handle::~hook_handle() {
+    try {
+        uninstall();
+    }
+    catch (...) {
+        release();
+    }
+}
+
+bool rcmp::hook_handle::installed() const noexcept {
+    return m_record != nullptr && m_record->installed;
+}
+
+void rcmp::hook_handle::uninstall() {
+    if (!installed()) {
+        return;
+    }
+
+    rcmp::hook_batch batch;
+
+    m_record->unpatch();
+
+    // Nothing refers to generated code once original bytes are written back. Live patched code may be still executed
+    // by threads that entered it before, so it's never reused (see `hook_record::~hook_record`).
+    batch.on_commit([record = m_record, live = rcmp::get_patch_mode() == rcmp::patch_mode::live] {
+        if (live) {
+            for (auto& code_block : record->code) {
+                code_block.release();
+            }
+        }
+
+        record->release_resources();
+    });
+
+    // Outer batch may still be rolled back, the hook is installed again then
+    m_record->installed = false;
+    batch.on_rollback([record = m_record] {
+        record->installed = true;
+    });
+
+    batch.commit();
+
+    if (rcmp::hook_batch::current() == nullptr) {
+        m_record.reset();
+    }
+}
+
+void rcmp::hook_handle::release() noexcept {
+    m_record.reset();
+}
+
+void rcmp::hook_handle::enable() {
+    set_enabled(true);
+}
+
+void rcmp::hook_handle::disable() {
+    set_enabled(false);
+}
+
+bool rcmp::hook_handle::enabled() const noexcept {
+    return installed() && m_record->enabled;
+}
+
+void rcmp::hook_handle::replace_hook(const void* hook_type, void* hook) {
+    if (!installed()) {
+        throw rcmp::error("unable to replace hook, it's not installed");
+    }
+
+    if (m_record->hook_type != hook_type || m_record->replace_hook == nullptr) {
+        throw rcmp::error("unable to replace hook, type of the new one differs from installed");
+    }
+
+    m_record->replace_hook(m_record->state, hook);
+}
+
+void rcmp::hook_handle::reclaim() noexcept {
+    if (installed() && m_record->reclaim_hooks != nullptr) {
+        m_record->reclaim_hooks(m_record->state);
+    }
+}
+
+void rcmp::hook_handle::set_enabled(bool enabled) {
+    if (!installed()) {
+        throw rcmp::error("unable to %s hook, it's not installed", enabled ? "enable" : "disable");
+    }
+
+    if (m_record->enabled == enabled) {
+        return;
+    }
+
+    rcmp::hook_batch batch;
+
+    m_record->set_enabled(enabled);
+
+    batch.on_commit([record = m_record, enabled] {
+        record->enabled = enabled;
+    });
+
+    batch.commit();
+}
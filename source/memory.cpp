@@ -1,9 +1,378 @@
 #include <rcmp/memory.hpp>
+#include <rcmp/detail/exception.hpp>
 
-std::unique_ptr<std::byte[]> rcmp::allocate_code(std::size_t count) {
-    auto result = std::make_unique<std::byte[]>(count);
+#include "detail/platform/platform.hpp"
 
-    unprotect_memory(result.get(), count);
+#include <algorithm>
+#include <cinttypes>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// Every allocation is aligned to this value, so trampolines never share a cache line with the next one's head
+constexpr std::size_t g_code_alignment = 16;
+
+// Minimal size of memory requested from the OS at once
+constexpr std::size_t g_slab_size = 0x10000;
+
+// A little less than 2GB, so every byte of the slab is reachable via rel32 from `near`
+constexpr std::ptrdiff_t g_max_near_distance = 0x7FFF0000 - static_cast<std::ptrdiff_t>(g_slab_size);
+
+constexpr std::size_t align_up(std::size_t value, std::size_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+class code_arena {
+    struct block_t {
+        rcmp::address_t begin;
+        std::size_t     size;
+    };
+
+    struct slab_t {
+        rcmp::address_t      begin;
+        std::size_t          size;
+        std::size_t          used;
+        std::vector<block_t> free_blocks; // sorted by address
+
+        bool contains(rcmp::address_t address) const {
+            return begin <= address && address < begin + size;
+        }
+    };
+
+    std::mutex          m_mutex;
+    std::vector<slab_t> m_slabs;
+
+    static bool is_near(const slab_t& slab, rcmp::address_t near) {
+        if constexpr (sizeof(void*) == 4) {
+            // whole address space is reachable
+            return true;
+        }
+        else {
+            if (near == nullptr) {
+                return true;
+            }
+
+            const auto distance = [near](rcmp::address_t address) {
+                return address > near ? address - near : near - address;
+            };
+            return distance(slab.begin) <= g_max_near_distance && distance(slab.begin + slab.size) <= g_max_near_distance;
+        }
+    }
+
+    static rcmp::address_t allocate_from(slab_t& slab, std::size_t count) {
+        // first-fit among reclaimed blocks
+        for (auto it = slab.free_blocks.begin(); it != slab.free_blocks.end(); ++it) {
+            if (it->size < count) {
+                continue;
+            }
+
+            const rcmp::address_t result = it->begin;
+            it->begin += count;
+            it->size  -= count;
+            if (it->size == 0) {
+                slab.free_blocks.erase(it);
+            }
+
+            return result;
+        }
+
+        if (slab.size - slab.used >= count) {
+            const rcmp::address_t result = slab.begin + slab.used;
+            slab.used += count;
+            return result;
+        }
+
+        return nullptr;
+    }
+
+public:
+    // Never destroyed: generated code is used until the very end of the program, including static destructors
+    static code_arena& instance() {
+        static const auto instance = new code_arena;
+        return *instance;
+    }
+
+    rcmp::address_t allocate(std::size_t count, rcmp::address_t near) {
+        count = align_up(count, g_code_alignment);
+
+        const std::lock_guard lock(m_mutex);
+
+        for (auto& slab : m_slabs) {
+            if (!is_near(slab, near)) {
+                continue;
+            }
+
+            if (auto result = allocate_from(slab, count); result != nullptr) {
+                return result;
+            }
+        }
+
+        const std::size_t slab_size = align_up(count, (std::max)(g_slab_size, rcmp::detail::platform::allocation_granularity()));
+
+        rcmp::address_t slab_begin = nullptr;
+        if constexpr (sizeof(void*) != 4) {
+            if (near != nullptr) {
+                slab_begin = rcmp::detail::platform::allocate_executable(near, slab_size, g_max_near_distance);
+            }
+        }
+
+        if (slab_begin == nullptr) {
+            // Out of luck, caller has to deal with far memory
+            slab_begin = rcmp::detail::platform::allocate_executable(nullptr, slab_size, 0);
+        }
+
+        if (slab_begin == nullptr) {
+            throw rcmp::error("unable to allocate %zu bytes of executable memory", slab_size);
+        }
+
+        auto& slab = m_slabs.emplace_back(slab_t{ slab_begin, slab_size, 0, {} });
+        return allocate_from(slab, count);
+    }
+
+    void free(rcmp::address_t code, std::size_t count) noexcept {
+        count = align_up(count, g_code_alignment);
+
+        const std::lock_guard lock(m_mutex);
+
+        const auto slab_it = std::find_if(m_slabs.begin(), m_slabs.end(), [code](const slab_t& slab) {
+            return slab.contains(code);
+        });
+
+        if (slab_it == m_slabs.end()) {
+            return;
+        }
+
+        auto& blocks = slab_it->free_blocks;
+
+        auto next = std::lower_bound(blocks.begin(), blocks.end(), code, [](const block_t& block, rcmp::address_t address) {
+            return block.begin < address;
+        });
+
+        next = blocks.insert(next, block_t{ code, count });
+
+        // merge with neighbours
+        if (auto after = std::next(next); after != blocks.end() && next->begin + next->size == after->begin) {
+            next->size += after->size;
+            blocks.erase(after);
+        }
+
+        if (next != blocks.begin()) {
+            if (auto before = std::prev(next); before->begin + before->size == next->begin) {
+                before->size += next->size;
+                next = blocks.erase(next);
+                next = std::prev(next);
+            }
+        }
+
+        // give the tail back to the bump pointer
+        if (next->begin + next->size == slab_it->begin + slab_it->used) {
+            slab_it->used -= next->size;
+            blocks.erase(next);
+        }
+    }
+};
+
+class protection_manager {
+    struct page_t {
+        std::uintptr_t                       region; // pages of different regions are never changed at once
+        rcmp::detail::platform::protection_t original;
+        std::size_t                          references;
+    };
+
+    std::mutex                       m_mutex;
+    std::map<std::uintptr_t, page_t> m_pages;
+
+    // Calls `callback(begin, size, page)` for every run of adjacent pages sharing region and protection
+    template <class F>
+    static void for_each_run(const std::vector<std::pair<std::uintptr_t, page_t>>& pages, F&& callback) {
+        const std::size_t page_size = rcmp::detail::platform::page_size();
+
+        for (auto run_begin = pages.begin(); run_begin != pages.end(); ) {
+            auto run_end = std::next(run_begin);
+            while (run_end != pages.end() &&
+                   run_end->first == std::prev(run_end)->first + page_size &&
+                   run_end->second.region == run_begin->second.region &&
+                   run_end->second.original == run_begin->second.original) {
+                ++run_end;
+            }
+
+            callback(run_begin->first, static_cast<std::size_t>(std::distance(run_begin, run_end)) * page_size, run_begin->second);
+            run_begin = run_end;
+        }
+    }
+
+    static void restore(std::uintptr_t begin, std::size_t size, const page_t& page) noexcept {
+        try {
+            rcmp::detail::platform::set_protection(begin, size, page.original);
+        }
+        catch (const rcmp::error&) {
+            // nothing to do, memory stays writable
+        }
+    }
+
+public:
+    // Never destroyed, hooks may be uninstalled from static destructors
+    static protection_manager& instance() {
+        static const auto instance = new protection_manager;
+        return *instance;
+    }
+
+    // `pages` must be sorted
+    void acquire(const std::vector<std::uintptr_t>& pages) {
+        const std::lock_guard lock(m_mutex);
+
+        std::vector<std::uintptr_t> fresh_pages;
+        std::copy_if(pages.begin(), pages.end(), std::back_inserter(fresh_pages), [this](std::uintptr_t page) {
+            return m_pages.count(page) == 0;
+        });
+
+        if (!fresh_pages.empty()) {
+            const auto regions = rcmp::detail::platform::query_regions(fresh_pages.front(), fresh_pages.back() + rcmp::detail::platform::page_size());
+
+            std::vector<std::pair<std::uintptr_t, page_t>> fresh;
+            auto region_it = regions.begin();
+            for (const auto page : fresh_pages) {
+                while (region_it != regions.end() && region_it->end <= page) {
+                    ++region_it;
+                }
+
+                if (region_it == regions.end() || region_it->begin > page) {
+                    throw rcmp::error("unable to change protection of unmapped page %" PRIXPTR, page);
+                }
+
+                fresh.emplace_back(page, page_t{ region_it->begin, region_it->protection, 0 });
+            }
+
+            std::vector<std::pair<std::uintptr_t, page_t>> protected_pages;
+            std::copy_if(fresh.begin(), fresh.end(), std::back_inserter(protected_pages), [](const auto& page) {
+                return !rcmp::detail::platform::is_writable(page.second.original);
+            });
+
+            std::vector<std::tuple<std::uintptr_t, std::size_t, page_t>> opened;
+            try {
+                for_each_run(protected_pages, [&opened](std::uintptr_t begin, std::size_t size, const page_t& page) {
+                    rcmp::detail::platform::set_protection(begin, size, rcmp::detail::platform::make_writable(page.original));
+                    opened.emplace_back(begin, size, page);
+                });
+            }
+            catch (const rcmp::error&) {
+                for (const auto& [begin, size, page] : opened) {
+                    restore(begin, size, page);
+                }
+                throw;
+            }
+
+            m_pages.insert(fresh.begin(), fresh.end());
+        }
+
+        for (const auto page : pages) {
+            m_pages[page].references++;
+        }
+    }
+
+    void release(const std::vector<std::uintptr_t>& pages) noexcept {
+        const std::lock_guard lock(m_mutex);
+
+        std::vector<std::pair<std::uintptr_t, page_t>> closed;
+        for (const auto page : pages) {
+            const auto it = m_pages.find(page);
+            if (it == m_pages.end() || --it->second.references != 0) {
+                continue;
+            }
+
+            if (!rcmp::detail::platform::is_writable(it->second.original)) {
+                closed.emplace_back(*it);
+            }
+            m_pages.erase(it);
+        }
+
+        for_each_run(closed, &protection_manager::restore);
+    }
+};
+
+std::vector<std::uintptr_t> pages_of(rcmp::address_t where, std::size_t count) {
+    std::vector<std::uintptr_t> result;
+    if (count == 0) {
+        return result;
+    }
+
+    const std::uintptr_t page_size = rcmp::detail::platform::page_size();
+
+    const std::uintptr_t first = where.as_number() & ~(page_size - 1);
+    const std::uintptr_t last  = (where + count - 1).as_number() & ~(page_size - 1);
+    for (std::uintptr_t page = first; page <= last; page += page_size) {
+        result.push_back(page);
+    }
 
     return result;
 }
+
+} // unnamed namespace
+
+void rcmp::unprotect_memory(rcmp::address_t where, std::size_t count) {
+    // pages are never released, so they stay writable
+    protection_manager::instance().acquire(pages_of(where, count));
+}
+
+rcmp::protection_scope::protection_scope(rcmp::address_t where, std::size_t count) {
+    add(where, count);
+}
+
+rcmp::protection_scope::protection_scope(protection_scope&& other) noexcept
+    : m_pages(std::exchange(other.m_pages, {})) {
+}
+
+rcmp::protection_scope& rcmp::protection_scope::operator=(protection_scope&& other) noexcept {
+    if (this != &other) {
+        reset();
+        m_pages = std::exchange(other.m_pages, {});
+    }
+    return *this;
+}
+
+rcmp::protection_scope::~protection_scope() {
+    reset();
+}
+
+void rcmp::protection_scope::add(rcmp::address_t where, std::size_t count) {
+    add({ { where, count } });
+}
+
+void rcmp::protection_scope::add(const std::vector<std::pair<rcmp::address_t, std::size_t>>& ranges) {
+    std::vector<std::uintptr_t> pages;
+    for (const auto& [where, count] : ranges) {
+        const auto range_pages = pages_of(where, count);
+        pages.insert(pages.end(), range_pages.begin(), range_pages.end());
+    }
+
+    std::sort(pages.begin(), pages.end());
+    pages.erase(std::unique(pages.begin(), pages.end()), pages.end());
+
+    // every page is held by the scope only once
+    pages.erase(std::remove_if(pages.begin(), pages.end(), [this](std::uintptr_t page) {
+        return std::binary_search(m_pages.begin(), m_pages.end(), page);
+    }), pages.end());
+
+    protection_manager::instance().acquire(pages);
+
+    const auto middle = m_pages.insert(m_pages.end(), pages.begin(), pages.end());
+    std::inplace_merge(m_pages.begin(), middle, m_pages.end());
+}
+
+void rcmp::protection_scope::reset() noexcept {
+    protection_manager::instance().release(m_pages);
+    m_pages.clear();
+}
+
+void rcmp::code_deleter::operator()(std::byte* code) const noexcept {
+    code_arena::instance().free(code, size);
+}
+
+rcmp::code_ptr rcmp::allocate_code(std::size_t count, rcmp::address_t near) {
+    return rcmp::code_ptr(code_arena::instance().allocate(count, near).as_ptr<std::byte>(), code_deleter{ count });
+}
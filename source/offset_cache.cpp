@@ -0,0 +1,295 @@
+#include <rcmp/offset_cache.hpp>
+#include <rcmp/detail/exception.hpp>
+#include <rcmp/detail/scope_exit.hpp>
+
+#if defined(RCMP_HAS_ELF)
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <tuple>
+#include <utility>
+
+namespace {
+
+constexpr char          g_magic[8]          = { 'R', 'C', 'M', 'P', 'O', 'F', 'F', 'S' };
+constexpr std::uint32_t g_version           = 1;
+constexpr std::size_t   g_max_build_id_size = 64;
+
+// File layout: header, entries sorted by (hash, key), keys
+struct header_t {
+    char          magic[8];
+    std::uint32_t version;
+    std::uint32_t build_id_size;
+    std::uint8_t  build_id[g_max_build_id_size];
+    std::uint64_t entry_count;
+    std::uint64_t keys_size;
+};
+
+struct entry_t {
+    std::uint64_t hash;
+    std::uint64_t offset;     // from load bias of the module
+    std::uint32_t key_offset; // from the beginning of keys
+    std::uint32_t key_size;
+};
+
+// FNV-1a
+std::uint64_t hash_key(std::string_view key) {
+    std::uint64_t hash = 0xCBF29CE484222325;
+    for (const char c : key) {
+        hash = (hash ^ static_cast<std::uint8_t>(c)) * 0x100000001B3;
+    }
+
+    return hash;
+}
+
+const header_t& header_of(const std::byte* mapping) {
+    return *reinterpret_cast<const header_t*>(mapping);
+}
+
+const entry_t* entries_of(const std::byte* mapping) {
+    return reinterpret_cast<const entry_t*>(mapping + sizeof(header_t));
+}
+
+std::string_view key_of(const std::byte* mapping, const entry_t& entry) {
+    const auto keys = reinterpret_cast<const char*>(entries_of(mapping) + header_of(mapping).entry_count);
+    return { keys + entry.key_offset, entry.key_size };
+}
+
+bool is_valid(const std::byte* mapping, std::size_t size, const std::vector<std::uint8_t>& build_id) {
+    if (size < sizeof(header_t)) {
+        return false;
+    }
+
+    const auto& header = header_of(mapping);
+
+    if (std::memcmp(header.magic, g_magic, sizeof(g_magic)) != 0 || header.version != g_version) {
+        return false;
+    }
+
+    if (header.build_id_size != build_id.size() || std::memcmp(header.build_id, build_id.data(), build_id.size()) != 0) {
+        return false;
+    }
+
+    if (header.entry_count > (size - sizeof(header_t)) / sizeof(entry_t) || header.keys_size != size - sizeof(header_t) - header.entry_count * sizeof(entry_t)) {
+        return false;
+    }
+
+    const auto entries = entries_of(mapping);
+    return std::all_of(entries, entries + header.entry_count, [&header](const entry_t& entry) {
+        return std::uint64_t{ entry.key_offset } + entry.key_size <= header.keys_size;
+    });
+}
+
+// Maps `path` for reading if it's a valid cache of the module with `build_id`, returns null mapping otherwise
+std::pair<const std::byte*, std::size_t> map_file(const std::string& path, const std::vector<std::uint8_t>& build_id) {
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return { nullptr, 0 };
+    }
+
+    struct stat info;
+    const bool has_size = ::fstat(fd, &info) == 0 && info.st_size > 0;
+
+    void* mapping = has_size ? ::mmap(nullptr, static_cast<std::size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    ::close(fd);
+
+    if (mapping == MAP_FAILED) {
+        return { nullptr, 0 };
+    }
+
+    if (!is_valid(static_cast<const std::byte*>(mapping), static_cast<std::size_t>(info.st_size), build_id)) {
+        ::munmap(mapping, static_cast<std::size_t>(info.st_size));
+        return { nullptr, 0 };
+    }
+
+    return { static_cast<const std::byte*>(mapping), static_cast<std::size_t>(info.st_size) };
+}
+
+void write_all(int fd, const void* data, std::size_t size) {
+    auto bytes = static_cast<const char*>(data);
+
+    while (size > 0) {
+        const auto written = ::write(fd, bytes, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            throw rcmp::error("%s", std::strerror(errno));
+        }
+
+        bytes += written;
+        size  -= static_cast<std::size_t>(written);
+    }
+}
+
+} // unnamed namespace
+
+rcmp::offset_cache::offset_cache(std::string path, const char* module) :
+    m_path(std::move(path)),
+    m_load_bias(rcmp::module_load_bias(module)),
+    m_build_id(rcmp::module_build_id(module)) {
+
+    if (m_build_id.empty()) {
+        throw rcmp::error("unable to open offset cache for module \"%s\", it has no build-id", module);
+    }
+
+    if (m_build_id.size() > g_max_build_id_size) {
+        throw rcmp::error("unable to open offset cache for module \"%s\", its build-id is too long (%zu bytes)", module, m_build_id.size());
+    }
+
+    std::tie(m_mapping, m_mapping_size) = map_file(m_path, m_build_id);
+}
+
+rcmp::offset_cache::~offset_cache() {
+    if (m_mapping != nullptr) {
+        ::munmap(const_cast<std::byte*>(m_mapping), m_mapping_size);
+    }
+}
+
+std::optional<std::uint64_t> rcmp::offset_cache::find_saved(std::string_view key) const {
+    if (m_mapping == nullptr) {
+        return std::nullopt;
+    }
+
+    const auto hash    = hash_key(key);
+    const auto entries = entries_of(m_mapping);
+    const auto end     = entries + header_of(m_mapping).entry_count;
+
+    for (auto it = std::lower_bound(entries, end, hash, [](const entry_t& entry, std::uint64_t value) { return entry.hash < value; }); it != end && it->hash == hash; ++it) {
+        if (key_of(m_mapping, *it) == key) {
+            return it->offset;
+        }
+    }
+
+    return std::nullopt;
+}
+
+std::optional<rcmp::address_t> rcmp::offset_cache::find(std::string_view key) const {
+    if (const auto it = m_pending.find(key); it != m_pending.end()) {
+        return m_load_bias + static_cast<std::ptrdiff_t>(it->second);
+    }
+
+    if (const auto offset = find_saved(key)) {
+        return m_load_bias + static_cast<std::ptrdiff_t>(*offset);
+    }
+
+    return std::nullopt;
+}
+
+void rcmp::offset_cache::insert(std::string_view key, rcmp::address_t address) {
+    const auto offset = static_cast<std::uint64_t>(address - m_load_bias);
+
+    if (find_saved(key) == offset) {
+        return;
+    }
+
+    m_pending.insert_or_assign(std::string(key), offset);
+    m_dirty = true;
+}
+
+void rcmp::offset_cache::save() {
+    if (!m_dirty) {
+        return;
+    }
+
+    // Saves are serialized by the lock file, so entries added by other processes since the cache was opened are kept.
+    // The lock file is never removed: another process may be waiting for the lock on it already.
+    const std::string lock_path = m_path + ".lock";
+
+    const int lock_fd = ::open(lock_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (lock_fd < 0) {
+        throw rcmp::error("unable to lock offset cache %s: %s", lock_path.c_str(), std::strerror(errno));
+    }
+
+    const rcmp::detail::scope_exit unlock = [lock_fd] { ::close(lock_fd); };
+
+    while (::flock(lock_fd, LOCK_EX) != 0) {
+        if (errno != EINTR) {
+            throw rcmp::error("unable to lock offset cache %s: %s", lock_path.c_str(), std::strerror(errno));
+        }
+    }
+
+    const auto [current, current_size] = map_file(m_path, m_build_id);
+    const rcmp::detail::scope_exit unmap = [current = current, current_size = current_size] {
+        if (current != nullptr) {
+            ::munmap(const_cast<std::byte*>(current), current_size);
+        }
+    };
+
+    // Entries of this run replace saved ones, the current file replaces the one mapped on opening
+    auto all = m_pending;
+    for (const auto mapping : { current, m_mapping }) {
+        if (mapping != nullptr) {
+            const auto entries = entries_of(mapping);
+            std::for_each(entries, entries + header_of(mapping).entry_count, [mapping = mapping, &all](const entry_t& entry) {
+                all.emplace(key_of(mapping, entry), entry.offset);
+            });
+        }
+    }
+
+    std::vector<entry_t> entries;
+    std::string          keys;
+    entries.reserve(all.size());
+
+    for (const auto& [key, offset] : all) {
+        entries.push_back({ hash_key(key), offset, static_cast<std::uint32_t>(keys.size()), static_cast<std::uint32_t>(key.size()) });
+        keys += key;
+    }
+
+    std::sort(entries.begin(), entries.end(), [&keys](const entry_t& lhs, const entry_t& rhs) {
+        const std::string_view lhs_key(keys.data() + lhs.key_offset, lhs.key_size);
+        const std::string_view rhs_key(keys.data() + rhs.key_offset, rhs.key_size);
+        return std::tie(lhs.hash, lhs_key) < std::tie(rhs.hash, rhs_key);
+    });
+
+    header_t header{};
+    std::memcpy(header.magic, g_magic, sizeof(g_magic));
+    header.version       = g_version;
+    header.build_id_size = static_cast<std::uint32_t>(m_build_id.size());
+    std::memcpy(header.build_id, m_build_id.data(), m_build_id.size());
+    header.entry_count   = entries.size();
+    header.keys_size     = keys.size();
+
+    // Readers map either the old file or the new one, never a partially written one
+    std::string temporary_path = m_path + ".XXXXXX";
+
+    const int fd = ::mkostemp(temporary_path.data(), O_CLOEXEC);
+    if (fd < 0) {
+        throw rcmp::error("unable to save offset cache %s: %s", temporary_path.c_str(), std::strerror(errno));
+    }
+
+    try {
+        // mkostemp creates the file readable by the owner only
+        if (::fchmod(fd, 0644) != 0) {
+            throw rcmp::error("%s", std::strerror(errno));
+        }
+
+        write_all(fd, &header, sizeof(header));
+        write_all(fd, entries.data(), entries.size() * sizeof(entry_t));
+        write_all(fd, keys.data(), keys.size());
+    }
+    catch (const rcmp::error& e) {
+        ::close(fd);
+        ::unlink(temporary_path.c_str());
+        throw rcmp::error("unable to save offset cache %s: %s", temporary_path.c_str(), e.what());
+    }
+
+    if (::close(fd) != 0 || ::rename(temporary_path.c_str(), m_path.c_str()) != 0) {
+        const int error = errno;
+        ::unlink(temporary_path.c_str());
+        throw rcmp::error("unable to save offset cache %s: %s", m_path.c_str(), std::strerror(error));
+    }
+
+    m_dirty = false;
+}
+
+#endif
@@ -0,0 +1,384 @@
+#include <rcmp/scan.hpp>
+#include <rcmp/detail/exception.hpp>
+
+#include "detail/platform/platform.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if RCMP_GET_ARCH() == RCMP_ARCH_X86 || RCMP_GET_ARCH() == RCMP_ARCH_X86_64
+    #define RCMP_DETAIL_SCAN_SIMD
+
+    #if RCMP_GET_COMPILER() == RCMP_COMPILER_MSVC
+        #include <intrin.h>
+        #define RCMP_DETAIL_SCAN_TARGET(features)
+    #else
+        #include <immintrin.h>
+        #define RCMP_DETAIL_SCAN_TARGET(features) __attribute__((target(features)))
+    #endif
+#endif
+
+namespace {
+
+// Segments are split into chunks, so a chunk stays in cache while every pattern is matched against it
+constexpr std::size_t g_chunk_size = 0x40000;
+
+struct pattern_t {
+    const std::uint8_t* bytes;
+    const std::uint8_t* mask;
+    std::size_t         size;
+    std::size_t         first; // offset of the first exact byte
+    std::size_t         last;  // offset of the last exact byte
+};
+
+pattern_t compile(const rcmp::byte_pattern& pattern) {
+    const auto mask = pattern.mask();
+    const auto size = pattern.size();
+
+    pattern_t result{ pattern.bytes(), mask, size, 0, size - 1 };
+    while (mask[result.first] == 0) {
+        result.first++;
+    }
+    while (mask[result.last] == 0) {
+        result.last--;
+    }
+
+    return result;
+}
+
+bool matches_scalar(const pattern_t& pattern, const std::uint8_t* data) {
+    for (std::size_t i = 0; i < pattern.size; i++) {
+        if ((data[i] & pattern.mask[i]) != pattern.bytes[i]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Appends matches starting in `[begin, end)`, `end - 1 + pattern.size` bytes must be readable.
+// memchr is vectorized by libc, so the first exact byte is found fast enough without SIMD as well.
+void scan_scalar(const pattern_t& pattern, const std::uint8_t* begin, const std::uint8_t* end, std::vector<std::uintptr_t>& matches) {
+    const std::uint8_t first = pattern.bytes[pattern.first];
+
+    for (auto position = begin; position < end; ) {
+        const auto found = static_cast<const std::uint8_t*>(std::memchr(position + pattern.first, first, end - position));
+        if (found == nullptr) {
+            break;
+        }
+
+        const auto candidate = found - pattern.first;
+        if (matches_scalar(pattern, candidate)) {
+            matches.push_back(reinterpret_cast<std::uintptr_t>(candidate));
+        }
+
+        position = candidate + 1;
+    }
+}
+
+#if defined(RCMP_DETAIL_SCAN_SIMD)
+
+unsigned count_trailing_zeros(std::uint32_t value) {
+#if RCMP_GET_COMPILER() == RCMP_COMPILER_MSVC
+    unsigned long index;
+    _BitScanForward(&index, value);
+    return index;
+#else
+    return __builtin_ctz(value);
+#endif
+}
+
+RCMP_DETAIL_SCAN_TARGET("sse2")
+bool matches_sse2(const pattern_t& pattern, const std::uint8_t* data) {
+    std::size_t i = 0;
+
+    for (; i + 16 <= pattern.size; i += 16) {
+        const __m128i value = _mm_and_si128(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i)),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(pattern.mask + i))
+        );
+        const __m128i expected = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pattern.bytes + i));
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(value, expected)) != 0xFFFF) {
+            return false;
+        }
+    }
+
+    for (; i < pattern.size; i++) {
+        if ((data[i] & pattern.mask[i]) != pattern.bytes[i]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// 16 positions at a time: candidates have both the first and the last exact bytes in place, the rest is compared then
+RCMP_DETAIL_SCAN_TARGET("sse2")
+void scan_sse2(const pattern_t& pattern, const std::uint8_t* begin, const std::uint8_t* end, std::vector<std::uintptr_t>& matches) {
+    const __m128i first = _mm_set1_epi8(static_cast<char>(pattern.bytes[pattern.first]));
+    const __m128i last  = _mm_set1_epi8(static_cast<char>(pattern.bytes[pattern.last]));
+
+    auto position = begin;
+    for (; end - position >= 16; position += 16) {
+        const __m128i first_block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(position + pattern.first));
+        const __m128i last_block  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(position + pattern.last));
+
+        auto candidates = static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first_block, first), _mm_cmpeq_epi8(last_block, last))));
+        for (; candidates != 0; candidates &= candidates - 1) {
+            const auto candidate = position + count_trailing_zeros(candidates);
+            if (matches_sse2(pattern, candidate)) {
+                matches.push_back(reinterpret_cast<std::uintptr_t>(candidate));
+            }
+        }
+    }
+
+    scan_scalar(pattern, position, end, matches);
+}
+
+// Same as `scan_sse2`, but 32 positions at a time
+RCMP_DETAIL_SCAN_TARGET("avx2")
+void scan_avx2(const pattern_t& pattern, const std::uint8_t* begin, const std::uint8_t* end, std::vector<std::uintptr_t>& matches) {
+    const __m256i first = _mm256_set1_epi8(static_cast<char>(pattern.bytes[pattern.first]));
+    const __m256i last  = _mm256_set1_epi8(static_cast<char>(pattern.bytes[pattern.last]));
+
+    auto position = begin;
+    for (; end - position >= 32; position += 32) {
+        const __m256i first_block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(position + pattern.first));
+        const __m256i last_block  = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(position + pattern.last));
+
+        auto candidates = static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(first_block, first), _mm256_cmpeq_epi8(last_block, last))));
+        for (; candidates != 0; candidates &= candidates - 1) {
+            const auto candidate = position + count_trailing_zeros(candidates);
+            if (matches_sse2(pattern, candidate)) {
+                matches.push_back(reinterpret_cast<std::uintptr_t>(candidate));
+            }
+        }
+    }
+
+    scan_sse2(pattern, position, end, matches);
+}
+
+#endif
+
+enum class kernel_t {
+    scalar,
+    sse2,
+    avx2,
+};
+
+kernel_t detect_kernel() {
+#if defined(RCMP_DETAIL_SCAN_SIMD)
+    #if RCMP_GET_COMPILER() == RCMP_COMPILER_MSVC
+        int info[4];
+        __cpuid(info, 0);
+        const int max_leaf = info[0];
+
+        __cpuid(info, 1);
+        const bool sse2    = (info[3] & (1 << 26)) != 0;
+        const bool osxsave = (info[2] & (1 << 27)) != 0;
+        const bool avx     = (info[2] & (1 << 28)) != 0;
+
+        // OS saves ymm registers on context switch
+        if (max_leaf >= 7 && osxsave && avx && (_xgetbv(0) & 6) == 6) {
+            __cpuidex(info, 7, 0);
+            if ((info[1] & (1 << 5)) != 0) {
+                return kernel_t::avx2;
+            }
+        }
+
+        if (sse2) {
+            return kernel_t::sse2;
+        }
+    #else
+        __builtin_cpu_init();
+
+        if (__builtin_cpu_supports("avx2")) {
+            return kernel_t::avx2;
+        }
+
+        if (__builtin_cpu_supports("sse2")) {
+            return kernel_t::sse2;
+        }
+    #endif
+#endif
+
+    return kernel_t::scalar;
+}
+
+void scan(const pattern_t& pattern, const std::uint8_t* begin, const std::uint8_t* end, std::vector<std::uintptr_t>& matches) {
+    static const kernel_t kernel = detect_kernel();
+
+    switch (kernel) {
+#if defined(RCMP_DETAIL_SCAN_SIMD)
+        case kernel_t::avx2: return scan_avx2(pattern, begin, end, matches);
+        case kernel_t::sse2: return scan_sse2(pattern, begin, end, matches);
+#endif
+        default:             return scan_scalar(pattern, begin, end, matches);
+    }
+}
+
+struct chunk_t {
+    std::uintptr_t begin;      // first position to match at
+    std::uintptr_t end;        // position after the last one
+    std::uintptr_t region_end; // matches can't cross it
+};
+
+std::vector<std::vector<rcmp::address_t>> scan_regions(const std::vector<rcmp::detail::platform::memory_region_t>& regions, const std::vector<pattern_t>& patterns) {
+    std::vector<chunk_t> chunks;
+    for (const auto& region : regions) {
+        for (std::uintptr_t begin = region.begin; begin < region.end; begin += (std::min)(g_chunk_size, region.end - begin)) {
+            chunks.push_back({ begin, begin + (std::min)(g_chunk_size, region.end - begin), region.end });
+        }
+    }
+
+    // (pattern index, address)
+    std::vector<std::vector<std::pair<std::size_t, std::uintptr_t>>> chunk_matches(chunks.size());
+
+    std::atomic<std::size_t> next_chunk{ 0 };
+    std::exception_ptr       error;
+    std::mutex               error_mutex;
+
+    const auto work = [&] {
+        try {
+            std::vector<std::uintptr_t> matches;
+
+            for (std::size_t i; (i = next_chunk++) < chunks.size(); ) {
+                const auto& chunk = chunks[i];
+
+                for (std::size_t j = 0; j < patterns.size(); j++) {
+                    const auto& pattern = patterns[j];
+                    if (chunk.region_end - chunk.begin < pattern.size) {
+                        continue;
+                    }
+
+                    const auto end = (std::min)(chunk.end, chunk.region_end - pattern.size + 1);
+
+                    matches.clear();
+                    scan(pattern, reinterpret_cast<const std::uint8_t*>(chunk.begin), reinterpret_cast<const std::uint8_t*>(end), matches);
+
+                    for (const auto match : matches) {
+                        chunk_matches[i].emplace_back(j, match);
+                    }
+                }
+            }
+        }
+        catch (...) {
+            std::lock_guard lock(error_mutex);
+            if (error == nullptr) {
+                error = std::current_exception();
+            }
+        }
+    };
+
+    // Current thread scans too
+    const std::size_t thread_count = (std::min)(static_cast<std::size_t>((std::max)(std::thread::hardware_concurrency(), 1u)), chunks.size());
+
+    std::vector<std::thread> threads;
+    for (std::size_t i = 1; i < thread_count; i++) {
+        try {
+            threads.emplace_back(work);
+        }
+        catch (const std::system_error&) {
+            // the rest is scanned by already started threads
+            break;
+        }
+    }
+
+    work();
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    if (error != nullptr) {
+        std::rethrow_exception(error);
+    }
+
+    // Chunks go in order of address, so matches of every pattern stay sorted
+    std::vector<std::vector<rcmp::address_t>> result(patterns.size());
+    for (const auto& matches : chunk_matches) {
+        for (const auto& [pattern, address] : matches) {
+            result[pattern].emplace_back(address);
+        }
+    }
+
+    return result;
+}
+
+int hex_digit(char c) {
+    if ('0' <= c && c <= '9') {
+        return c - '0';
+    }
+    if ('a' <= c && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if ('A' <= c && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+} // unnamed namespace
+
+rcmp::byte_pattern::byte_pattern(std::string_view signature) {
+    constexpr std::string_view whitespace = " \t\r\n";
+
+    for (std::size_t position = signature.find_first_not_of(whitespace); position != std::string_view::npos; ) {
+        const std::size_t token_end = (std::min)(signature.find_first_of(whitespace, position), signature.size());
+        const std::string_view token = signature.substr(position, token_end - position);
+
+        if (token == "?" || token == "??") {
+            m_bytes.push_back(0x00);
+            m_mask.push_back(0x00);
+        }
+        else if (token.size() == 2 && hex_digit(token[0]) >= 0 && hex_digit(token[1]) >= 0) {
+            m_bytes.push_back(static_cast<std::uint8_t>(hex_digit(token[0]) * 16 + hex_digit(token[1])));
+            m_mask.push_back(0xFF);
+        }
+        else {
+            throw rcmp::error("invalid byte pattern \"%s\", unexpected \"%s\"", std::string(signature).c_str(), std::string(token).c_str());
+        }
+
+        position = signature.find_first_not_of(whitespace, token_end);
+    }
+
+    if (std::find(m_mask.begin(), m_mask.end(), 0xFF) == m_mask.end()) {
+        throw rcmp::error("invalid byte pattern \"%s\", it has no exact bytes", std::string(signature).c_str());
+    }
+}
+
+std::vector<rcmp::address_t> rcmp::find_pattern(const byte_pattern& pattern, rcmp::address_t begin, std::size_t size) {
+    const std::vector<rcmp::detail::platform::memory_region_t> regions{ { begin.as_number(), begin.as_number() + size, 0 } };
+    return std::move(scan_regions(regions, { compile(pattern) }).front());
+}
+
+std::vector<rcmp::address_t> rcmp::find_pattern(const byte_pattern& pattern, const char* module) {
+    return std::move(scan_regions(rcmp::detail::platform::module_code_regions(module), { compile(pattern) }).front());
+}
+
+std::vector<std::vector<rcmp::address_t>> rcmp::find_patterns(const std::vector<byte_pattern>& patterns, const char* module) {
+    std::vector<pattern_t> compiled;
+    compiled.reserve(patterns.size());
+
+    for (const auto& pattern : patterns) {
+        compiled.push_back(compile(pattern));
+    }
+
+    return scan_regions(rcmp::detail::platform::module_code_regions(module), compiled);
+}
+
+rcmp::address_t rcmp::resolve_rel32(rcmp::address_t instruction, std::size_t operand_offset, std::size_t instruction_size) {
+    std::int32_t operand;
+    std::memcpy(&operand, (instruction + operand_offset).as_ptr(), sizeof(operand));
+
+    return instruction + instruction_size + operand;
+}
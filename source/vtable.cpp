@@ -0,0 +1,239 @@
+#include <rcmp/codegen.hpp>
+#include <rcmp/batch.hpp>
+#include <rcmp/memory.hpp>
+#include <rcmp/detail/exception.hpp>
+
+#include "detail/platform/platform.hpp"
+
+#if defined(RCMP_HAS_HOOK_VTABLE_CLONE_POLICY)
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <typeinfo>
+#include <utility>
+#include <vector>
+
+#if !defined(_MSC_VER)
+#include <cxxabi.h>
+#endif
+
+namespace {
+
+#if defined(_MSC_VER)
+// complete object locator
+constexpr std::size_t g_vtable_prefix = 1;
+#else
+// offset to top, type info. Classes with virtual bases keep vbase and vcall offsets before them too, those are rejected.
+constexpr std::size_t g_vtable_prefix = 2;
+#endif
+
+constexpr std::size_t g_max_vtable_methods = 0x1000;
+
+struct vtable_clone_t {
+    rcmp::address_t             original_vtable;
+    std::vector<std::uintptr_t> storage;        // prefix followed by methods, never executed
+    rcmp::address_t             vtable;         // points to the first method of `storage`
+    std::size_t                 method_count;
+    std::size_t                 hook_count = 0; // including queued installations and uninstallations
+};
+
+// Methods go one after another until the first entry that doesn't point to executable memory
+std::size_t count_methods(rcmp::address_t vtable) {
+    using namespace rcmp::detail;
+
+    const auto regions = platform::query_regions(0, (std::numeric_limits<std::uintptr_t>::max)());
+
+    const auto find_region = [&regions](rcmp::address_t address) -> const platform::memory_region_t* {
+        const auto it = std::upper_bound(regions.begin(), regions.end(), address.as_number(), [](std::uintptr_t value, const platform::memory_region_t& region) {
+            return value < region.end;
+        });
+
+        return it != regions.end() && it->begin <= address.as_number() ? &*it : nullptr;
+    };
+
+    const auto is_readable = [&find_region](rcmp::address_t address) {
+        const auto region = find_region(address);
+        return region != nullptr && address.as_number() + sizeof(void*) <= region->end;
+    };
+
+    if (!is_readable(vtable - g_vtable_prefix * sizeof(void*))) {
+        throw rcmp::error("unable to clone vtable %" PRIXPTR ", it's not readable", vtable.as_number());
+    }
+
+    std::size_t count = 0;
+    for (; count < g_max_vtable_methods; count++) {
+        const rcmp::address_t entry = vtable + count * sizeof(void*);
+        if (!is_readable(entry)) {
+            break;
+        }
+
+        const auto method = find_region(*entry.as_ptr<const std::uintptr_t>());
+        if (method == nullptr || !platform::is_executable(method->protection)) {
+            break;
+        }
+    }
+
+    return count;
+}
+
+#if !defined(_MSC_VER)
+bool has_virtual_bases(const std::type_info* type) {
+    if (const auto vmi = dynamic_cast<const abi::__vmi_class_type_info*>(type)) {
+        for (unsigned int i = 0; i < vmi->__base_count; i++) {
+            const auto& base = vmi->__base_info[i];
+            if ((base.__offset_flags & abi::__base_class_type_info::__virtual_mask) != 0 || has_virtual_bases(base.__base_type)) {
+                return true;
+            }
+        }
+    }
+    else if (const auto si = dynamic_cast<const abi::__si_class_type_info*>(type)) {
+        return has_virtual_bases(si->__base_type);
+    }
+
+    return false;
+}
+
+// Only offset to top and type info are copied, so the copy has to be the whole vtable prefix
+void check_vtable_prefix(rcmp::address_t object, rcmp::address_t vtable) {
+    const auto type = *(vtable - sizeof(void*)).as_ptr<const std::type_info* const>();
+
+    if (type == nullptr) {
+        throw rcmp::error("unable to clone vtable of object %" PRIXPTR ", it has no type info (built without RTTI)", object.as_number());
+    }
+
+    if (has_virtual_bases(type)) {
+        throw rcmp::error("unable to clone vtable of object %" PRIXPTR ", its class %s has virtual bases", object.as_number(), type->name());
+    }
+}
+#endif
+
+class vtable_clones {
+    std::mutex                                                 m_mutex;
+    std::map<rcmp::address_t, std::shared_ptr<vtable_clone_t>> m_clones; // by object
+
+    static std::shared_ptr<vtable_clone_t> make_clone(rcmp::address_t object) {
+        auto clone = std::make_shared<vtable_clone_t>();
+        rcmp::read_memory(object, &clone->original_vtable, sizeof(clone->original_vtable));
+
+        clone->method_count = count_methods(clone->original_vtable);
+
+#if !defined(_MSC_VER)
+        check_vtable_prefix(object, clone->original_vtable);
+#endif
+
+        if (clone->method_count == 0) {
+            throw rcmp::error("unable to clone vtable of object %" PRIXPTR ", it has no virtual methods", object.as_number());
+        }
+
+        clone->storage.resize(g_vtable_prefix + clone->method_count);
+        clone->vtable = rcmp::address_t(clone->storage.data() + g_vtable_prefix);
+
+        // RTTI (dynamic_cast, typeid) keeps working with the copy
+        std::memcpy(clone->storage.data(), (clone->original_vtable - g_vtable_prefix * sizeof(void*)).as_ptr(), clone->storage.size() * sizeof(void*));
+
+        return clone;
+    }
+
+public:
+    static vtable_clones& instance() {
+        // Never destroyed, see `hook_registry::instance`
+        static auto instance = new vtable_clones;
+        return *instance;
+    }
+
+    // Returns vtable copy of `object`, makes it if there's none yet. Called within a batch.
+    std::shared_ptr<vtable_clone_t> acquire(rcmp::address_t object) {
+        std::lock_guard lock(m_mutex);
+
+        auto& clone = m_clones[object];
+        if (clone == nullptr) {
+            try {
+                clone = make_clone(object);
+            }
+            catch (...) {
+                m_clones.erase(object);
+                throw;
+            }
+
+            rcmp::write_memory(object, &clone->vtable, sizeof(clone->vtable));
+
+            rcmp::hook_batch::current()->on_rollback([this, object, clone] {
+                std::lock_guard lock(m_mutex);
+
+                if (const auto it = m_clones.find(object); it != m_clones.end() && it->second == clone) {
+                    m_clones.erase(it);
+                }
+            });
+        }
+
+        clone->hook_count++;
+        rcmp::hook_batch::current()->on_rollback([this, clone] {
+            std::lock_guard lock(m_mutex);
+            clone->hook_count--;
+        });
+
+        return clone;
+    }
+
+    // Switches `object` back to its original vtable once the last hook is gone. Called within a batch.
+    void release(rcmp::address_t object, const std::shared_ptr<vtable_clone_t>& clone) {
+        std::lock_guard lock(m_mutex);
+
+        if (clone->hook_count == 1) {
+            rcmp::address_t vtable;
+            rcmp::read_memory(object, &vtable, sizeof(vtable));
+
+            if (vtable != clone->vtable) {
+                throw rcmp::error("unable to restore vtable of object %" PRIXPTR ", it's replaced by %" PRIXPTR, object.as_number(), vtable.as_number());
+            }
+
+            rcmp::write_memory(object, &clone->original_vtable, sizeof(clone->original_vtable));
+
+            // Copy itself is freed with the last record referring to it
+            rcmp::hook_batch::current()->on_commit([this, object, clone] {
+                std::lock_guard lock(m_mutex);
+
+                if (const auto it = m_clones.find(object); it != m_clones.end() && it->second == clone) {
+                    m_clones.erase(it);
+                }
+            });
+        }
+
+        clone->hook_count--;
+        rcmp::hook_batch::current()->on_rollback([this, clone] {
+            std::lock_guard lock(m_mutex);
+            clone->hook_count++;
+        });
+    }
+};
+
+} // unnamed namespace
+
+rcmp::address_t rcmp::detail::install_vtable_clone_hook(const vtable_slot_t& slot, rcmp::address_t wrapper_function, hook_record& record) {
+    rcmp::hook_batch batch;
+
+    const auto clone = vtable_clones::instance().acquire(slot.object);
+
+    if (slot.index >= clone->method_count) {
+        throw rcmp::error("unable to hook method %zu of object %" PRIXPTR ", its vtable has %zu methods", slot.index, slot.object.as_number(), clone->method_count);
+    }
+
+    // The copy is writable already, otherwise it's the same as hooking vtable slot in place
+    const auto original_function = HookIndirectStatelessPolicy::install_stateless_hook(clone->vtable + slot.index * sizeof(void*), wrapper_function, record);
+
+    record.unpatch = [unpatch_slot = std::move(record.unpatch), object = slot.object, clone] {
+        unpatch_slot();
+        vtable_clones::instance().release(object, clone);
+    };
+
+    batch.commit();
+
+    return original_function;
+}
+
+#endif
@@ -0,0 +1,226 @@
+#include "catch2/catch.hpp"
+
+#include <rcmp.hpp>
+
+#if defined(RCMP_HAS_ELF)
+
+#include <dlfcn.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+TEST_CASE("Import slots") {
+    // bind lazily bound import
+    const auto pid = ::getpid();
+    REQUIRE(pid > 0);
+
+    const auto slots = rcmp::find_import_slots("getpid", "");
+    REQUIRE_FALSE(slots.empty());
+    CHECK(std::is_sorted(slots.begin(), slots.end()));
+
+    const auto all_slots = rcmp::find_import_slots("getpid");
+    CHECK(all_slots.size() >= slots.size());
+
+    CHECK(rcmp::find_import_slots("getpid", "no-such-module.so").empty());
+    CHECK(rcmp::find_import_slots("no_such_symbol_in_any_module").empty());
+
+    // variable imported through GOT by every binary with polymorphic classes
+    CHECK(rcmp::find_import_slots("_ZTVN10__cxxabiv117__class_type_infoE", "").empty());
+}
+
+TEST_CASE("Import hook") {
+    const auto pid = ::getpid();
+
+    {
+        auto handle = rcmp::hook_import_scoped<pid_t()>("", "getpid", [](auto original) {
+            return original() + 1;
+        });
+
+        CHECK(::getpid() == pid + 1);
+
+        handle.disable();
+        CHECK(::getpid() == pid);
+
+        handle.enable();
+        CHECK(::getpid() == pid + 1);
+
+        // imports of the same symbol are chained
+        const auto inner = rcmp::hook_import_scoped<pid_t()>("getpid", [](auto original) {
+            return original() * 2;
+        });
+        CHECK(::getpid() == (pid + 1) * 2);
+
+        CHECK_THROWS_WITH(handle.uninstall(), Catch::Contains("overridden by another hook"));
+    }
+
+    CHECK(::getpid() == pid);
+
+    CHECK_THROWS_WITH((rcmp::hook_import<pid_t()>("no-such-module.so", "getpid", [](auto original) {
+        return original();
+    })), Catch::Contains("no module imports it"));
+}
+
+namespace {
+
+int cached_function(int arg) {
+    return arg + 1;
+}
+
+} // unnamed namespace
+
+// Local symbol with unmangled name, it's not exported.
+// GCC would call its `.constprop` clone otherwise, that isn't affected by hooking the symbol.
+#if RCMP_GET_COMPILER() == RCMP_COMPILER_GCC
+    #define RCMP_TEST_NO_CLONE [[gnu::noipa]]
+#else
+    #define RCMP_TEST_NO_CLONE [[gnu::noinline, clang::optnone]]
+#endif
+
+extern "C" {
+    RCMP_TEST_NO_CLONE static int rcmp_local_symbol(int arg) {
+        return arg * 2 + 1;
+    }
+}
+
+TEST_CASE("Module build-id") {
+    CHECK(rcmp::module_load_bias("") == rcmp::module_load_bias(""));
+    CHECK_THROWS_WITH(rcmp::module_load_bias("no-such-module.so"), Catch::Contains("is not loaded"));
+    CHECK_THROWS_WITH(rcmp::module_build_id("no-such-module.so"), Catch::Contains("is not loaded"));
+}
+
+TEST_CASE("Offset cache") {
+    if (rcmp::module_build_id("").empty()) {
+        WARN("test executable is linked without build-id");
+        return;
+    }
+
+    const std::string path = "rcmp-offset-cache-" + std::to_string(::getpid()) + ".bin";
+    const rcmp::address_t function = rcmp::bit_cast<const void*>(&cached_function);
+
+    int resolved = 0;
+    const auto resolver = [&resolved, function] {
+        resolved++;
+        return function;
+    };
+
+    {
+        rcmp::offset_cache cache(path, "");
+        CHECK_FALSE(cache.loaded());
+
+        CHECK(cache.resolve("cached_function", resolver) == function);
+        CHECK(cache.resolve("cached_function", resolver) == function);
+        CHECK(resolved == 1);
+
+        cache.insert("other", function + 0x10);
+        cache.save();
+    }
+
+    {
+        // the next run resolves nothing
+        rcmp::offset_cache cache(path, "");
+        CHECK(cache.loaded());
+
+        CHECK(cache.resolve("cached_function", resolver) == function);
+        CHECK(cache.find("other") == function + 0x10);
+        CHECK(cache.find("missing") == std::nullopt);
+        CHECK(resolved == 1);
+
+        // saved entries are kept
+        cache.insert("another", function + 0x20);
+        cache.save();
+    }
+
+    {
+        rcmp::offset_cache cache(path, "");
+        CHECK(cache.find("cached_function") == function);
+        CHECK(cache.find("other") == function + 0x10);
+        CHECK(cache.find("another") == function + 0x20);
+    }
+
+    {
+        // concurrent saves of caches opened before any of them, none of the entries is lost
+        std::vector<std::unique_ptr<rcmp::offset_cache>> caches;
+        for (std::ptrdiff_t i = 0; i < 4; i++) {
+            caches.push_back(std::make_unique<rcmp::offset_cache>(path, ""));
+            caches.back()->insert("thread" + std::to_string(i), function + i);
+        }
+
+        std::vector<std::thread> threads;
+        for (auto& cache : caches) {
+            threads.emplace_back([&cache] { cache->save(); });
+        }
+
+        for (auto& thread : threads) {
+            thread.join();
+        }
+
+        rcmp::offset_cache cache(path, "");
+        CHECK(cache.find("another") == function + 0x20);
+
+        for (std::ptrdiff_t i = 0; i < 4; i++) {
+            CHECK(cache.find("thread" + std::to_string(i)) == function + i);
+        }
+    }
+
+    {
+        // as if the module is rebuilt: build-id follows magic, version and build-id size
+        std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp(16);
+        file.put(static_cast<char>(~rcmp::module_build_id("")[0]));
+    }
+
+    {
+        rcmp::offset_cache cache(path, "");
+        CHECK_FALSE(cache.loaded());
+        CHECK(cache.find("cached_function") == std::nullopt);
+    }
+
+    std::remove(path.c_str());
+    std::remove((path + ".lock").c_str());
+}
+
+TEST_CASE("Symbol lookup") {
+    const rcmp::address_t local = rcmp::bit_cast<const void*>(&rcmp_local_symbol);
+
+    CHECK(rcmp::find_symbol("", "rcmp_local_symbol") == local);
+    CHECK(rcmp::find_symbol(nullptr, "rcmp_local_symbol") == local);
+    CHECK(rcmp::find_symbol("", "no_such_symbol_in_any_module") == nullptr);
+
+    // exported function, the default version as with dlsym
+    CHECK(rcmp::find_symbol(nullptr, "getpid") == ::dlsym(RTLD_DEFAULT, "getpid"));
+
+    // indirect function, the implementation picked by its resolver
+    CHECK(rcmp::find_symbol(nullptr, "memcpy") == ::dlsym(RTLD_DEFAULT, "memcpy"));
+    CHECK(rcmp::find_symbol(nullptr, "memcpy") != nullptr);
+
+    // imported only, not defined by the main executable
+    CHECK(rcmp::find_symbol("", "getpid") == nullptr);
+
+    CHECK_THROWS_WITH(rcmp::find_symbol("no-such-module.so", "getpid"), Catch::Contains("is not loaded"));
+}
+
+TEST_CASE("Hook by symbol") {
+    REQUIRE(rcmp_local_symbol(10) == 21);
+
+    {
+        auto handle = rcmp::hook_function_scoped<int(*)(int)>("", "rcmp_local_symbol", [](auto original, int arg) {
+            return original(arg) * 10;
+        });
+
+        CHECK(rcmp_local_symbol(10) == 210);
+    }
+
+    CHECK(rcmp_local_symbol(10) == 21);
+
+    CHECK_THROWS_WITH((rcmp::hook_function<int(*)(int)>("", "no_such_symbol_in_any_module", [](auto original, int arg) {
+        return original(arg);
+    })), Catch::Contains("no such symbol"));
+}
+
+#endif
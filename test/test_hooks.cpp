@@ -2,7 +2,18 @@
 
 #include <rcmp.hpp>
 
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <typeinfo>
+#include <vector>
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 
 // TODO:
 //  Compiler inserts `call __x86_get_pc_thunk_ax` in function prolog, that works incorrectly after relocating.
@@ -23,9 +34,6 @@ int sum(int a, int b) {
 }
 static_assert(std::is_same_v<decltype(&sum), int(*)(int, int)>);
 
-// TODO: remove 'if' when jmp relocation is ready
-#if RCMP_GET_ARCH() == RCMP_ARCH_X86
-
 NO_OPTIMIZE int bar(float arg) {
     return static_cast<int>(arg) + 5;
 }
@@ -40,8 +48,6 @@ TEST_CASE("Simplest hook") {
     REQUIRE(bar(5.1f) == 16);
 }
 
-#endif // RCMP_GET_ARCH() == RCMP_ARCH_X86
-
 NO_OPTIMIZE int foo(int arg) {
     return arg + 1;
 }
@@ -279,6 +285,116 @@ TEST_CASE("vtable hooking") {
     REQUIRE(call_f(av, 10) == 32);
 }
 
+#if defined(RCMP_HAS_VIRTUAL_METHOD_INDEX)
+
+struct Shape {
+    int scale = 2;
+
+    virtual ~Shape() = default;
+
+    NO_OPTIMIZE
+    virtual int area(int size) const {
+        return size * size * scale;
+    }
+
+    NO_OPTIMIZE
+    virtual int perimeter(int size) const {
+        return 4 * size * scale;
+    }
+
+    NO_OPTIMIZE
+    virtual int corners(int) const {
+        return 4;
+    }
+
+    int non_virtual(int size) const {
+        return size;
+    }
+};
+
+struct Triangle : Shape {
+    NO_OPTIMIZE
+    int corners(int) const override {
+        return 3;
+    }
+};
+
+struct Labeled {
+    virtual ~Labeled() = default;
+
+    virtual int label() const {
+        return 1;
+    }
+};
+
+// `Labeled` methods are in the secondary vtable
+struct LabeledShape : Shape, Labeled {};
+
+// prevent devirtualization
+NO_OPTIMIZE
+int call_shape(const Shape& shape, int size) {
+    return shape.area(size) + shape.perimeter(size) + shape.corners(size);
+}
+
+TEST_CASE("Virtual method hook by pointer to member") {
+    // virtual destructor takes two slots
+    CHECK(rcmp::virtual_method_index(&Shape::area) == 2);
+    CHECK(rcmp::virtual_method_index(&Shape::perimeter) == 3);
+    CHECK(rcmp::virtual_method_index(&Triangle::corners) == 4);
+    CHECK_THROWS_WITH(rcmp::virtual_method_index(&Shape::non_virtual), Catch::Contains("not virtual"));
+    CHECK(rcmp::virtual_method_index(&Labeled::label) == 2);
+    CHECK_THROWS_WITH(rcmp::virtual_method_index(static_cast<int (LabeledShape::*)() const>(&Labeled::label)), Catch::Contains("belongs to the base"));
+
+    Shape square;
+    Triangle triangle;
+
+    REQUIRE(call_shape(square, 3) == 18 + 24 + 4);
+    REQUIRE(call_shape(triangle, 3) == 18 + 24 + 3);
+
+    {
+        // one hook for methods of different classes (`const Shape*` and `const Triangle*`)
+        auto hooks = rcmp::hook_virtual_methods_scoped<&Shape::area, &Shape::perimeter, &Triangle::corners>(rcmp::vtable_of(&triangle), [](auto original, auto self, int size) {
+            return original(self, size) * 10;
+        });
+
+        CHECK(call_shape(triangle, 3) == 180 + 240 + 30);
+        CHECK(call_shape(square, 3) == 18 + 24 + 4);
+
+        hooks[1].disable();
+        CHECK(call_shape(triangle, 3) == 180 + 24 + 30);
+    }
+
+    CHECK(call_shape(triangle, 3) == 18 + 24 + 3);
+
+    // nothing is hooked if any method fails
+    CHECK_THROWS_WITH((rcmp::hook_virtual_methods<&Shape::area, &Shape::non_virtual>(rcmp::vtable_of(&square), [](auto original, auto self, int size) {
+        return original(self, size) + 1;
+    })), Catch::Contains("not virtual"));
+    CHECK(call_shape(square, 3) == 18 + 24 + 4);
+
+    {
+        auto hook = rcmp::hook_virtual_method_scoped<&Shape::corners>(rcmp::vtable_of(&square), [](auto original, auto self, int size) {
+            return original(self, size) + 100;
+        });
+
+        CHECK(call_shape(square, 3) == 18 + 24 + 104);
+        CHECK(call_shape(triangle, 3) == 18 + 24 + 3);
+    }
+
+    {
+        auto hook = rcmp::hook_instance_method_scoped<&Shape::area>(&square, [](auto original, auto self, int size) {
+            return -original(self, size);
+        });
+
+        CHECK(call_shape(square, 3) == -18 + 24 + 4);
+        CHECK(call_shape(Shape(), 3) == 18 + 24 + 4);
+    }
+
+    CHECK(call_shape(square, 3) == 18 + 24 + 4);
+}
+
+#endif
+
 NO_OPTIMIZE
 int f3(int arg) {
     return arg;
@@ -349,7 +465,13 @@ float f5(int a, float b, X x) {
     return a + b * 2 + (x.arr[0] + x.arr[99]) * 3;
 }
 
-#if RCMP_GET_ARCH() == RCMP_ARCH_X86
+#if RCMP_GET_ARCH() == RCMP_ARCH_X86 || RCMP_GET_ARCH() == RCMP_ARCH_X86_64
+#if RCMP_GET_ARCH() == RCMP_ARCH_X86 && RCMP_GET_COMPILER() != RCMP_COMPILER_MSVC
+// stub passes state in eax, no thread-local round trip
+static_assert(rcmp::detail::has_state_register_wrapper_v<rcmp::to_generic_signature<decltype(&f5)>>);
+static_assert(!rcmp::detail::has_state_register_wrapper_v<rcmp::to_generic_signature<X(*)(int)>>);
+#endif
+
 TEST_CASE("Hooks with tls-state") {
     X x{};
     x.arr[0] = x.arr[99] = 1;
@@ -363,4 +485,1059 @@ TEST_CASE("Hooks with tls-state") {
         REQUIRE(f5(100, 20.f, x) == 146 + i);
     }
 }
+
+NO_OPTIMIZE
+double mix1(int a, double b, int c, double d, int e, double f, int g, double h) {
+    return a + b + c + d + e + f + g + h;
+}
+
+NO_OPTIMIZE
+double mix2(int a, double b, int c, double d, int e, double f, int g, double h) {
+    return a * b + c * d + e * f + g * h;
+}
+
+using mix_t = double(*)(int, double, int, double, int, double, int, double);
+
+// Same instantiation for every address, the hook is told apart by its captured state only
+rcmp::hook_handle hook_mix(mix_t function, double offset) {
+    return rcmp::hook_function_stateless_scoped<mix_t>(rcmp::bit_cast<const void*>(function), [offset](auto original, auto... args) {
+        return original(args...) + offset;
+    });
+}
+
+TEST_CASE("Scoped hooks with tls-state") {
+    REQUIRE(mix1(1, 2.5, 3, 4.5, 5, 6.5, 7, 8.5) == 38.0);
+    REQUIRE(mix2(1, 2.5, 3, 4.5, 5, 6.5, 7, 8.5) == 108.0);
+
+    {
+        const auto first  = hook_mix(mix1, 100.0);
+        const auto second = hook_mix(mix2, 1000.0);
+
+        // every argument register survives the state stub
+        CHECK(mix1(1, 2.5, 3, 4.5, 5, 6.5, 7, 8.5) == 138.0);
+        CHECK(mix2(1, 2.5, 3, 4.5, 5, 6.5, 7, 8.5) == 1108.0);
+
+        const auto third = hook_mix(mix1, 10.0);
+        CHECK(mix1(1, 2.5, 3, 4.5, 5, 6.5, 7, 8.5) == 148.0);
+    }
+
+    CHECK(mix1(1, 2.5, 3, 4.5, 5, 6.5, 7, 8.5) == 38.0);
+    CHECK(mix2(1, 2.5, 3, 4.5, 5, 6.5, 7, 8.5) == 108.0);
+}
+#endif
+
+#if RCMP_GET_ARCH() == RCMP_ARCH_X86_64
+TEST_CASE("Hook function far from wrapper") {
+    // Memory near an address 64GB below the test binary, so the wrapper is out of rel32 reach
+    const rcmp::address_t binary = rcmp::bit_cast<const void*>(&mix1);
+    auto far_function = rcmp::allocate_code(16, binary - (std::ptrdiff_t{ 64 } << 30));
+
+    // distance doesn't fit in 32 bits
+    REQUIRE(std::abs(rcmp::address_t(far_function.get()) - binary) > std::ptrdiff_t{ 0xFFFFFFFF });
+
+    const std::array<std::uint8_t, 9> code = {{
+        0x55,                 // push rbp
+        0x48, 0x89, 0xE5,     // mov rbp, rsp
+#if RCMP_GET_PLATFORM() == RCMP_PLATFORM_WIN
+        0x8D, 0x41, 0x01,     // lea eax, [rcx + 1]
+#else
+        0x8D, 0x47, 0x01,     // lea eax, [rdi + 1]
+#endif
+        0x5D,                 // pop rbp
+        0xC3,                 // ret
+    }};
+    std::memcpy(far_function.get(), code.data(), code.size());
+
+    const auto f = rcmp::bit_cast<int(*)(int)>(far_function.get());
+    REQUIRE(f(1) == 2);
+
+    {
+        auto handle = rcmp::hook_function_scoped<int(int)>(far_function.get(), [](auto original, int arg) {
+            return original(arg) * 10;
+        });
+
+        CHECK(f(1) == 20);
+    }
+
+    // the function is released after the hook is uninstalled
+    CHECK(std::memcmp(far_function.get(), code.data(), code.size()) == 0);
+    CHECK(f(1) == 2);
+}
+#endif
+
+#if RCMP_GET_ARCH() == RCMP_ARCH_X86_64
+std::int64_t g_rip_target = 42;
+
+TEST_CASE("Hook function with rip-relative prolog") {
+    // Place functions near `g_rip_target`, so it can be addressed with [rip + disp32]
+    auto code = rcmp::allocate_code(32, &g_rip_target);
+
+    const auto emit = [&code](std::size_t offset, std::array<std::uint8_t, 3> opcode) {
+        const rcmp::address_t instruction = code.get() + offset;
+        const std::int32_t disp = static_cast<std::int32_t>(rcmp::address_t(&g_rip_target) - (instruction + 7));
+
+        std::memcpy(instruction.as_ptr(), opcode.data(), opcode.size());
+        std::memcpy((instruction + 3).as_ptr(), &disp, sizeof(disp));
+        (instruction + 7).as_ptr<std::uint8_t>()[0] = 0xC3; // ret
+
+        return rcmp::bit_cast<std::int64_t(*)()>(instruction);
+    };
+
+    const auto load = emit(0, {{ 0x48, 0x8B, 0x05 }});  // mov rax, [rip + X]
+    const auto lea  = emit(16, {{ 0x48, 0x8D, 0x05 }}); // lea rax, [rip + X]
+
+    REQUIRE(load() == 42);
+    REQUIRE(lea() == rcmp::bit_cast<std::int64_t>(&g_rip_target));
+
+    std::array<std::byte, 32> original_code;
+    std::memcpy(original_code.data(), code.get(), original_code.size());
+
+    {
+        auto load_hook = rcmp::hook_function_scoped<std::int64_t()>(rcmp::bit_cast<const void*>(load), [](auto original) {
+            return original() + 1;
+        });
+
+        auto lea_hook = rcmp::hook_function_scoped<std::int64_t()>(rcmp::bit_cast<const void*>(lea), [](auto original) {
+            return original() + 1;
+        });
+
+        CHECK(load() == 43);
+        CHECK(lea() == rcmp::bit_cast<std::int64_t>(&g_rip_target) + 1);
+
+        g_rip_target = 100;
+        CHECK(load() == 101);
+    }
+
+    CHECK(std::memcmp(code.get(), original_code.data(), original_code.size()) == 0);
+    CHECK(load() == 100);
+    CHECK(lea() == rcmp::bit_cast<std::int64_t>(&g_rip_target));
+    g_rip_target = 42;
+}
+#endif
+
+TEST_CASE("Hook function with branch inside prolog") {
+    auto code = rcmp::allocate_code(32);
+
+    const std::array<std::uint8_t, 8> jump_over = {{
+        0xEB, 0x01, // jmp +1
+        0xCC,       // int3
+        0x31, 0xC0, // xor eax, eax
+        0xFF, 0xC0, // inc eax
+        0xC3,       // ret
+    }};
+
+    const std::array<std::uint8_t, 8> jump_inside = {{
+        0xEB, 0x02, // jmp +2, to the middle of `xor eax, eax`
+        0xCC,       // int3
+        0x31, 0xC0, // xor eax, eax
+        0xFF, 0xC0, // inc eax
+        0xC3,       // ret
+    }};
+
+    std::memcpy(code.get(), jump_over.data(), jump_over.size());
+    std::memcpy(code.get() + 16, jump_inside.data(), jump_inside.size());
+
+    const auto f = rcmp::bit_cast<int(*)()>(code.get());
+    REQUIRE(f() == 1);
+
+    std::array<std::byte, 32> original_code;
+    std::memcpy(original_code.data(), code.get(), original_code.size());
+
+    {
+        // the relocated branch must still skip `int3`
+        auto handle = rcmp::hook_function_scoped<int()>(code.get(), [](auto original) {
+            return original() + 10;
+        });
+
+        CHECK(f() == 11);
+
+        CHECK_THROWS_AS((rcmp::hook_function_scoped<int()>(code.get() + 16, [](auto original) {
+            return original();
+        })), rcmp::error);
+    }
+
+    CHECK(std::memcmp(code.get(), original_code.data(), original_code.size()) == 0);
+    CHECK(f() == 1);
+}
+
+NO_OPTIMIZE
+int f6(int arg) {
+    return arg + 6;
+}
+
+NO_OPTIMIZE
+int f7(int arg) {
+    return arg + 7;
+}
+
+TEST_CASE("Hook batch") {
+    REQUIRE(f6(1) == 7);
+    REQUIRE(f7(1) == 8);
+
+    {
+        rcmp::hook_batch batch;
+
+        rcmp::hook_function<class F6Tag, decltype(f6)>(rcmp::bit_cast<const void*>(f6), [](auto original, int arg) {
+            return original(arg) * 10;
+        });
+
+        // hooks of the same function are chained even if the first one is not written yet
+        rcmp::hook_function<class F6Tag2, decltype(f6)>(rcmp::bit_cast<const void*>(f6), [](auto original, int arg) {
+            return original(arg) + 1;
+        });
+
+        rcmp::hook_function<class F7Tag, decltype(f7)>(rcmp::bit_cast<const void*>(f7), [](auto original, int arg) {
+            return original(arg) * 10;
+        });
+
+        // nothing is patched before commit
+        CHECK(f6(1) == 7);
+        CHECK(f7(1) == 8);
+
+        batch.commit();
+    }
+
+    CHECK(f6(1) == 71);
+    CHECK(f7(1) == 80);
+}
+
+NO_OPTIMIZE
+int f8(int arg) {
+    return arg + 8;
+}
+
+TEST_CASE("Hook batch rollback") {
+    REQUIRE(f8(1) == 9);
+
+    const auto install = [] {
+        rcmp::hook_function<class F8Tag, decltype(f8)>(rcmp::bit_cast<const void*>(f8), [](auto original, int arg) {
+            return original(arg) * 10;
+        });
+    };
+
+    {
+        rcmp::hook_batch batch;
+        install();
+
+        // destroyed without commit
+    }
+
+    CHECK(f8(1) == 9);
+
+    // state of rolled back hook is released, so the same tag can be used again
+    install();
+    CHECK(f8(1) == 90);
+}
+
+NO_OPTIMIZE
+int f9(int arg) {
+    return arg + 9;
+}
+
+TEST_CASE("Scoped hook") {
+    REQUIRE(f9(1) == 10);
+
+    const auto install = [](int multiplier) {
+        return rcmp::hook_function_scoped<class F9Tag, decltype(f9)>(rcmp::bit_cast<const void*>(f9), [multiplier](auto original, int arg) {
+            return original(arg) * multiplier;
+        });
+    };
+
+    for (int i = 2; i < 5; i++) {
+        const auto handle = install(i);
+        CHECK(handle.installed());
+        CHECK(f9(1) == 10 * i);
+    }
+
+    CHECK(f9(1) == 10);
+
+    auto outer = install(2);
+    auto inner = rcmp::hook_function_scoped<decltype(f9)>(rcmp::bit_cast<const void*>(f9), [](auto original, int arg) {
+        return original(arg) + 1;
+    });
+    CHECK(f9(1) == 21);
+
+    rcmp::hook_handle moved = std::move(outer);
+    CHECK(f9(1) == 21);
+
+    // function hooks may be uninstalled in any order
+    moved.uninstall();
+    CHECK_FALSE(moved.installed());
+    CHECK(f9(1) == 11);
+
+    inner = rcmp::hook_handle();
+    CHECK(f9(1) == 10);
+}
+
+NO_OPTIMIZE
+int f13(int arg) {
+    return arg + 13;
+}
+
+TEST_CASE("Captureless hook") {
+    REQUIRE(f13(1) == 14);
+
+    const auto hook = [](auto original, int arg) {
+        return original(arg) * 2;
+    };
+    static_assert(rcmp::detail::is_empty_hook_v<decltype(hook)>);
+    static_assert(!rcmp::detail::is_empty_hook_v<std::function<int(int(*)(int), int)>>);
+
+    for (int i = 0; i < 2; i++) {
+        const auto handle = rcmp::hook_function_scoped<class F13Tag, decltype(f13)>(rcmp::bit_cast<const void*>(f13), hook);
+        CHECK(f13(1) == 28);
+    }
+
+    CHECK(f13(1) == 14);
+}
+
+NO_OPTIMIZE
+int f12(int arg) {
+    return arg + 12;
+}
+
+TEST_CASE("Hooks of the same function share entry jump") {
+    REQUIRE(f12(1) == 13);
+
+    std::array<std::uint8_t, 16> first_patch{};
+    std::array<std::uint8_t, 16> last_patch{};
+
+    auto first = rcmp::hook_function_scoped<class F12Tag1, decltype(f12)>(rcmp::bit_cast<const void*>(f12), [](auto original, int arg) {
+        return original(arg) * 2;
+    });
+    std::memcpy(first_patch.data(), rcmp::bit_cast<const void*>(f12), first_patch.size());
+
+    auto second = rcmp::hook_function_scoped<class F12Tag2, decltype(f12)>(rcmp::bit_cast<const void*>(f12), [](auto original, int arg) {
+        return original(arg) + 1;
+    });
+
+    auto third = rcmp::hook_function_scoped<class F12Tag3, decltype(f12)>(rcmp::bit_cast<const void*>(f12), [](auto original, int arg) {
+        return original(arg) * 3;
+    });
+    std::memcpy(last_patch.data(), rcmp::bit_cast<const void*>(f12), last_patch.size());
+
+    // prolog is patched only once
+    CHECK(first_patch == last_patch);
+    CHECK(f12(1) == 81);
+
+    // removing the middle hook relinks its neighbours
+    second.uninstall();
+    CHECK(f12(1) == 78);
+
+    third.uninstall();
+    CHECK(f12(1) == 26);
+
+    first.uninstall();
+    CHECK(f12(1) == 13);
+}
+
+NO_OPTIMIZE
+int f14(int arg) {
+    return arg + 14;
+}
+
+TEST_CASE("Disable and enable hook") {
+    REQUIRE(f14(1) == 15);
+
+    std::array<std::uint8_t, 16> original_bytes{};
+    std::memcpy(original_bytes.data(), rcmp::bit_cast<const void*>(f14), original_bytes.size());
+
+    const auto current_bytes = [] {
+        std::array<std::uint8_t, 16> bytes{};
+        std::memcpy(bytes.data(), rcmp::bit_cast<const void*>(f14), bytes.size());
+        return bytes;
+    };
+
+    auto first = rcmp::hook_function_scoped<class F14Tag1, decltype(f14)>(rcmp::bit_cast<const void*>(f14), [](auto original, int arg) {
+        return original(arg) * 2;
+    });
+
+    auto second = rcmp::hook_function_scoped<class F14Tag2, decltype(f14)>(rcmp::bit_cast<const void*>(f14), [](auto original, int arg) {
+        return original(arg) + 1;
+    });
+
+    CHECK(first.enabled());
+    CHECK(f14(1) == 31);
+
+    first.disable();
+    CHECK_FALSE(first.enabled());
+    CHECK(f14(1) == 16);
+
+    // disabled twice is still disabled
+    first.disable();
+    CHECK(f14(1) == 16);
+
+    // with all hooks disabled function runs its own code
+    second.disable();
+    CHECK(f14(1) == 15);
+    CHECK(current_bytes() == original_bytes);
+
+    first.enable();
+    CHECK(current_bytes() != original_bytes);
+    CHECK(f14(1) == 30);
+
+    second.enable();
+    CHECK(f14(1) == 31);
+
+    {
+        rcmp::hook_batch batch;
+        first.disable();
+        second.disable();
+    }
+    CHECK(first.enabled());
+    CHECK(second.enabled());
+    CHECK(f14(1) == 31);
+
+    // disabled hook may be uninstalled
+    second.disable();
+    second.uninstall();
+    CHECK_THROWS_AS(second.enable(), rcmp::error);
+    CHECK(f14(1) == 30);
+
+    first.disable();
+    first.uninstall();
+    CHECK(f14(1) == 15);
+    CHECK(current_bytes() == original_bytes);
+}
+
+NO_OPTIMIZE
+int f15(int arg) {
+    return arg + 15;
+}
+
+TEST_CASE("Replace hook callable") {
+    REQUIRE(f15(1) == 16);
+
+    // zeroed on destruction, so calls of destroyed callables are noticed
+    struct multiplier_t {
+        int value;
+        ~multiplier_t() { value = 0; }
+    };
+
+    // if `stage` is given, the call reports it's running (1) and waits for permission to continue (2)
+    const auto make_hook = [](int multiplier, std::atomic<int>* stage = nullptr) {
+        return [multiplier = multiplier_t{ multiplier }, stage](auto original, int arg) {
+            if (stage != nullptr) {
+                *stage = 1;
+                while (*stage != 2) {
+                    std::this_thread::yield();
+                }
+            }
+
+            return original(arg) * multiplier.value;
+        };
+    };
+
+    auto handle = rcmp::hook_function_scoped<class F15Tag, decltype(f15)>(rcmp::bit_cast<const void*>(f15), make_hook(2));
+    CHECK(f15(1) == 32);
+
+    handle.replace(make_hook(3));
+    CHECK(f15(1) == 48);
+
+    CHECK_THROWS_AS(handle.replace([](auto original, int arg) { return original(arg); }), rcmp::error);
+    CHECK(f15(1) == 48);
+
+    // callable running on another thread survives its replacement and reclamation
+    std::atomic<int> stage = 0;
+    handle.replace(make_hook(2, &stage));
+
+    int blocked_result = 0;
+    std::thread blocked_caller([&blocked_result] { blocked_result = f15(1); });
+
+    while (stage != 1) {
+        std::this_thread::yield();
+    }
+
+    handle.replace(make_hook(3));
+    handle.reclaim();
+    stage = 2;
+    blocked_caller.join();
+
+    CHECK(blocked_result == 32);
+    CHECK(f15(1) == 48);
+
+    std::atomic<bool> stop = false;
+    std::atomic<int>  unexpected_results = 0;
+
+    std::thread caller([&stop, &unexpected_results] {
+        while (!stop) {
+            const int result = f15(1);
+            if (result % 16 != 0 || result < 16 * 3 || result > 16 * 1000) {
+                unexpected_results++;
+            }
+        }
+    });
+
+    // replacements race each other and reclamation, while callables are running
+    std::thread replacer([&handle, &make_hook] {
+        for (int i = 500; i <= 999; i++) {
+            handle.replace(make_hook(i));
+        }
+    });
+
+    for (int i = 4; i <= 500; i++) {
+        handle.replace(make_hook(i));
+        handle.reclaim();
+    }
+
+    replacer.join();
+    handle.replace(make_hook(1000));
+    handle.reclaim();
+
+    stop = true;
+    caller.join();
+
+    CHECK(unexpected_results == 0);
+    CHECK(f15(1) == 16000);
+
+    handle.reclaim();
+    CHECK(f15(1) == 16000);
+
+    handle.uninstall();
+    CHECK(f15(1) == 16);
+    CHECK_THROWS_AS(handle.replace(make_hook(2)), rcmp::error);
+}
+
+NO_OPTIMIZE
+int f16(int arg) {
+    return arg + 16;
+}
+
+TEST_CASE("Hook registry") {
+    const rcmp::address_t function = rcmp::bit_cast<const void*>(f16);
+
+    REQUIRE(f16(1) == 17);
+    CHECK_FALSE(rcmp::find_hooked_function(function).has_value());
+    CHECK(rcmp::get_original(function) == nullptr);
+    CHECK_THROWS_AS(rcmp::call_original<decltype(f16)>(function, 1), rcmp::error);
+
+    const auto functions_before = rcmp::hooked_function_count();
+    const auto hooks_before     = rcmp::hook_count();
+
+    auto first = rcmp::hook_function_scoped<class F16Tag1, decltype(f16)>(function, [](auto original, int arg) {
+        return original(arg) * 2;
+    });
+    auto second = rcmp::hook_function_scoped<class F16Tag2, decltype(f16)>(function, [](auto original, int arg) {
+        return original(arg) * 3;
+    });
+    CHECK(f16(1) == 102);
+
+    CHECK(rcmp::hooked_function_count() == functions_before + 1);
+    CHECK(rcmp::hook_count() == hooks_before + 2);
+
+    const auto info = rcmp::find_hooked_function(function);
+    REQUIRE(info.has_value());
+    CHECK(info->function == function);
+    CHECK(info->hook_count == 2);
+    CHECK(info->patched);
+    CHECK(info->patched_code.begin == function);
+    CHECK(info->patched_code.end > function);
+
+    // every piece of code maps back to the function
+    for (const auto& range : { info->patched_code, info->relocated_prolog, info->dispatcher }) {
+        CHECK(rcmp::find_hooked_function_by_code(range.begin)->function == function);
+        CHECK(rcmp::find_hooked_function_by_code(range.end - 1)->function == function);
+    }
+
+    CHECK(rcmp::get_original(function) == info->relocated_prolog.begin);
+    CHECK(rcmp::call_original<decltype(f16)>(function, 1) == 17);
+
+    const auto functions = rcmp::hooked_functions();
+    CHECK(std::is_sorted(functions.begin(), functions.end(), [](const rcmp::hooked_function_info& lhs, const rcmp::hooked_function_info& rhs) {
+        return lhs.function < rhs.function;
+    }));
+    CHECK(std::count_if(functions.begin(), functions.end(), [function](const rcmp::hooked_function_info& hooked) {
+        return hooked.function == function;
+    }) == 1);
+
+    first.disable();
+    second.disable();
+    CHECK_FALSE(rcmp::find_hooked_function(function)->patched);
+
+    {
+        // not visible until commit
+        rcmp::hook_batch batch;
+        first.uninstall();
+        CHECK_FALSE(first.installed());
+        CHECK(rcmp::find_hooked_function(function)->hook_count == 2);
+    }
+    CHECK(first.installed());
+    CHECK(rcmp::find_hooked_function(function)->hook_count == 2);
+
+    first.uninstall();
+    second.uninstall();
+    CHECK_FALSE(rcmp::find_hooked_function(function).has_value());
+    CHECK_FALSE(rcmp::find_hooked_function_by_code(info->relocated_prolog.begin).has_value());
+    CHECK(rcmp::hooked_function_count() == functions_before);
+    CHECK(rcmp::hook_count() == hooks_before);
+}
+
+template <int N>
+NO_OPTIMIZE int parallel_target(int arg) {
+    return arg + N;
+}
+
+NO_OPTIMIZE
+int f17(int arg) {
+    return arg + 17;
+}
+
+template <std::size_t... I>
+void hook_in_parallel(std::index_sequence<I...>) {
+    std::mutex                     handles_mutex;
+    std::vector<rcmp::hook_handle> shared_hooks;
+    std::atomic<int>               unexpected_results = 0;
+
+    const auto worker = [&](auto function) {
+        for (int i = 1; i <= 20; i++) {
+            const auto handle = rcmp::hook_function_stateless_scoped<int(*)(int)>(rcmp::bit_cast<const void*>(function), [i](auto original, int arg) {
+                return original(arg) * i;
+            });
+
+            if (function(1) - function(0) != i) {
+                unexpected_results++;
+            }
+        }
+
+        auto shared = rcmp::hook_function_stateless_scoped<decltype(&f17)>(rcmp::bit_cast<const void*>(&f17), [](auto original, int arg) {
+            return original(arg) + 1;
+        });
+
+        const std::lock_guard lock(handles_mutex);
+        shared_hooks.push_back(std::move(shared));
+    };
+
+    std::vector<std::thread> threads;
+    (threads.emplace_back(worker, &parallel_target<I>), ...);
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    CHECK(unexpected_results == 0);
+    CHECK(f17(0) == 17 + static_cast<int>(sizeof...(I)));
+
+    shared_hooks.clear();
+    CHECK(f17(0) == 17);
+}
+
+TEST_CASE("Hooks installed from many threads") {
+    hook_in_parallel(std::make_index_sequence<8>{});
+}
+
+NO_OPTIMIZE
+int f18(int arg) {
+    return arg + 18;
+}
+
+NO_OPTIMIZE
+int f18_hot_caller(int arg) {
+    return f18(arg) * 2;
+}
+
+NO_OPTIMIZE
+int f18_cold_caller(int arg) {
+    return f18(arg) * 3;
+}
+
+// Address of `call rel32` to `callee` inside of `caller`
+rcmp::address_t find_call(rcmp::address_t caller, rcmp::address_t callee) {
+    for (rcmp::address_t it = caller; it < caller + 0x100; it += 1) {
+        if (*it.as_ptr<const std::uint8_t>() != 0xE8) {
+            continue;
+        }
+
+        std::int32_t offset = 0;
+        std::memcpy(&offset, (it + 1).as_ptr(), sizeof(offset));
+
+        if (it + 5 + offset == callee) {
+            return it;
+        }
+    }
+
+    return nullptr;
+}
+
+TEST_CASE("Call site hook") {
+    REQUIRE(f18_hot_caller(1) == 38);
+    REQUIRE(f18_cold_caller(1) == 57);
+
+    const auto call_site = find_call(rcmp::bit_cast<const void*>(&f18_hot_caller), rcmp::bit_cast<const void*>(&f18));
+    REQUIRE(call_site != nullptr);
+
+    std::array<std::uint8_t, 5> original_bytes;
+    std::memcpy(original_bytes.data(), call_site.as_ptr(), original_bytes.size());
+
+    {
+        auto handle = rcmp::hook_call_site_scoped<decltype(f18)>(call_site, [](auto original, int arg) {
+            return original(arg) + 100;
+        });
+
+        // only the hooked call is affected
+        CHECK(f18_hot_caller(1) == 238);
+        CHECK(f18_cold_caller(1) == 57);
+        CHECK(f18(1) == 19);
+
+        // function hook is still called from the hooked call site
+        auto function_handle = rcmp::hook_function_scoped<decltype(f18)>(rcmp::bit_cast<const void*>(&f18), [](auto original, int arg) {
+            return original(arg) * 10;
+        });
+        CHECK(f18_hot_caller(1) == 580);
+        CHECK(f18_cold_caller(1) == 570);
+        function_handle.uninstall();
+
+        auto inner = rcmp::hook_call_site_scoped<decltype(f18)>(call_site, [](auto original, int arg) {
+            return original(arg + 1);
+        });
+        CHECK(f18_hot_caller(1) == 240);
+
+        // call site hooks must be uninstalled in reverse order
+        CHECK_THROWS_WITH(handle.uninstall(), Catch::Contains("overridden by another hook"));
+        inner.uninstall();
+
+        handle.disable();
+        CHECK(f18_hot_caller(1) == 38);
+        CHECK(std::memcmp(call_site.as_ptr(), original_bytes.data(), original_bytes.size()) == 0);
+
+        handle.enable();
+        CHECK(f18_hot_caller(1) == 238);
+    }
+
+    CHECK(std::memcmp(call_site.as_ptr(), original_bytes.data(), original_bytes.size()) == 0);
+    CHECK(f18_hot_caller(1) == 38);
+
+    // `call [X]` through a slot shared with other callers, the slot itself isn't changed
+    const auto stub_code = rcmp::allocate_code(0x20);
+    const rcmp::address_t stub = stub_code.get();
+    const rcmp::address_t slot = stub + 0x18;
+    *slot.as_ptr<int(*)(int)>() = &f18;
+
+#if RCMP_GET_ARCH() == RCMP_ARCH_X86_64
+    // sub rsp, 0x28; call [rip + X]; add rsp, 0x28; ret
+    std::array<std::uint8_t, 15> code{{ 0x48, 0x83, 0xEC, 0x28, 0xFF, 0x15, 0, 0, 0, 0, 0x48, 0x83, 0xC4, 0x28, 0xC3 }};
+    const auto disp = static_cast<std::int32_t>(slot - (stub + 10));
+#else
+    // push [esp + 4]; call [X]; add esp, 4; ret
+    std::array<std::uint8_t, 14> code{{ 0xFF, 0x74, 0x24, 0x04, 0xFF, 0x15, 0, 0, 0, 0, 0x83, 0xC4, 0x04, 0xC3 }};
+    const auto disp = static_cast<std::uint32_t>(slot.as_number());
+#endif
+    constexpr std::size_t call_offset = 4;
+    std::memcpy(code.data() + call_offset + 2, &disp, sizeof(disp));
+    std::memcpy(stub.as_ptr(), code.data(), code.size());
+
+    const auto call_stub = stub.as<int(*)(int)>();
+    REQUIRE(call_stub(1) == 19);
+
+    {
+        const auto handle = rcmp::hook_call_site_scoped<decltype(f18)>(stub + call_offset, [](auto original, int arg) {
+            return original(arg) * 5;
+        });
+
+        CHECK(call_stub(1) == 95);
+        CHECK(*slot.as_ptr<int(*)(int)>() == &f18);
+    }
+
+    CHECK(call_stub(1) == 19);
+
+    // not a call
+    CHECK_THROWS_WITH((rcmp::hook_call_site<decltype(f18)>(rcmp::bit_cast<const void*>(&f18_cold_caller), [](auto original, int arg) {
+        return original(arg);
+    })), Catch::Contains("not a `call"));
+    CHECK(f18_cold_caller(1) == 57);
+}
+
+NO_OPTIMIZE
+int f19(int arg) {
+    return arg + 19;
+}
+
+NO_OPTIMIZE
+int f19_caller(int arg) {
+    return f19(arg) * 2;
+}
+
+TEST_CASE("Hook function and its call sites") {
+    int (* volatile indirect)(int) = &f19;
+
+    REQUIRE(f19_caller(1) == 40);
+    REQUIRE(indirect(1) == 20);
+
+    const rcmp::address_t function = rcmp::bit_cast<const void*>(&f19);
+    const auto call_site = find_call(rcmp::bit_cast<const void*>(&f19_caller), function);
+    REQUIRE(call_site != nullptr);
+
+    const auto branches = rcmp::find_direct_branches(function);
+    CHECK(std::find(branches.begin(), branches.end(), call_site) != branches.end());
+    CHECK(std::is_sorted(branches.begin(), branches.end()));
+
+    // not a branch to the function
+    CHECK_THROWS_AS(rcmp::hook_function_and_call_sites_scoped<&f19>({ rcmp::bit_cast<const void*>(&f19_caller) }, [](auto original, int arg) {
+        return original(arg);
+    }), rcmp::error);
+    CHECK_FALSE(rcmp::find_hooked_function(function).has_value());
+
+    {
+        auto handle = rcmp::hook_function_and_call_sites_scoped<&f19>({ call_site }, [](auto original, int arg) {
+            return original(arg) * 10;
+        });
+
+        CHECK(f19_caller(1) == 400);
+        CHECK(indirect(1) == 200);
+
+        // direct call goes to the dispatcher, bypassing entry jump
+        CHECK(find_call(rcmp::bit_cast<const void*>(&f19_caller), function) == nullptr);
+        CHECK(rcmp::find_hooked_function(function).has_value());
+
+        handle.disable();
+        CHECK(find_call(rcmp::bit_cast<const void*>(&f19_caller), function) == call_site);
+        CHECK(f19_caller(1) == 40);
+        CHECK(indirect(1) == 20);
+
+        handle.enable();
+        CHECK(f19_caller(1) == 400);
+        CHECK(indirect(1) == 200);
+
+        // hooks installed later are seen by retargeted callers as well
+        {
+            const auto later = rcmp::hook_function_scoped<decltype(f19)>(function, [](auto original, int arg) {
+                return original(arg) + 1;
+            });
+            CHECK(f19_caller(1) == 402);
+            CHECK(indirect(1) == 201);
+        }
+
+        CHECK(f19_caller(1) == 400);
+        CHECK(indirect(1) == 200);
+    }
+
+    CHECK(find_call(rcmp::bit_cast<const void*>(&f19_caller), function) == call_site);
+    CHECK_FALSE(rcmp::find_hooked_function(function).has_value());
+    CHECK(f19_caller(1) == 40);
+    CHECK(indirect(1) == 20);
+}
+
+struct Connection {
+    int id;
+
+    explicit Connection(int id) : id(id) {}
+
+    NO_OPTIMIZE
+    virtual int send(int size) const {
+        return size + id;
+    }
+
+    NO_OPTIMIZE
+    virtual int receive(int size) const {
+        return size - id;
+    }
+};
+
+// prevent devirtualization
+NO_OPTIMIZE
+int call_send(const Connection& connection, int size) {
+    return connection.send(size);
+}
+
+NO_OPTIMIZE
+int call_receive(const Connection& connection, int size) {
+    return connection.receive(size);
+}
+
+// vtable has vbase offset before the type info
+struct SharedConnection : virtual Connection {
+    explicit SharedConnection(int id) : Connection(id) {}
+};
+
+TEST_CASE("Instance method hook") {
+    using method_t = rcmp::generic_signature_t<int(const Connection*, int), member_function_conv>;
+
+    Connection hot(1);
+    Connection cold(2);
+
+    const auto vtable_of = [](const Connection& connection) {
+        return *rcmp::bit_cast<const rcmp::address_t*>(&connection);
+    };
+
+    const auto original_vtable = vtable_of(hot);
+    REQUIRE(vtable_of(cold) == original_vtable);
+
+    auto send_hook = rcmp::hook_instance_method_scoped<method_t>(&hot, 0, [](auto original, auto self, int size) {
+        return original(self, size) * 10;
+    });
+
+    // only the cloned object is affected
+    CHECK(call_send(hot, 5) == 60);
+    CHECK(call_send(cold, 5) == 7);
+    CHECK(vtable_of(cold) == original_vtable);
+    CHECK(vtable_of(hot) != original_vtable);
+    CHECK(typeid(hot) == typeid(Connection));
+
+    // hooks of the same object share the copy, each one has its own state
+    auto receive_hook = rcmp::hook_instance_method_scoped<method_t>(&hot, 1, [factor = 3](auto original, auto self, int size) {
+        return original(self, size) * factor;
+    });
+    const auto cloned_vtable = vtable_of(hot);
+
+    CHECK(call_receive(hot, 5) == 12);
+    CHECK(call_receive(cold, 5) == 3);
+
+    auto inner = rcmp::hook_instance_method_scoped<method_t>(&hot, 0, [](auto original, auto self, int size) {
+        return original(self, size) + 1;
+    });
+    CHECK(call_send(hot, 5) == 61);
+
+    CHECK_THROWS_WITH(send_hook.uninstall(), Catch::Contains("overridden by another hook"));
+    inner.uninstall();
+
+    send_hook.disable();
+    CHECK(call_send(hot, 5) == 6);
+    send_hook.enable();
+    CHECK(call_send(hot, 5) == 60);
+
+    send_hook.uninstall();
+    CHECK(call_send(hot, 5) == 6);
+    CHECK(vtable_of(hot) == cloned_vtable);
+
+    // the last hook switches the object back
+    receive_hook.uninstall();
+    CHECK(vtable_of(hot) == original_vtable);
+    CHECK(call_receive(hot, 5) == 4);
+
+    CHECK_THROWS_WITH((rcmp::hook_instance_method<method_t>(&cold, 100, [](auto original, auto self, int size) {
+        return original(self, size);
+    })), Catch::Contains("its vtable has"));
+    CHECK(vtable_of(cold) == original_vtable);
+
+#if !defined(_MSC_VER)
+    SharedConnection shared(3);
+    CHECK_THROWS_WITH((rcmp::hook_instance_method<method_t>(&shared, 0, [](auto original, auto self, int size) {
+        return original(self, size);
+    })), Catch::Contains("has virtual bases"));
+    CHECK(call_send(shared, 5) == 8);
+#endif
+}
+
+NO_OPTIMIZE
+int f10(int arg) {
+    return arg + 10;
+}
+
+TEST_CASE("Scoped indirect hook") {
+    int (*table[1])(int) = { &f10 };
+
+    const auto call = [&table](int arg) {
+        return reinterpret_cast<int(* volatile*)(int)>(table)[0](arg);
+    };
+
+    REQUIRE(call(1) == 11);
+
+    {
+        const auto handle = rcmp::hook_indirect_function_scoped<decltype(f10)>(&table[0], [](auto original, int arg) {
+            return original(arg) * 2;
+        });
+
+        CHECK(call(1) == 22);
+    }
+
+    CHECK(table[0] == &f10);
+    CHECK(call(1) == 11);
+
+    auto outer = rcmp::hook_indirect_function_scoped<decltype(f10)>(&table[0], [](auto original, int arg) {
+        return original(arg) * 2;
+    });
+    auto inner = rcmp::hook_indirect_function_scoped<decltype(f10)>(&table[0], [](auto original, int arg) {
+        return original(arg) + 1;
+    });
+    CHECK(call(1) == 23);
+
+    // indirect hooks must be uninstalled in reverse order
+    CHECK_THROWS_WITH(outer.uninstall(), Catch::Contains("overridden by another hook"));
+    CHECK(outer.installed());
+    CHECK(call(1) == 23);
+
+    inner.disable();
+    CHECK(call(1) == 22);
+
+    outer.disable();
+    CHECK(call(1) == 11);
+
+    // hooks are toggled in reverse order too
+    CHECK_THROWS_WITH(inner.enable(), Catch::Contains("overridden by another hook"));
+    CHECK_FALSE(inner.enabled());
+
+    inner.uninstall();
+    CHECK(call(1) == 11);
+
+    outer.enable();
+    CHECK(call(1) == 22);
+
+    outer.disable();
+    outer.uninstall();
+    CHECK(call(1) == 11);
+}
+
+NO_OPTIMIZE
+int f11(int arg) {
+    return arg + 11;
+}
+
+#if RCMP_GET_ARCH() == RCMP_ARCH_X86 || RCMP_GET_ARCH() == RCMP_ARCH_X86_64
+template <std::size_t... I>
+void install_passthrough_hooks(std::index_sequence<I...>) {
+    (rcmp::hook_function<std::integral_constant<std::size_t, I>, decltype(f11)>(rcmp::bit_cast<const void*>(f11), [](auto original, int arg) {
+        return original(arg);
+    }), ...);
+}
+
+NO_OPTIMIZE
+int f20(int arg) {
+    return arg + 20;
+}
+
+TEST_CASE("Live patching") {
+    if (!rcmp::is_patch_mode_supported(rcmp::patch_mode::live)) {
+        WARN("live patching is not supported by the system");
+        return;
+    }
+
+    REQUIRE(f11(1) == 12);
+    REQUIRE(f20(1) == 21);
+
+    rcmp::set_patch_mode(rcmp::patch_mode::live);
+    const rcmp::detail::scope_exit restore_mode = [] {
+        rcmp::set_patch_mode(rcmp::patch_mode::plain);
+    };
+
+    std::atomic<bool> stop = false;
+    std::atomic<int>  unexpected_results = 0;
+
+    {
+        std::thread caller([&stop, &unexpected_results] {
+            while (!stop) {
+                if (f11(1) != 12 || f20(1) != 21) {
+                    unexpected_results++;
+                }
+            }
+        });
+
+        const rcmp::detail::scope_exit stop_caller = [&stop, &caller] {
+            stop = true;
+            caller.join();
+        };
+
+        // every hook relocates prolog that is being executed by `caller`
+        install_passthrough_hooks(std::make_index_sequence<32>{});
+
+        // the last hook takes relocated prolog and dispatcher away, while `caller` may be running them
+        for (int i = 0; i < 200; i++) {
+            auto handle = rcmp::hook_function_scoped<decltype(f20)>(rcmp::bit_cast<const void*>(f20), [](auto original, int arg) {
+                return original(arg);
+            });
+        }
+    }
+
+    CHECK(unexpected_results == 0);
+    CHECK(f11(1) == 12);
+    CHECK(f20(1) == 21);
+}
 #endif
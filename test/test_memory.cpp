@@ -0,0 +1,102 @@
+#include "catch2/catch.hpp"
+
+#include <rcmp/memory.hpp>
+
+#include <array>
+#include <cstdlib>
+#include <cstdio>
+#include <string>
+
+TEST_CASE("Code arena") {
+    auto near = rcmp::bit_cast<const void*>(&std::abort);
+
+    auto first  = rcmp::allocate_code(10, near);
+    auto second = rcmp::allocate_code(10, near);
+
+    REQUIRE(first != nullptr);
+    REQUIRE(second != nullptr);
+
+#if RCMP_GET_ARCH() == RCMP_ARCH_X86_64
+    const auto distance = [near](rcmp::address_t address) {
+        return address > near ? address - near : near - address;
+    };
+
+    CHECK(distance(first.get()) < 0x7FFFFFFF);
+    CHECK(distance(second.get()) < 0x7FFFFFFF);
+#endif
+
+    // Small trampolines are packed together
+    CHECK(rcmp::address_t(second.get()) - rcmp::address_t(first.get()) == 16);
+
+    // Freed memory is reused
+    const rcmp::address_t first_address = first.get();
+    first.reset();
+
+    auto third = rcmp::allocate_code(16, near);
+    CHECK(rcmp::address_t(third.get()) == first_address);
+
+    // Memory is executable and writable
+    third[0] = std::byte{ 0xC3 }; // ret
+    rcmp::bit_cast<void(*)()>(third.get())();
+}
+
+#if RCMP_GET_PLATFORM() == RCMP_PLATFORM_LINUX
+static std::string page_permissions(rcmp::address_t address) {
+    std::string result;
+
+    std::FILE* maps = std::fopen("/proc/self/maps", "r");
+    REQUIRE(maps != nullptr);
+
+    char line[512];
+    while (std::fgets(line, sizeof(line), maps)) {
+        unsigned long long begin = 0, end = 0;
+        char permissions[5] = {};
+        if (std::sscanf(line, "%llx-%llx %4s", &begin, &end, permissions) == 3 && begin <= address.as_number() && address.as_number() < end) {
+            result = permissions;
+        }
+    }
+
+    std::fclose(maps);
+    return result;
+}
+#endif
+
+static const int g_read_only_value = 1;
+
+TEST_CASE("Protection scope") {
+    const rcmp::address_t address = &g_read_only_value;
+    const auto value = [address] { return *address.as_ptr<const volatile int>(); };
+
+#if RCMP_GET_PLATFORM() == RCMP_PLATFORM_LINUX
+    const auto original_permissions = page_permissions(address);
+    REQUIRE(original_permissions[1] == '-');
+#endif
+
+    {
+        rcmp::protection_scope outer(address, sizeof(int));
+        {
+            const rcmp::protection_scope inner(address, sizeof(int));
+            *address.as_ptr<volatile int>() = 2;
+        }
+
+        // page is still held by the outer scope
+        *address.as_ptr<volatile int>() = 3;
+
+        // empty scope takes ownership
+        rcmp::protection_scope moved = std::move(outer);
+        *address.as_ptr<volatile int>() = 4;
+    }
+
+    CHECK(value() == 4);
+
+#if RCMP_GET_PLATFORM() == RCMP_PLATFORM_LINUX
+    CHECK(page_permissions(address) == original_permissions);
+#endif
+
+    rcmp::set_opcode(address, std::array<std::uint8_t, sizeof(int)>{{ 5, 0, 0, 0 }});
+    CHECK(value() == 5);
+
+#if RCMP_GET_PLATFORM() == RCMP_PLATFORM_LINUX
+    CHECK(page_permissions(address) == original_permissions);
+#endif
+}
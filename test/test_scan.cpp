@@ -0,0 +1,135 @@
+#include "catch2/catch.hpp"
+
+#include <rcmp/scan.hpp>
+#include <rcmp/detail/exception.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Matches of `pattern` found byte by byte
+std::vector<rcmp::address_t> find_naive(const rcmp::byte_pattern& pattern, const std::vector<std::uint8_t>& data) {
+    std::vector<rcmp::address_t> result;
+
+    for (std::size_t i = 0; i + pattern.size() <= data.size(); i++) {
+        bool matches = true;
+        for (std::size_t j = 0; j < pattern.size() && matches; j++) {
+            matches = (data[i + j] & pattern.mask()[j]) == pattern.bytes()[j];
+        }
+
+        if (matches) {
+            result.emplace_back(data.data() + i);
+        }
+    }
+
+    return result;
+}
+
+#if RCMP_GET_COMPILER() == RCMP_COMPILER_MSVC
+__declspec(noinline)
+#else
+[[gnu::noinline]]
+#endif
+int scan_target(int a, int b) {
+    return a * 3 + b * 7 - (a ^ b);
+}
+
+} // unnamed namespace
+
+TEST_CASE("Byte pattern") {
+    const rcmp::byte_pattern pattern("E8 ?? ?  ab\t0F ");
+
+    REQUIRE(pattern.size() == 5);
+    CHECK(std::vector<std::uint8_t>(pattern.bytes(), pattern.bytes() + 5) == std::vector<std::uint8_t>{ 0xE8, 0x00, 0x00, 0xAB, 0x0F });
+    CHECK(std::vector<std::uint8_t>(pattern.mask(), pattern.mask() + 5) == std::vector<std::uint8_t>{ 0xFF, 0x00, 0x00, 0xFF, 0xFF });
+
+    CHECK_THROWS_WITH(rcmp::byte_pattern("E8 ?? XY"), Catch::Contains("unexpected \"XY\""));
+    CHECK_THROWS_WITH(rcmp::byte_pattern("E8 123"), Catch::Contains("unexpected \"123\""));
+    CHECK_THROWS_WITH(rcmp::byte_pattern("?? ??"), Catch::Contains("no exact bytes"));
+    CHECK_THROWS_WITH(rcmp::byte_pattern(""), Catch::Contains("no exact bytes"));
+}
+
+TEST_CASE("Pattern scan") {
+    // Several chunks, so the buffer is scanned by several threads. Few distinct bytes give a lot of candidates.
+    std::vector<std::uint8_t> data(0x40000 * 3 + 123);
+
+    std::mt19937 random(42);
+    for (auto& byte : data) {
+        byte = static_cast<std::uint8_t>(random() % 4);
+    }
+
+    const rcmp::byte_pattern marker("11 22 ?? 33 44 55 66 77 88 99 AA BB CC DD EE FF 10 ?? 12");
+    const auto put_marker = [&data](std::size_t offset) {
+        const std::uint8_t bytes[] = { 0x11, 0x22, 0x00, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF, 0x10, 0x01, 0x12 };
+        std::memcpy(data.data() + offset, bytes, sizeof(bytes));
+    };
+
+    // buffer edges and chunk boundary
+    put_marker(0);
+    put_marker(0x40000 - 5);
+    put_marker(data.size() - marker.size());
+
+    const auto markers = rcmp::find_pattern(marker, data.data(), data.size());
+    CHECK(markers == std::vector<rcmp::address_t>{ data.data(), data.data() + 0x40000 - 5, data.data() + data.size() - marker.size() });
+
+    // Shorter buffer ends before the last marker
+    CHECK(rcmp::find_pattern(marker, data.data(), data.size() - 1).size() == 2);
+
+    for (const auto signature : { "01", "03 ?? 02", "00 01 02 03", "?? 02 02 ?? 01 ??", "01 ?? ?? ?? ?? ?? ?? ?? ?? ?? ?? ?? ?? ?? ?? ?? ?? ?? 02 01" }) {
+        const rcmp::byte_pattern pattern(signature);
+
+        INFO(signature);
+        CHECK(rcmp::find_pattern(pattern, data.data(), data.size()) == find_naive(pattern, data));
+    }
+}
+
+TEST_CASE("Module pattern scan") {
+    const auto code = rcmp::bit_cast<const std::uint8_t*>(&scan_target);
+
+    std::string signature;
+    for (std::size_t i = 0; i < 12; i++) {
+        if (i % 3 == 1) {
+            signature += "?? ";
+            continue;
+        }
+
+        signature += "0123456789ABCDEF"[code[i] / 16];
+        signature += "0123456789ABCDEF"[code[i] % 16];
+        signature += " ";
+    }
+
+    const std::vector<rcmp::byte_pattern> patterns{ rcmp::byte_pattern(signature), rcmp::byte_pattern("F1 F2 F3 F4 F5 F6 F7 F8 F9") };
+
+    const auto contains_target = [code](const std::vector<rcmp::address_t>& matches) {
+        return std::find(matches.begin(), matches.end(), rcmp::address_t(code)) != matches.end();
+    };
+
+    // main executable, every module
+    CHECK(contains_target(rcmp::find_pattern(patterns[0], "")));
+    CHECK(contains_target(rcmp::find_pattern(patterns[0])));
+
+    const auto matches = rcmp::find_patterns(patterns, "");
+    REQUIRE(matches.size() == 2);
+    CHECK(contains_target(matches[0]));
+    CHECK(matches[1].empty());
+
+    CHECK(rcmp::find_pattern(patterns[0], "no-such-module.so").empty());
+    CHECK(scan_target(1, 2) == 14);
+}
+
+TEST_CASE("Relative operand") {
+    std::uint8_t call[5] = { 0xE8 };
+
+    const std::int32_t forward = 0x1234;
+    std::memcpy(call + 1, &forward, sizeof(forward));
+    CHECK(rcmp::resolve_rel32(call, 1, 5) == rcmp::address_t(call) + 5 + 0x1234);
+
+    const std::int32_t backward = -0x20;
+    std::memcpy(call + 1, &backward, sizeof(backward));
+    CHECK(rcmp::resolve_rel32(call, 1, 5) == rcmp::address_t(call) + 5 - 0x20);
+}
@@ -0,0 +1 @@
+#include <rcmp/batch.hpp>
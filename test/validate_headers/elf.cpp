@@ -0,0 +1 @@
+#include <rcmp/elf.hpp>
\ No newline at end of file
@@ -0,0 +1 @@
+#include <rcmp/hook_handle.hpp>
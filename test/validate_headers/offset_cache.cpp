@@ -0,0 +1 @@
+#include <rcmp/offset_cache.hpp>
\ No newline at end of file
@@ -0,0 +1 @@
+#include <rcmp/registry.hpp>
\ No newline at end of file
@@ -0,0 +1 @@
+#include <rcmp/scan.hpp>
\ No newline at end of file
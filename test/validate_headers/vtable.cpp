@@ -0,0 +1 @@
+#include <rcmp/vtable.hpp>
\ No newline at end of file